@@ -5,134 +5,779 @@
  * Modified on 2024-12-11 to support prefetching
  */
 
+#include <cstdarg>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include "Cache.h"
+#include "Checkpoint.h"
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Finds the way of a set whose key equals key, or returns -1. For 32-bit
+// keys compares four (SSE2/NEON) or eight (AVX2) ways per instruction;
+// small sets and the tail of a set are scanned with the scalar loop. Valid
+// tags are unique within a set, so the first match is the only one
+static inline uint32_t findWay(const uint32_t *keys, uint32_t ways,
+                               uint32_t key) {
+    uint32_t i = 0;
+#if defined(__AVX2__)
+    __m256i key8 = _mm256_set1_epi32(key);
+    for (; i + 8 <= ways; i += 8) {
+        __m256i v = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(keys + i));
+        __m256i eq = _mm256_cmpeq_epi32(v, key8);
+        uint32_t mask = _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+#endif
+#if defined(__SSE2__)
+    __m128i key4 = _mm_set1_epi32(key);
+    for (; i + 4 <= ways; i += 4) {
+        __m128i v = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(keys + i));
+        __m128i eq = _mm_cmpeq_epi32(v, key4);
+        uint32_t mask = _mm_movemask_ps(_mm_castsi128_ps(eq));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+#elif defined(__ARM_NEON)
+    uint32x4_t key4 = vdupq_n_u32(key);
+    for (; i + 4 <= ways; i += 4) {
+        uint32x4_t eq = vceqq_u32(vld1q_u32(keys + i), key4);
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u16(vmovn_u32(eq)), 0);
+        if (mask) return i + (__builtin_ctzll(mask) >> 4);
+    }
+#endif
+    for (; i < ways; ++i) {
+        if (keys[i] == key) return i;
+    }
+    return -1;
+}
+
+// 64-bit keys: two (SSE2/NEON) or four (AVX2) ways per instruction. SSE2
+// has no 64-bit compare, so both 32-bit halves of a way have to match
+static inline uint32_t findWay(const uint64_t *keys, uint32_t ways,
+                               uint64_t key) {
+    uint32_t i = 0;
+#if defined(__AVX2__)
+    __m256i key4 = _mm256_set1_epi64x(key);
+    for (; i + 4 <= ways; i += 4) {
+        __m256i v = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(keys + i));
+        __m256i eq = _mm256_cmpeq_epi64(v, key4);
+        uint32_t mask = _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+#endif
+#if defined(__SSE2__)
+    __m128i key2 = _mm_set1_epi64x(key);
+    for (; i + 2 <= ways; i += 2) {
+        __m128i v = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(keys + i));
+        __m128i eq = _mm_cmpeq_epi32(v, key2);
+        eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+        uint32_t mask = _mm_movemask_pd(_mm_castsi128_pd(eq));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    uint64x2_t key2 = vdupq_n_u64(key);
+    for (; i + 2 <= ways; i += 2) {
+        uint64x2_t eq = vceqq_u64(vld1q_u64(keys + i), key2);
+        if (vgetq_lane_u64(eq, 0)) return i;
+        if (vgetq_lane_u64(eq, 1)) return i + 1;
+    }
+#endif
+    for (; i < ways; ++i) {
+        if (keys[i] == key) return i;
+    }
+    return -1;
+}
 
 // Constructor: Initializes the cache with given parameters
-Cache::Cache(MemoryManager *manager, Policy policy, Cache *lowerCache,
-             bool writeBack, bool writeAllocate) {
-    referenceCounter = 0;
+template <typename Addr>
+BasicCache<Addr>::BasicCache(Memory *manager, Policy policy,
+                             BasicCache *lowerCache, bool writeBack,
+                             bool writeAllocate, bool timingOnly) {
     memory = manager;
     this->policy = policy;
     this->lowerCache = lowerCache;
+    this->timingOnly = timingOnly;
+    upperCache = nullptr;
+    victimCache = nullptr;
+    victimBuffer = false;
+    fillDirty = false;
+    prefetcher = nullptr;
+    lateAccesses = 0;
+    evictionTracking = false;
 
-    if (!isPolicyValid()) {
-        fprintf(stderr, "Policy invalid!\n");
-        exit(-1);
+    if (lowerCache != nullptr) {
+        lowerCache->upperCache = this;
+    }
+    inclusiveBelow = false;
+    for (BasicCache *c = lowerCache; c != nullptr; c = c->lowerCache) {
+        if (c->policy.inclusion == INCLUSIVE)
+            inclusiveBelow = true;
+    }
+
+    // The victim cache sits between this level and the one below
+    if (policy.victimBlocks > 0) {
+        Policy victimPolicy = {policy.victimBlocks * policy.blockSize,
+                               policy.blockSize,
+                               policy.victimBlocks,
+                               policy.victimBlocks,
+                               policy.hitLatency,
+                               0,
+                               ReplacementPolicy::LRU,
+                               EXCLUSIVE,
+                               0};
+        victimCache = new BasicCache(manager, victimPolicy, lowerCache, true,
+                                     true, timingOnly);
+        victimCache->victimBuffer = true;
+        victimCache->upperCache = this;
+        this->lowerCache = victimCache;
     }
 
+    initAddressDecoding();
     initCache();
-    statistics = Statistics{0, 0, 0, 0, 0};
+    statistics = Statistics();
+#ifdef CACHESIM_PROFILE
+    profile = Profile();
+    setProfiles.assign(getSetNum(), Profile());
+#endif
     this->writeBack = writeBack;
     this->writeAllocate = writeAllocate;
 }
 
+// Constructs a cache after checking its policy
+template <typename Addr>
+BasicCache<Addr> *BasicCache<Addr>::create(Memory *manager, Policy policy,
+                                           BasicCache *lowerCache,
+                                           bool writeBack, bool writeAllocate,
+                                           bool timingOnly,
+                                           std::string *error) {
+    if (!isPolicyValid(policy, error)) {
+        return nullptr;
+    }
+    return new BasicCache(manager, policy, lowerCache, writeBack,
+                          writeAllocate, timingOnly);
+}
+
+template <typename Addr>
+BasicCache<Addr>::~BasicCache() {
+    delete replacement;
+    delete prefetcher;
+    delete victimCache;
+}
+
 // Checks if the address is present in the cache
-bool Cache::inCache(uint32_t addr) {
+template <typename Addr>
+bool BasicCache<Addr>::inCache(Addr addr) {
     return getBlockId(addr) != -1;
 }
 
 // Retrieves the block ID for a given address
-uint32_t Cache::getBlockId(uint32_t addr) {
-    uint32_t tag = getTag(addr);
-    uint32_t id = getId(addr);
+template <typename Addr>
+uint32_t BasicCache<Addr>::getBlockId(Addr addr) {
+    return (this->*lookup)(addr);
+}
 
-    for (uint32_t i = id * policy.associativity; i < (id + 1) * policy.associativity; ++i) {
-        if (blocks[i].id != id) {
-            fprintf(stderr, "Inconsistent ID in block %d\n", i);
-            exit(-1);
-        }
-        if (blocks[i].valid && blocks[i].tag == tag) {
-            return i;
+// Block lookup for any configuration
+template <typename Addr>
+uint32_t BasicCache<Addr>::lookupGeneric(Addr addr) {
+    uint32_t begin = getId(addr) * policy.associativity;
+    uint32_t way = findWay(&keys[begin], policy.associativity,
+                           makeKey(getTag(addr)));
+    return way == uint32_t(-1) ? way : begin + way;
+}
+
+// Compile-time integer log base 2
+static constexpr uint32_t log2Const(uint32_t val) {
+    return val <= 1 ? 0 : 1 + log2Const(val >> 1);
+}
+
+// Block lookup with block size and associativity known at compile time
+template <typename Addr>
+template <uint32_t BlockSize, uint32_t Associativity>
+uint32_t BasicCache<Addr>::lookupFixed(Addr addr) {
+    const uint32_t blockBits = log2Const(BlockSize);
+    Addr tag = addr >> (blockBits + idBits);
+    uint32_t begin = ((addr >> blockBits) & idMask) * Associativity;
+    uint32_t way = findWay(&keys[begin], Associativity, makeKey(tag));
+    return way == uint32_t(-1) ? way : begin + way;
+}
+
+// Looks up an address for a read, loading its block on a miss, and charges
+// the access to stats. Returns the block ID, or -1 for an access to a set
+// that is not sampled. Shared by the single, batched and block accesses;
+// batches keep their statistics in a local copy. Prefetches count apart
+// from the demand reads, hits and misses
+template <typename Addr>
+inline uint32_t BasicCache<Addr>::readBlock(Addr addr, uint32_t *cycles,
+                                            bool is_prefetch,
+                                            Statistics &stats) {
+    if (!sampledSets.empty() && !sampleAccess(addr, !is_prefetch)) {
+        return -1;
+    }
+    if (is_prefetch) {
+        stats.numPrefetch++;
+    } else {
+        stats.numRead++;
+    }
+
+    uint32_t blockId = getBlockId(addr);
+    if (blockId != uint32_t(-1)) {
+        stats.totalCycles += policy.hitLatency;
+        replacement->onHit(blockId >> wayBits, blockId & wayMask);
+        if (cycles) *cycles = policy.hitLatency;
+        if (!is_prefetch) {
+            stats.numHit++;
+#ifdef CACHESIM_PROFILE
+            profileAccess(addr, false);
+#endif
+            if (prefetched[blockId] != 0 || prefetcher != nullptr)
+                observeHit(addr, blockId, stats);
         }
+        return blockId;
     }
-    return -1;
-}
 
-// Retrieves a byte from the cache, updating cycles and handling misses
-uint8_t Cache::getByte(uint32_t addr, uint32_t *cycles, bool is_prefetch) {
-    referenceCounter++;
     if (!is_prefetch) {
-        statistics.numRead++;
+        stats.numMiss++;
+        stats.totalCycles += policy.missLatency;
+        if (!sampledSets.empty()) setStatistics[getId(addr)].numMiss++;
+#ifdef CACHESIM_PROFILE
+        profileAccess(addr, true);
+#endif
     }
+    blockId = loadBlockFromLowerLevel(addr, cycles, is_prefetch, stats);
+    if (prefetcher != nullptr && !is_prefetch)
+        observeAccess(addr, blockId, true, false);
+    return blockId;
+}
 
-    int blockId = getBlockId(addr);
-    if (blockId != -1) {
-        uint32_t offset = getOffset(addr);
-        statistics.numHit++;
-        statistics.totalCycles += policy.hitLatency;
-        blocks[blockId].lastReference = referenceCounter;
+// Writes size bytes from src (nullptr for a timing-only access) at addr,
+// all within one block, and charges the access to stats. Write-backs from
+// the level above count apart from the demand writes, hits and misses, and
+// only demand writes are shown to the prefetcher
+template <typename Addr>
+inline void BasicCache<Addr>::writeBytes(Addr addr, const uint8_t *src,
+                                         uint32_t size, uint32_t *cycles,
+                                         bool isDemand, Statistics &stats) {
+    if (!sampledSets.empty() && !sampleAccess(addr, isDemand)) {
+        return;
+    }
+    if (isDemand) {
+        stats.numWrite++;
+    } else {
+        stats.numWritebackIn++;
+    }
+
+    uint32_t blockId = getBlockId(addr);
+    bool hit = blockId != uint32_t(-1);
+    if (hit) {
+        stats.totalCycles += policy.hitLatency;
+        replacement->onHit(blockId >> wayBits, blockId & wayMask);
         if (cycles) *cycles = policy.hitLatency;
-        return blocks[blockId].data[offset];
+        if (isDemand) {
+            stats.numHit++;
+#ifdef CACHESIM_PROFILE
+            profileAccess(addr, false);
+#endif
+            if (prefetched[blockId] != 0 || prefetcher != nullptr)
+                observeHit(addr, blockId, stats);
+        }
+    } else {
+        stats.totalCycles += policy.missLatency;
+        if (isDemand) {
+            stats.numMiss++;
+            if (!sampledSets.empty()) setStatistics[getId(addr)].numMiss++;
+#ifdef CACHESIM_PROFILE
+            profileAccess(addr, true);
+#endif
+        } else {
+            stats.numWritebackMiss++;
+        }
+
+        if (!writeAllocate || policy.inclusion == EXCLUSIVE) {
+            if (prefetcher != nullptr && isDemand)
+                observeAccess(addr, uint32_t(-1), true, false);
+            stats.numWriteback++;
+            if (lowerCache != nullptr) {
+                forwardWriteback(addr, size, src);
+            } else if (!timingOnly) {
+                memory->writebackBlock(addr, size, src);
+            }
+            return;
+        }
+        blockId = loadBlockFromLowerLevel(addr, cycles, false, stats);
+        if (prefetcher != nullptr && isDemand)
+            observeAccess(addr, blockId, true, false);
     }
 
-    if (!is_prefetch) {
-        statistics.numMiss++;
-        statistics.totalCycles += policy.missLatency;
+    modified[blockId] = true;
+    if (!timingOnly && src != nullptr) {
+        memcpy(&data[blockId * policy.blockSize + getOffset(addr)], src, size);
+    }
+    if (hit && !writeBack) {
+        writeBlockToLowerLevel(blockId, stats);
+        stats.totalCycles += policy.missLatency;
+    }
+}
+
+// Retrieves a byte from the cache, updating cycles and handling misses
+template <typename Addr>
+uint8_t BasicCache<Addr>::getByte(Addr addr, uint32_t *cycles,
+                                  bool is_prefetch) {
+    uint32_t blockId = readBlock(addr, cycles, is_prefetch, statistics);
+    uint8_t val = 0;
+    if (blockId != uint32_t(-1) && !timingOnly) {
+        val = data[blockId * policy.blockSize + getOffset(addr)];
+    }
+    if (!prefetchQueue.empty()) issuePrefetches(statistics);
+    return val;
+}
+
+// Sets a byte in the cache, handling write policies and misses
+template <typename Addr>
+void BasicCache<Addr>::setByte(Addr addr, uint8_t val, uint32_t *cycles) {
+    writeBytes(addr, &val, 1, cycles, true, statistics);
+    if (!prefetchQueue.empty()) issuePrefetches(statistics);
+}
+
+// Reads size bytes at addr for the level above, one access per block of
+// this cache the range touches
+template <typename Addr>
+void BasicCache<Addr>::fillBlock(Addr addr, uint32_t size, uint8_t *out,
+                                 uint32_t *cycles, bool is_prefetch) {
+    fill(addr, size, out, cycles, is_prefetch, statistics);
+}
+
+// Writes back size bytes at addr from the level above, one access per
+// block of this cache the range touches
+template <typename Addr>
+void BasicCache<Addr>::writebackBlock(Addr addr, uint32_t size,
+                                      const uint8_t *src) {
+    writeback(addr, size, src, statistics);
+}
+
+// Block fill, charging the accesses to stats
+template <typename Addr>
+void BasicCache<Addr>::fill(Addr addr, uint32_t size, uint8_t *out,
+                            uint32_t *cycles, bool is_prefetch,
+                            Statistics &stats) {
+    if (policy.inclusion == EXCLUSIVE) {
+        fillExclusive(addr, size, out, cycles, is_prefetch, stats);
+        return;
+    }
+    for (uint32_t done = 0; done < size;) {
+        uint32_t offset = getOffset(addr + done);
+        uint32_t chunk = policy.blockSize - offset;
+        if (chunk > size - done) chunk = size - done;
+        uint32_t blockId = readBlock(addr + done, cycles, is_prefetch, stats);
+        if (out != nullptr && !timingOnly && blockId != uint32_t(-1)) {
+            memcpy(out + done, &data[blockId * policy.blockSize + offset],
+                   chunk);
+        }
+        if (!prefetchQueue.empty()) issuePrefetches(stats);
+        done += chunk;
     }
+}
 
-    loadBlockFromLowerLevel(addr, cycles, is_prefetch);
+// Block fill of an exclusive level, charging the accesses to stats. A hit
+// hands the block and whether it is modified to the level above, which
+// takes over the only copy. A miss passes the fill on to the level below
+// without allocating here
+template <typename Addr>
+void BasicCache<Addr>::fillExclusive(Addr addr, uint32_t size, uint8_t *out,
+                                     uint32_t *cycles, bool is_prefetch,
+                                     Statistics &stats) {
+    for (uint32_t done = 0; done < size;) {
+        uint32_t offset = getOffset(addr + done);
+        uint32_t chunk = policy.blockSize - offset;
+        if (chunk > size - done) chunk = size - done;
+        if (is_prefetch) {
+            stats.numPrefetch++;
+        } else {
+            stats.numRead++;
+        }
+
+        uint32_t blockId = getBlockId(addr + done);
+        if (blockId != uint32_t(-1)) {
+            stats.totalCycles += policy.hitLatency;
+            if (cycles) *cycles = policy.hitLatency;
+            if (!is_prefetch) {
+                stats.numHit++;
+#ifdef CACHESIM_PROFILE
+                profileAccess(addr + done, false);
+#endif
+                if (prefetched[blockId] != 0 || prefetcher != nullptr)
+                    observeHit(addr + done, blockId, stats);
+            }
+            if (out != nullptr && !timingOnly) {
+                memcpy(out + done, &data[blockId * policy.blockSize + offset],
+                       chunk);
+            }
+            fillDirty = modified[blockId] != 0;
+            dropBlock(blockId);
+        } else {
+            if (!is_prefetch) {
+                stats.numMiss++;
+                stats.totalCycles += policy.missLatency;
+#ifdef CACHESIM_PROFILE
+                profileAccess(addr + done, true);
+#endif
+            }
+            uint8_t *newData =
+                out != nullptr && !timingOnly ? fillBuffer.data() : nullptr;
+            Addr blockAddrBegin = (addr + done) & ~Addr(policy.blockSize - 1);
+            if (lowerCache != nullptr) {
+                forwardFill(blockAddrBegin, policy.blockSize, newData, cycles,
+                            is_prefetch);
+            } else {
+                if (newData != nullptr)
+                    memory->fillBlock(blockAddrBegin, policy.blockSize,
+                                      newData);
+                if (cycles) *cycles += 100;
+#ifdef CACHESIM_PROFILE
+                memory->countMiss(blockAddrBegin);
+#endif
+            }
+            if (newData != nullptr) memcpy(out + done, newData + offset, chunk);
+            // An exclusive level below handed over its only copy
+            fillDirty = lowerCache != nullptr &&
+                        lowerCache->policy.inclusion == EXCLUSIVE &&
+                        lowerCache->fillDirty;
+            if (prefetcher != nullptr && !is_prefetch)
+                observeAccess(addr + done, uint32_t(-1), true, false);
+        }
+        if (!prefetchQueue.empty()) issuePrefetches(stats);
+        done += chunk;
+    }
+}
 
-    blockId = getBlockId(addr);
-    if (blockId != -1) {
-        uint32_t offset = getOffset(addr);
-        blocks[blockId].lastReference = referenceCounter;
-        return blocks[blockId].data[offset];
+// Places a block the level above evicted into this exclusive level, making
+// room as for a fill; the block needs nothing from the level below. dirty
+// carries over the modified bit of the evicted copy
+template <typename Addr>
+void BasicCache<Addr>::insertVictim(Addr addr, uint32_t size,
+                                    const uint8_t *src, bool dirty,
+                                    Statistics &stats) {
+    stats.numWritebackIn++;
+    stats.totalCycles += policy.hitLatency;
+    uint32_t blockId = getBlockId(addr);
+    if (blockId == uint32_t(-1)) {
+        uint32_t id = getId(addr);
+        uint32_t blockIdBegin = id * policy.associativity;
+        blockId = getReplacementBlockId(blockIdBegin,
+                                        blockIdBegin + policy.associativity);
+        if (isValid(blockId)) evictBlock(blockId, stats);
+        prefetched[blockId] = NOT_PREFETCHED;
+        keys[blockId] = makeKey(getTag(addr));
+        modified[blockId] = false;
+        replacement->onFill(id, blockId - blockIdBegin);
     } else {
-        fprintf(stderr, "Error: data not in top level cache!\n");
+        replacement->onHit(blockId >> wayBits, blockId & wayMask);
+    }
+    if (dirty) modified[blockId] = true;
+    if (!timingOnly && src != nullptr) {
+        memcpy(&data[blockId * policy.blockSize + getOffset(addr)], src, size);
+    }
+
+#ifdef CACHE_VALIDATE
+    if (!validateSet(getId(addr))) {
+        fprintf(stderr, "Inconsistent state in set %d\n", getId(addr));
         exit(-1);
     }
+#endif
 }
 
-// Sets a byte in the cache, handling write policies and misses
-void Cache::setByte(uint32_t addr, uint8_t val, uint32_t *cycles) {
-    referenceCounter++;
-    statistics.numWrite++;
-
-    int blockId = getBlockId(addr);
-    if (blockId != -1) {
-        uint32_t offset = getOffset(addr);
-        statistics.numHit++;
-        statistics.totalCycles += policy.hitLatency;
-        blocks[blockId].modified = true;
-        blocks[blockId].lastReference = referenceCounter;
-        blocks[blockId].data[offset] = val;
-        if (!writeBack) {
-            writeBlockToLowerLevel(blocks[blockId]);
-            statistics.totalCycles += policy.missLatency;
+// Block write-back, charging the accesses to stats
+template <typename Addr>
+void BasicCache<Addr>::writeback(Addr addr, uint32_t size, const uint8_t *src,
+                                 Statistics &stats) {
+    for (uint32_t done = 0; done < size;) {
+        uint32_t chunk = policy.blockSize - getOffset(addr + done);
+        if (chunk > size - done) chunk = size - done;
+        writeBytes(addr + done, src != nullptr ? src + done : nullptr, chunk,
+                   nullptr, false, stats);
+        done += chunk;
+    }
+}
+
+// Runs a batch of records through the cache in one loop. The statistics
+// live in a local copy for the duration of the batch, and the batch of
+// lower-level accesses it produced is forwarded before returning
+template <typename Addr>
+void BasicCache<Addr>::access(const Record *begin, const Record *end) {
+    Statistics stats = statistics;
+    for (const Record *r = begin; r != end; ++r) {
+        accessRecord(*r, stats);
+        if (r->getRepeat() != 0) repeatRecord(*r, stats);
+    }
+    statistics = stats;
+    flush();
+}
+
+template <typename Addr>
+inline void BasicCache<Addr>::accessRecord(const Record &record,
+                                           Statistics &stats) {
+    if (record.isWrite()) {
+        uint8_t val = 0;
+        writeBytes(record.addr, &val, 1, nullptr, !record.isWriteback(),
+                   stats);
+    } else {
+        readBlock(record.addr, nullptr, record.isPrefetch(), stats);
+    }
+    if (!prefetchQueue.empty()) issuePrefetches(stats);
+}
+
+// Once a record holds its block, every repeat of it is a hit on the most
+// recently used block, and a single replacement update stands for all of
+// them, so the repeats are counted at once. They run one by one where
+// something sees each access: a prefetcher, a write-through to the level
+// below, or a block the record did not allocate
+template <typename Addr>
+void BasicCache<Addr>::repeatRecord(const Record &record, Statistics &stats) {
+    uint32_t repeat = record.getRepeat();
+    if (!isSampled(record.addr)) {
+        return;
+    }
+    uint32_t blockId = getBlockId(record.addr);
+    if (prefetcher != nullptr || (record.isWrite() && !writeBack) ||
+        blockId == uint32_t(-1)) {
+        for (uint32_t i = 0; i < repeat; ++i) {
+            accessRecord(record, stats);
         }
-        if (cycles) *cycles = policy.hitLatency;
         return;
     }
+    replacement->onHit(blockId >> wayBits, blockId & wayMask);
 
-    statistics.numMiss++;
-    statistics.totalCycles += policy.missLatency;
+    bool demand = !record.isPrefetch() && !record.isWriteback();
+    if (record.isPrefetch()) {
+        stats.numPrefetch += repeat;
+    } else if (record.isWriteback()) {
+        stats.numWritebackIn += repeat;
+    } else if (record.isWrite()) {
+        stats.numWrite += repeat;
+    } else {
+        stats.numRead += repeat;
+    }
+    stats.totalCycles += uint64_t(repeat) * policy.hitLatency;
+    if (demand) {
+        stats.numHit += repeat;
+        if (!sampledSets.empty())
+            setStatistics[getId(record.addr)].numAccess += repeat;
+#ifdef CACHESIM_PROFILE
+        profile.numAccess += repeat;
+        setProfiles[getId(record.addr)].numAccess += repeat;
+#endif
+    }
+}
 
-    if (writeAllocate) {
-        loadBlockFromLowerLevel(addr, cycles);
-        blockId = getBlockId(addr);
-        if (blockId != -1) {
-            uint32_t offset = getOffset(addr);
-            blocks[blockId].modified = true;
-            blocks[blockId].lastReference = referenceCounter;
-            blocks[blockId].data[offset] = val;
-            return;
+// Runs a batch of queued block transfers from the level above
+template <typename Addr>
+void BasicCache<Addr>::transfer(const Transfer *begin, const Transfer *end) {
+    Statistics stats = statistics;
+    for (const Transfer *t = begin; t != end; ++t) {
+        if (t->isVictim) {
+            insertVictim(t->addr, t->size, nullptr, t->isWrite, stats);
+        } else if (t->isWrite) {
+            writeback(t->addr, t->size, nullptr, stats);
         } else {
-            fprintf(stderr, "Error: data not in top level cache!\n");
-            exit(-1);
+            fill(t->addr, t->size, nullptr, nullptr, t->isPrefetch, stats);
         }
+    }
+    statistics = stats;
+    flush();
+}
+
+// Forwards the pending lower-level transfers of this and all lower levels
+template <typename Addr>
+void BasicCache<Addr>::flush() {
+    if (lowerCache == nullptr) {
+        return;
+    }
+    if (!lowerBatch.empty()) {
+        lowerCache->transfer(lowerBatch.data(),
+                             lowerBatch.data() + lowerBatch.size());
+        lowerBatch.clear();
     } else {
-        if (lowerCache == nullptr) {
-            memory->setByteNoCache(addr, val);
-        } else {
-            lowerCache->setByte(addr, val);
+        lowerCache->flush();
+    }
+}
+
+// Fills a block from the lower cache level. A timing-only cache needs no
+// data back, so unless the caller wants the cycles the fill is queued. A
+// fill from an exclusive level is not, since it tells whether the block
+// comes back modified, and neither is one over an inclusive level, whose
+// evictions must back-invalidate the blocks this level holds now
+template <typename Addr>
+void BasicCache<Addr>::forwardFill(Addr addr, uint32_t size, uint8_t *out,
+                                   uint32_t *cycles, bool is_prefetch) {
+    if (timingOnly && cycles == nullptr && !inclusiveBelow &&
+        lowerCache->policy.inclusion != EXCLUSIVE) {
+        lowerBatch.push_back(Transfer{addr, size, false, is_prefetch, false});
+        if (lowerBatch.size() == LOWER_BATCH_TRANSFERS) flush();
+        return;
+    }
+    if (!lowerBatch.empty()) flush();
+    lowerCache->fillBlock(addr, size, out, cycles, is_prefetch);
+}
+
+// Writes a block back to the lower cache level, queued for a timing-only
+// cache
+template <typename Addr>
+void BasicCache<Addr>::forwardWriteback(Addr addr, uint32_t size,
+                                        const uint8_t *src) {
+    if (timingOnly) {
+        lowerBatch.push_back(Transfer{addr, size, true, false, false});
+        if (lowerBatch.size() == LOWER_BATCH_TRANSFERS) flush();
+        return;
+    }
+    lowerCache->writebackBlock(addr, size, src);
+}
+
+// Hands an evicted block, clean or not, to the exclusive level below,
+// queued for a timing-only cache
+template <typename Addr>
+void BasicCache<Addr>::forwardVictim(uint32_t blockId) {
+    Addr addr = getAddr(blockId);
+    bool dirty = modified[blockId] != 0;
+    if (timingOnly) {
+        lowerBatch.push_back(
+            Transfer{addr, policy.blockSize, dirty, false, true});
+        if (lowerBatch.size() == LOWER_BATCH_TRANSFERS) flush();
+        return;
+    }
+    lowerCache->insertVictim(addr, policy.blockSize,
+                             &data[blockId * policy.blockSize], dirty,
+                             lowerCache->statistics);
+}
+
+// Picks the sampled sets by hashing the set ID, so the selection does not
+// follow address strides. At least one set is always simulated
+template <typename Addr>
+void BasicCache<Addr>::sampleSets(uint32_t ratio) {
+    uint32_t setNum = getSetNum();
+    sampledSets.assign(setNum, 0);
+    setStatistics.assign(setNum, SetStatistics{0, 0});
+    bool any = false;
+    for (uint32_t id = 0; id < setNum; ++id) {
+        uint32_t h = id * 0x9e3779b1u;
+        h ^= h >> 16;
+        sampledSets[id] = ratio <= 1 || h % ratio == 0;
+        any = any || sampledSets[id];
+    }
+    if (!any) {
+        sampledSets[0] = 1;
+    }
+}
+
+// Whether accesses to an address are simulated
+template <typename Addr>
+bool BasicCache<Addr>::isSampled(Addr addr) {
+    return sampledSets.empty() || sampledSets[getId(addr)];
+}
+
+// Number of sets
+template <typename Addr>
+uint32_t BasicCache<Addr>::getSetNum() {
+    return policy.blockNum / policy.associativity;
+}
+
+// Whether a set is simulated
+template <typename Addr>
+bool BasicCache<Addr>::isSetSampled(uint32_t id) {
+    return sampledSets.empty() || sampledSets[id];
+}
+
+// Access and miss counts of a set while sampling sets
+template <typename Addr>
+const CacheBase::SetStatistics &
+BasicCache<Addr>::getSetStatistics(uint32_t id) {
+    return setStatistics[id];
+}
+
+// Filters an access while sampling sets: returns false for sets that are
+// not simulated, otherwise counts demand accesses for the set
+template <typename Addr>
+bool BasicCache<Addr>::sampleAccess(Addr addr, bool isDemand) {
+    uint32_t id = getId(addr);
+    if (!sampledSets[id]) {
+        return false;
+    }
+    if (isDemand) setStatistics[id].numAccess++;
+    return true;
+}
+
+#ifdef CACHESIM_PROFILE
+// Classifies a demand access by the 3C model and counts it for the level
+// and its set. The shadow cache sees hits as well, so its LRU order
+// follows every demand access of the real one
+template <typename Addr>
+void BasicCache<Addr>::profileAccess(Addr addr, bool miss) {
+    Addr block = addr & ~Addr(policy.blockSize - 1);
+    Profile &set = setProfiles[getId(addr)];
+    profile.numAccess++;
+    set.numAccess++;
+
+    bool firstUse = referencedBlocks.insert(block).second;
+    auto it = shadowIndex.find(block);
+    bool shadowHit = it != shadowIndex.end();
+    if (shadowHit) {
+        shadowBlocks.splice(shadowBlocks.begin(), shadowBlocks, it->second);
+    } else {
+        if (shadowBlocks.size() >= policy.blockNum) {
+            shadowIndex.erase(shadowBlocks.back());
+            shadowBlocks.pop_back();
         }
+        shadowBlocks.push_front(block);
+        shadowIndex[block] = shadowBlocks.begin();
+    }
+    if (!miss)
+        return;
+
+    profile.numMiss++;
+    set.numMiss++;
+    if (firstUse) {
+        profile.numCompulsory++;
+        set.numCompulsory++;
+    } else if (shadowHit) {
+        profile.numConflict++;
+        set.numConflict++;
+    } else {
+        profile.numCapacity++;
+        set.numCapacity++;
+    }
+}
+
+// Writes the CSV header row of the per-set profile
+void CacheBase::writeSetProfileHeader(FILE *out) {
+    fprintf(out, "cache,set,numAccess,numMiss,numCompulsory,numCapacity,"
+                 "numConflict\n");
+}
+
+// Writes the profile of every set as a CSV row
+template <typename Addr>
+void BasicCache<Addr>::writeSetProfile(FILE *out, const char *name) {
+    for (uint32_t id = 0; id < setProfiles.size(); ++id) {
+        const Profile &p = setProfiles[id];
+        fprintf(out, "%s,%u,%llu,%llu,%llu,%llu,%llu\n", name, id,
+                (unsigned long long)p.numAccess,
+                (unsigned long long)p.numMiss,
+                (unsigned long long)p.numCompulsory,
+                (unsigned long long)p.numCapacity,
+                (unsigned long long)p.numConflict);
     }
 }
+#endif
 
 // Prints cache configuration and optionally block details
-void Cache::printInfo(bool verbose) {
+template <typename Addr>
+void BasicCache<Addr>::printInfo(bool verbose) {
     printf("---------- Cache Info -----------\n");
     printf("Cache Size: %d bytes\n", policy.cacheSize);
     printf("Block Size: %d bytes\n", policy.blockSize);
@@ -140,95 +785,444 @@ void Cache::printInfo(bool verbose) {
     printf("Associativity: %d\n", policy.associativity);
     printf("Hit Latency: %d cycles\n", policy.hitLatency);
     printf("Miss Latency: %d cycles\n", policy.missLatency);
+    printf("Replacement: %s\n", ReplacementPolicy::getName(policy.replacement));
+    printf("Inclusion: %s\n", getInclusionName(policy.inclusion));
+    if (victimCache != nullptr)
+        printf("Victim Cache: %d blocks\n", policy.victimBlocks);
 
     if (verbose) {
-        for (int j = 0; j < blocks.size(); ++j) {
-            const Block &b = blocks[j];
-            printf("Block %d: tag 0x%x id %d %s %s (last ref %d)\n",
-                   j, b.tag, b.id,
-                   b.valid ? "valid" : "invalid",
-                   b.modified ? "modified" : "unmodified",
-                   b.lastReference);
+        for (uint32_t j = 0; j < policy.blockNum; ++j) {
+            printf("Block %d: tag 0x%llx id %d %s %s "
+                   "(replacement state %llu)\n",
+                   j, (unsigned long long)keyTag(keys[j]), j >> wayBits,
+                   isValid(j) ? "valid" : "invalid",
+                   modified[j] ? "modified" : "unmodified",
+                   (unsigned long long)replacement->getState(j >> wayBits,
+                                                             j & wayMask));
+        }
+    }
+}
+
+// Attaches a prefetcher to this level, replacing any previous one
+template <typename Addr>
+void BasicCache<Addr>::setPrefetcher(Prefetcher *prefetcher) {
+    delete this->prefetcher;
+    this->prefetcher = prefetcher;
+    prefetchQueue.clear();
+    for (uint8_t &source : prefetched) {
+        if (source == OWN_PREFETCH) source = PREFETCH_FILL;
+    }
+    if (prefetcher == nullptr) {
+        std::vector<uint64_t>().swap(prefetchTimes);
+        return;
+    }
+    prefetchTimes.assign(policy.blockNum, 0);
+    const BasicCache *below = lowerCache;
+    if (below != nullptr && below->victimBuffer)
+        below = below->lowerCache;
+    uint32_t fillLatency = below != nullptr ? below->policy.hitLatency : 100;
+    uint32_t hitLatency = policy.hitLatency > 0 ? policy.hitLatency : 1;
+    lateAccesses = fillLatency / hitLatency;
+}
+
+template <typename Addr>
+Prefetcher *BasicCache<Addr>::getPrefetcher() {
+    return prefetcher;
+}
+
+// Counts the first demand use of a prefetched block and shows the hit to
+// the prefetcher
+template <typename Addr>
+void BasicCache<Addr>::observeHit(Addr addr, uint32_t blockId,
+                                  Statistics &stats) {
+    uint8_t source = prefetched[blockId];
+    if (source != NOT_PREFETCHED) {
+        stats.numUsefulPrefetch++;
+        prefetched[blockId] = NOT_PREFETCHED;
+    }
+    if (prefetcher != nullptr)
+        observeAccess(addr, blockId, false, source == OWN_PREFETCH);
+}
+
+// Counts a demand access for the prefetcher, which names the addresses to
+// prefetch next. ownPrefetchHit is the first use of a block it prefetched
+template <typename Addr>
+void BasicCache<Addr>::observeAccess(Addr addr, uint32_t blockId, bool miss,
+                                     bool ownPrefetchHit) {
+    Prefetcher::Statistics &stats = prefetcher->statistics;
+    stats.numAccess++;
+    if (miss) {
+        stats.numMiss++;
+    } else if (ownPrefetchHit) {
+        stats.numUseful++;
+        if (stats.numAccess - prefetchTimes[blockId] < lateAccesses)
+            stats.numLate++;
+    }
+    prefetcher->onAccess(addr, miss, ownPrefetchHit, prefetchQueue);
+}
+
+// Fills the queued prefetches into this level. Blocks already present, or
+// in sets that are not sampled, are skipped, and so are blocks of an
+// exclusive level that a level above holds
+template <typename Addr>
+void BasicCache<Addr>::issuePrefetches(Statistics &stats) {
+    for (uint64_t queued : prefetchQueue) {
+        Addr addr = Addr(queued);
+        if (!sampledSets.empty() && !sampledSets[getId(addr)])
+            continue;
+        stats.numPrefetch++;
+        if (getBlockId(addr) != uint32_t(-1) ||
+            (policy.inclusion == EXCLUSIVE && isHeldAbove(addr)))
+            continue;
+        uint32_t blockId = loadBlockFromLowerLevel(addr, nullptr, true, stats);
+        prefetched[blockId] = OWN_PREFETCH;
+        prefetchTimes[blockId] = prefetcher->statistics.numAccess;
+        prefetcher->statistics.numIssued++;
+    }
+    prefetchQueue.clear();
+}
+
+static const char *const inclusionNames[] = {
+    "non-inclusive", "inclusive", "exclusive",
+};
+
+// Returns the name of an inclusion policy
+const char *CacheBase::getInclusionName(Inclusion inclusion) {
+    return inclusionNames[inclusion];
+}
+
+// Looks up an inclusion policy by name
+bool CacheBase::parseInclusion(const char *name, Inclusion &inclusion) {
+    for (uint32_t i = 0;
+         i < sizeof(inclusionNames) / sizeof(inclusionNames[0]); ++i) {
+        if (strcmp(name, inclusionNames[i]) == 0) {
+            inclusion = static_cast<Inclusion>(i);
+            return true;
         }
     }
+    return false;
 }
 
+// Counters of a level in output order
+const CacheBase::StatisticsField CacheBase::STATISTICS_FIELDS[] = {
+    {"numRead", "Num Read", &Statistics::numRead},
+    {"numWrite", "Num Write", &Statistics::numWrite},
+    {"numHit", "Num Hit", &Statistics::numHit},
+    {"numMiss", "Num Miss", &Statistics::numMiss},
+    {"numPrefetch", "Num Prefetch", &Statistics::numPrefetch},
+    {"numPrefetchFill", "Prefetch Fills", &Statistics::numPrefetchFill},
+    {"numUsefulPrefetch", "Useful Prefetch Fills",
+     &Statistics::numUsefulPrefetch},
+    {"numUselessPrefetch", "Useless Prefetch Fills",
+     &Statistics::numUselessPrefetch},
+    {"numWritebackIn", "Writebacks In", &Statistics::numWritebackIn},
+    {"numWritebackMiss", "Writeback Misses", &Statistics::numWritebackMiss},
+    {"numWriteback", "Writebacks Out", &Statistics::numWriteback},
+    {"numEviction", "Evictions", &Statistics::numEviction},
+    {"numInvalidation", "Invalidations", &Statistics::numInvalidation},
+    {"numBackInvalidation", "Back Invalidations",
+     &Statistics::numBackInvalidation},
+    {"totalCycles", "Total Cycles", &Statistics::totalCycles},
+};
+const size_t CacheBase::STATISTICS_FIELD_NUM =
+    sizeof(STATISTICS_FIELDS) / sizeof(STATISTICS_FIELDS[0]);
+
 // Displays cache access statistics
-void Cache::printStatistics() {
-    printf("-------- STATISTICS ----------\n");
-    printf("Num Read: %d\n", statistics.numRead);
-    printf("Num Write: %d\n", statistics.numWrite);
-    printf("Num Hit: %d\n", statistics.numHit);
-    printf("Num Miss: %d\n", statistics.numMiss);
-    printf("Total Cycles: %llu\n", statistics.totalCycles);
-    if (lowerCache != nullptr) {
-        printf("---------- LOWER CACHE ----------\n");
-        lowerCache->printStatistics();
+template <typename Addr>
+void BasicCache<Addr>::printStatistics() {
+    writeStatistics(stdout, TEXT);
+}
+
+// Writes the statistics of every level from this one down. Walks the
+// levels in a loop, so each format has one place that lays out a level
+template <typename Addr>
+void BasicCache<Addr>::writeStatistics(FILE *out, StatisticsFormat format) {
+    flush();
+    if (format == CSV) {
+        writeStatisticsHeader(out);
+    } else if (format == JSON) {
+        fprintf(out, "{\n  \"levels\": [");
+    }
+
+    int level = 1;
+    for (BasicCache *cache = this; cache != nullptr;
+         cache = cache->lowerCache) {
+        if (cache->victimBuffer)
+            continue;
+        if (format == TEXT && level > 1)
+            fprintf(out, "---------- LOWER CACHE ----------\n");
+        char name[16];
+        snprintf(name, sizeof(name), "L%d", level);
+        cache->writeStatisticsRecord(out, format, name, level == 1);
+        ++level;
+    }
+
+    if (format == JSON) {
+        fprintf(out, "\n  ]\n}\n");
     }
 }
 
+// Writes the CSV header row of the statistics records
+void CacheBase::writeStatisticsHeader(FILE *out) {
+    fprintf(out, "cache");
+    for (size_t i = 0; i < STATISTICS_FIELD_NUM; ++i)
+        fprintf(out, ",%s", STATISTICS_FIELDS[i].key);
+    fprintf(out, ",prefetcher,prefetchDegree,prefetchIssued,"
+                 "prefetchUseful,prefetchLate,prefetchUnused,"
+                 "prefetchAccuracy,prefetchCoverage,prefetchTimeliness,"
+                 "victimBlocks,victimProbes,victimHits,victimInserts,"
+                 "victimWritebacks,effectiveCapacity\n");
+}
+
+// Writes this level's statistics as a text block, a JSON object in an
+// array (following a comma unless first) or a CSV row
+template <typename Addr>
+void BasicCache<Addr>::writeStatisticsRecord(FILE *out,
+                                             StatisticsFormat format,
+                                             const char *name, bool first) {
+    const Prefetcher *pf = prefetcher;
+    const Statistics *vs =
+        victimCache != nullptr ? &victimCache->statistics : nullptr;
+    switch (format) {
+    case TEXT:
+        fprintf(out, "-------- STATISTICS ----------\n");
+        for (size_t i = 0; i < STATISTICS_FIELD_NUM; ++i) {
+            const StatisticsField &f = STATISTICS_FIELDS[i];
+            fprintf(out, "%s: %llu\n", f.label,
+                    (unsigned long long)(statistics.*f.field));
+        }
+        if (pf != nullptr)
+            pf->printStatistics(out);
+        if (vs != nullptr) {
+            fprintf(out, "Victim Cache Blocks: %d\n", policy.victimBlocks);
+            fprintf(out, "Victim Probes: %llu\n",
+                    (unsigned long long)(vs->numRead + vs->numPrefetch));
+            fprintf(out, "Victim Hits: %llu\n",
+                    (unsigned long long)vs->numHit);
+            fprintf(out, "Victim Inserts: %llu\n",
+                    (unsigned long long)vs->numWritebackIn);
+            fprintf(out, "Victim Writebacks: %llu\n",
+                    (unsigned long long)vs->numWriteback);
+            fprintf(out, "Effective Capacity: %llu bytes\n",
+                    (unsigned long long)getEffectiveCapacity());
+        }
+#ifdef CACHESIM_PROFILE
+        fprintf(out, "Compulsory Misses: %llu\n",
+                (unsigned long long)profile.numCompulsory);
+        fprintf(out, "Capacity Misses: %llu\n",
+                (unsigned long long)profile.numCapacity);
+        fprintf(out, "Conflict Misses: %llu\n",
+                (unsigned long long)profile.numConflict);
+#endif
+        break;
+    case JSON:
+        fprintf(out, "%s\n    {\"cache\": \"%s\"", first ? "" : ",", name);
+        for (size_t i = 0; i < STATISTICS_FIELD_NUM; ++i) {
+            const StatisticsField &f = STATISTICS_FIELDS[i];
+            fprintf(out, ", \"%s\": %llu", f.key,
+                    (unsigned long long)(statistics.*f.field));
+        }
+        if (pf != nullptr) {
+            const Prefetcher::Statistics &ps = pf->statistics;
+            fprintf(out,
+                    ", \"prefetcher\": {\"type\": \"%s\", "
+                    "\"degree\": %d, \"numIssued\": %llu, "
+                    "\"numUseful\": %llu, \"numLate\": %llu, "
+                    "\"numUnused\": %llu, \"accuracy\": %.6f, "
+                    "\"coverage\": %.6f, \"timeliness\": %.6f}",
+                    Prefetcher::getName(pf->getType()), pf->getDegree(),
+                    (unsigned long long)ps.numIssued,
+                    (unsigned long long)ps.numUseful,
+                    (unsigned long long)ps.numLate,
+                    (unsigned long long)ps.numUnused, pf->getAccuracy(),
+                    pf->getCoverage(), pf->getTimeliness());
+        }
+        if (vs != nullptr) {
+            fprintf(out,
+                    ", \"victimCache\": {\"blocks\": %d, \"numProbe\": %llu, "
+                    "\"numHit\": %llu, \"numInsert\": %llu, "
+                    "\"numWriteback\": %llu, \"effectiveCapacity\": %llu}",
+                    policy.victimBlocks,
+                    (unsigned long long)(vs->numRead + vs->numPrefetch),
+                    (unsigned long long)vs->numHit,
+                    (unsigned long long)vs->numWritebackIn,
+                    (unsigned long long)vs->numWriteback,
+                    (unsigned long long)getEffectiveCapacity());
+        }
+#ifdef CACHESIM_PROFILE
+        fprintf(out,
+                ", \"profile\": {\"numCompulsory\": %llu, "
+                "\"numCapacity\": %llu, \"numConflict\": %llu}",
+                (unsigned long long)profile.numCompulsory,
+                (unsigned long long)profile.numCapacity,
+                (unsigned long long)profile.numConflict);
+#endif
+        fprintf(out, "}");
+        break;
+    case CSV:
+        fprintf(out, "%s", name);
+        for (size_t i = 0; i < STATISTICS_FIELD_NUM; ++i) {
+            const StatisticsField &f = STATISTICS_FIELDS[i];
+            fprintf(out, ",%llu", (unsigned long long)(statistics.*f.field));
+        }
+        if (pf != nullptr) {
+            const Prefetcher::Statistics &ps = pf->statistics;
+            fprintf(out, ",%s,%d,%llu,%llu,%llu,%llu,%.6f,%.6f,%.6f",
+                    Prefetcher::getName(pf->getType()), pf->getDegree(),
+                    (unsigned long long)ps.numIssued,
+                    (unsigned long long)ps.numUseful,
+                    (unsigned long long)ps.numLate,
+                    (unsigned long long)ps.numUnused, pf->getAccuracy(),
+                    pf->getCoverage(), pf->getTimeliness());
+        } else {
+            fprintf(out, ",,,,,,,,,");
+        }
+        if (vs != nullptr) {
+            fprintf(out, ",%d,%llu,%llu,%llu,%llu,%llu\n", policy.victimBlocks,
+                    (unsigned long long)(vs->numRead + vs->numPrefetch),
+                    (unsigned long long)vs->numHit,
+                    (unsigned long long)vs->numWritebackIn,
+                    (unsigned long long)vs->numWriteback,
+                    (unsigned long long)getEffectiveCapacity());
+        } else {
+            fprintf(out, ",,,,,,\n");
+        }
+        break;
+    }
+}
+
+// Reports a policy error to error, or to stderr without one
+static bool policyError(std::string *error, const char *format, ...) {
+    char message[128];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    if (error != nullptr) {
+        *error = message;
+    } else {
+        fprintf(stderr, "%s\n", message);
+    }
+    return false;
+}
+
 // Validates the cache configuration policy
-bool Cache::isPolicyValid() {
+bool CacheBase::isPolicyValid(const Policy &policy, std::string *error) {
     if (!isPowerOfTwo(policy.cacheSize)) {
-        fprintf(stderr, "Invalid Cache Size %d\n", policy.cacheSize);
-        return false;
+        return policyError(error, "Invalid Cache Size %d", policy.cacheSize);
     }
     if (!isPowerOfTwo(policy.blockSize)) {
-        fprintf(stderr, "Invalid Block Size %d\n", policy.blockSize);
-        return false;
+        return policyError(error, "Invalid Block Size %d", policy.blockSize);
     }
     if (policy.cacheSize % policy.blockSize != 0) {
-        fprintf(stderr, "cacheSize %% blockSize != 0\n");
-        return false;
+        return policyError(error, "cacheSize %% blockSize != 0");
     }
     if (policy.blockNum * policy.blockSize != policy.cacheSize) {
-        fprintf(stderr, "blockNum * blockSize != cacheSize\n");
-        return false;
+        return policyError(error, "blockNum * blockSize != cacheSize");
+    }
+    if (!isPowerOfTwo(policy.associativity)) {
+        return policyError(error, "Invalid Associativity %d",
+                           policy.associativity);
     }
     if (policy.blockNum % policy.associativity != 0) {
-        fprintf(stderr, "blockNum %% associativity != 0\n");
-        return false;
+        return policyError(error, "blockNum %% associativity != 0");
+    }
+    // The packed block keys need at least one offset or set ID bit
+    if (policy.blockSize == 1 && policy.blockNum == policy.associativity) {
+        return policyError(error, "Fully associative cache with 1 byte "
+                                  "blocks");
+    }
+    if (policy.replacement < ReplacementPolicy::LRU ||
+        policy.replacement > ReplacementPolicy::FIFO) {
+        return policyError(error, "Invalid Replacement Policy %d",
+                           policy.replacement);
+    }
+    if (policy.inclusion < NON_INCLUSIVE || policy.inclusion > EXCLUSIVE) {
+        return policyError(error, "Invalid Inclusion Policy %d",
+                           policy.inclusion);
+    }
+    if (policy.victimBlocks != 0 && !isPowerOfTwo(policy.victimBlocks)) {
+        return policyError(error, "Invalid Victim Cache Blocks %d",
+                           policy.victimBlocks);
     }
     return true;
 }
 
-// Initializes all cache blocks based on the policy
-void Cache::initCache() {
-    blocks = std::vector<Block>(policy.blockNum);
-    for (uint32_t i = 0; i < blocks.size(); ++i) {
-        Block &b = blocks[i];
-        b.valid = false;
-        b.modified = false;
-        b.size = policy.blockSize;
-        b.tag = 0;
-        b.id = i / policy.associativity;
-        b.lastReference = 0;
-        b.data = std::vector<uint8_t>(b.size);
+// Checks the block state of every set for internal consistency
+template <typename Addr>
+bool BasicCache<Addr>::validate() {
+    for (uint32_t id = 0; id < policy.blockNum / policy.associativity; ++id) {
+        if (!validateSet(id))
+            return false;
     }
+    return true;
 }
 
-// Loads a block from the lower cache level or memory
-void Cache::loadBlockFromLowerLevel(uint32_t addr, uint32_t *cycles, bool is_prefetch) {
-    uint32_t blockSize = policy.blockSize;
-    Block newBlock;
-    newBlock.valid = true;
-    newBlock.modified = false;
-    newBlock.tag = getTag(addr);
-    newBlock.id = getId(addr);
-    newBlock.size = blockSize;
-    newBlock.data = std::vector<uint8_t>(blockSize);
+// Checks one set: invalid blocks carry no tag or modified bit, valid tags
+// are unique within the set
+template <typename Addr>
+bool BasicCache<Addr>::validateSet(uint32_t id) {
+    uint32_t begin = id * policy.associativity;
+    uint32_t end = begin + policy.associativity;
+    for (uint32_t i = begin; i < end; ++i) {
+        if (!isValid(i) && (keys[i] != 0 || modified[i])) {
+            fprintf(stderr, "Invalid block %d carries state\n", i);
+            return false;
+        }
+        for (uint32_t j = i + 1; isValid(i) && j < end; ++j) {
+            if (keys[j] == keys[i]) {
+                fprintf(stderr, "Duplicate tag in blocks %d and %d\n", i, j);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Initializes all cache blocks based on the policy. All storage is
+// allocated here once, so the access and miss paths never allocate
+template <typename Addr>
+void BasicCache<Addr>::initCache() {
+    keys.assign(policy.blockNum, 0);
+    modified.assign(policy.blockNum, false);
+    prefetched.assign(policy.blockNum, NOT_PREFETCHED);
+    replacement = ReplacementPolicy::create(
+        policy.replacement, policy.blockNum / policy.associativity,
+        policy.associativity);
+    if (!timingOnly) {
+        data.assign(policy.blockNum * policy.blockSize, 0);
+        fillBuffer.assign(policy.blockSize, 0);
+    } else if (lowerCache != nullptr) {
+        lowerBatch.reserve(LOWER_BATCH_TRANSFERS);
+    }
+}
 
-    uint32_t blockAddrBegin = addr & ~(blockSize - 1);
+// Loads a block from the lower cache level or memory as one block fill.
+// The new data is staged in fillBuffer because the victim can only be
+// written back after the lower level has been read. A timing-only cache
+// still walks the lower levels to keep their statistics, but moves no
+// data. A dirty victim's write-back is charged to stats. Returns the ID of
+// the filled block
+template <typename Addr>
+uint32_t BasicCache<Addr>::loadBlockFromLowerLevel(Addr addr,
+                                                   uint32_t *cycles,
+                                                   bool is_prefetch,
+                                                   Statistics &stats) {
+    uint32_t blockSize = policy.blockSize;
+    uint8_t *newData = timingOnly ? nullptr : fillBuffer.data();
+    Addr blockAddrBegin = addr & ~Addr(blockSize - 1);
 
+    bool dirty = false;
     if (lowerCache != nullptr) {
-        for (uint32_t i = blockAddrBegin; i < blockAddrBegin + 1; ++i) {
-            newBlock.data[i - blockAddrBegin] = lowerCache->getByte(i, cycles, is_prefetch);
-        }
+        forwardFill(blockAddrBegin, blockSize, newData, cycles, is_prefetch);
+        dirty = lowerCache->policy.inclusion == EXCLUSIVE &&
+                lowerCache->fillDirty;
     } else {
-        for (uint32_t i = blockAddrBegin; i < blockAddrBegin + 1; ++i) {
-            newBlock.data[i - blockAddrBegin] = memory->getByteNoCache(i);
-            if (cycles) *cycles += 100;
-        }
+        if (!timingOnly) memory->fillBlock(blockAddrBegin, blockSize, newData);
+        if (cycles) *cycles += 100;
+#ifdef CACHESIM_PROFILE
+        memory->countMiss(blockAddrBegin);
+#endif
     }
 
     uint32_t id = getId(addr);
@@ -236,54 +1230,278 @@ void Cache::loadBlockFromLowerLevel(uint32_t addr, uint32_t *cycles, bool is_pre
     uint32_t blockIdEnd = (id + 1) * policy.associativity;
     uint32_t replaceId = getReplacementBlockId(blockIdBegin, blockIdEnd);
 
-    Block replaceBlock = blocks[replaceId];
-    if (writeBack && replaceBlock.valid && replaceBlock.modified) {
-        writeBlockToLowerLevel(replaceBlock);
-        statistics.totalCycles += policy.missLatency;
+    if (isValid(replaceId)) {
+        evictBlock(replaceId, stats);
     }
+    if (is_prefetch) stats.numPrefetchFill++;
+    prefetched[replaceId] = is_prefetch ? PREFETCH_FILL : NOT_PREFETCHED;
 
-    blocks[replaceId] = newBlock;
+    keys[replaceId] = makeKey(getTag(addr));
+    modified[replaceId] = dirty;
+    replacement->onFill(id, replaceId - blockIdBegin);
+    if (!timingOnly) memcpy(&data[replaceId * blockSize], newData, blockSize);
+
+#ifdef CACHE_VALIDATE
+    if (!validateSet(id)) {
+        fprintf(stderr, "Inconsistent state in set %d\n", id);
+        exit(-1);
+    }
+#endif
+    return replaceId;
 }
 
-// Determines which block to replace using LRU policy
-uint32_t Cache::getReplacementBlockId(uint32_t begin, uint32_t end) {
+// Determines which block to replace: an invalid block if the set has one,
+// otherwise the replacement policy's victim
+template <typename Addr>
+uint32_t BasicCache<Addr>::getReplacementBlockId(uint32_t begin, uint32_t end) {
     for (uint32_t i = begin; i < end; ++i) {
-        if (!blocks[i].valid)
+        if (!isValid(i))
             return i;
     }
+    return begin + replacement->getVictim(begin >> wayBits);
+}
 
-    uint32_t resultId = begin;
-    uint32_t minReference = UINT32_MAX;
-    for (uint32_t i = begin; i < end; ++i) {
-        if (blocks[i].lastReference < minReference) {
-            resultId = i;
-            minReference = blocks[i].lastReference;
+// Evicts a valid block. An exclusive level below takes every victim, clean
+// or not; otherwise only modified blocks of a write-back level are written
+// back. An exclusive level writes back modified blocks even when
+// write-through, since they may have come modified from above
+template <typename Addr>
+void BasicCache<Addr>::evictBlock(uint32_t blockId, Statistics &stats) {
+    stats.numEviction++;
+    if (evictionTracking) evictions.push_back(getAddr(blockId));
+    if (policy.inclusion == INCLUSIVE && upperCache != nullptr)
+        backInvalidate(blockId, stats);
+    if (lowerCache != nullptr && lowerCache->policy.inclusion == EXCLUSIVE) {
+        stats.numWriteback++;
+        forwardVictim(blockId);
+        if (modified[blockId]) stats.totalCycles += policy.missLatency;
+    } else if (modified[blockId] &&
+               (writeBack || policy.inclusion == EXCLUSIVE)) {
+        writeBlockToLowerLevel(blockId, stats);
+        stats.totalCycles += policy.missLatency;
+    }
+    if (prefetched[blockId] != NOT_PREFETCHED) {
+        stats.numUselessPrefetch++;
+        if (prefetched[blockId] == OWN_PREFETCH)
+            prefetcher->statistics.numUnused++;
+    }
+}
+
+// Drops every copy of the block in the levels above, nearest first, so the
+// data of the most recently written copy ends up in the block. The drops
+// are counted here, as the levels above may be in the middle of a batch
+template <typename Addr>
+void BasicCache<Addr>::backInvalidate(uint32_t blockId, Statistics &stats) {
+    Addr begin = getAddr(blockId);
+    for (BasicCache *upper = upperCache; upper != nullptr;
+         upper = upper->upperCache) {
+        uint32_t upperSize = upper->policy.blockSize;
+        for (Addr addr = begin; addr - begin < policy.blockSize;
+             addr += upperSize) {
+            uint32_t id = upper->getBlockId(addr);
+            if (id == uint32_t(-1))
+                continue;
+            if (upper->modified[id]) {
+                if (!timingOnly && !upper->timingOnly) {
+                    memcpy(&data[blockId * policy.blockSize + (addr - begin)],
+                           &upper->data[id * upperSize], upperSize);
+                }
+                modified[blockId] = true;
+            }
+            upper->dropBlock(id);
+            stats.numBackInvalidation++;
         }
     }
-    return resultId;
 }
 
-// Writes a block to the lower cache level or memory
-void Cache::writeBlockToLowerLevel(Cache::Block &b) {
-    uint32_t addrBegin = getAddr(b);
-    if (lowerCache == nullptr) {
-        for (uint32_t i = 0; i < b.size; ++i) {
-            memory->setByteNoCache(addrBegin + i, b.data[i]);
+// Checks if a level above holds the block of an address
+template <typename Addr>
+bool BasicCache<Addr>::isHeldAbove(Addr addr) {
+    for (BasicCache *upper = upperCache; upper != nullptr;
+         upper = upper->upperCache) {
+        if (upper->inCache(addr))
+            return true;
+    }
+    return false;
+}
+
+// Drops a block without writing it back or touching the statistics
+template <typename Addr>
+void BasicCache<Addr>::dropBlock(uint32_t blockId) {
+    if (prefetched[blockId] == OWN_PREFETCH)
+        prefetcher->statistics.numUnused++;
+    keys[blockId] = 0;
+    modified[blockId] = false;
+    prefetched[blockId] = NOT_PREFETCHED;
+}
+
+// Bytes of the valid blocks of this level and its victim cache
+template <typename Addr>
+uint64_t BasicCache<Addr>::getEffectiveCapacity() const {
+    uint64_t blocks = 0;
+    for (uint32_t i = 0; i < policy.blockNum; ++i) {
+        if (isValid(i)) blocks++;
+    }
+    uint64_t bytes = blocks * policy.blockSize;
+    if (victimCache != nullptr) bytes += victimCache->getEffectiveCapacity();
+    return bytes;
+}
+
+// Writes a whole block back to the lower cache level or memory as one
+// block write-back, counted in stats. A timing-only cache has nothing to
+// store in memory
+template <typename Addr>
+void BasicCache<Addr>::writeBlockToLowerLevel(uint32_t blockId,
+                                              Statistics &stats) {
+    stats.numWriteback++;
+    Addr addrBegin = getAddr(blockId);
+    const uint8_t *blockData =
+        timingOnly ? nullptr : &data[blockId * policy.blockSize];
+    if (lowerCache != nullptr) {
+        forwardWriteback(addrBegin, policy.blockSize, blockData);
+    } else if (!timingOnly) {
+        memory->writebackBlock(addrBegin, policy.blockSize, blockData);
+    }
+}
+
+// Drops the block holding addr, writing it back first if dirty. A prefetched
+// block that goes before its first use counts as a useless prefetch
+template <typename Addr>
+bool BasicCache<Addr>::invalidateBlock(Addr addr, bool toMemory) {
+    uint32_t blockId = getBlockId(addr);
+    if (blockId == uint32_t(-1)) {
+        return false;
+    }
+    if (writeBack && modified[blockId]) {
+        if (!toMemory) {
+            writeBlockToLowerLevel(blockId, statistics);
+        } else {
+            statistics.numWriteback++;
+            if (!timingOnly) {
+                memory->writebackBlock(getAddr(blockId), policy.blockSize,
+                                       &data[blockId * policy.blockSize]);
+            }
         }
+    }
+    if (prefetched[blockId] != NOT_PREFETCHED) {
+        statistics.numUselessPrefetch++;
+        if (prefetched[blockId] == OWN_PREFETCH)
+            prefetcher->statistics.numUnused++;
+    }
+    keys[blockId] = 0;
+    modified[blockId] = false;
+    prefetched[blockId] = NOT_PREFETCHED;
+    statistics.numInvalidation++;
+    return true;
+}
+
+// Writes the block holding addr back if it is dirty, keeping it clean
+template <typename Addr>
+bool BasicCache<Addr>::cleanBlock(Addr addr) {
+    uint32_t blockId = getBlockId(addr);
+    if (blockId == uint32_t(-1) || !writeBack || !modified[blockId]) {
+        return false;
+    }
+    writeBlockToLowerLevel(blockId, statistics);
+    modified[blockId] = false;
+    return true;
+}
+
+// Copies bytes of a present block
+template <typename Addr>
+bool BasicCache<Addr>::peekBlock(Addr addr, uint32_t size, uint8_t *out) {
+    uint32_t blockId = getBlockId(addr);
+    if (timingOnly || blockId == uint32_t(-1)) {
+        return false;
+    }
+    memcpy(out, &data[blockId * policy.blockSize + getOffset(addr)], size);
+    return true;
+}
+
+// Stores bytes in the first level holding their block, or in memory
+template <typename Addr>
+void BasicCache<Addr>::pokeBlock(Addr addr, uint32_t size,
+                                 const uint8_t *src) {
+    if (timingOnly) {
+        return;
+    }
+    uint32_t blockId = getBlockId(addr);
+    if (blockId != uint32_t(-1)) {
+        memcpy(&data[blockId * policy.blockSize + getOffset(addr)], src, size);
+    } else if (lowerCache != nullptr) {
+        lowerCache->pokeBlock(addr, size, src);
     } else {
-        for (uint32_t i = 0; i < b.size; ++i) {
-            lowerCache->setByte(addrBegin + i, b.data[i]);
-        }
+        memory->writebackBlock(addr, size, src);
     }
 }
 
+// Appends the block state of this level to a checkpoint
+template <typename Addr>
+void BasicCache<Addr>::saveState(std::vector<uint8_t> &out, bool withData) {
+    CheckpointBase::append(out, keys.data(), keys.size() * sizeof(Addr));
+    CheckpointBase::append(out, modified.data(), modified.size());
+    replacement->saveState(out);
+    if (withData) {
+        CheckpointBase::append(out, data.data(), data.size());
+    }
+    if (victimCache != nullptr) {
+        victimCache->saveState(out, withData);
+    }
+}
+
+// Restores the block state of this level from a checkpoint
+template <typename Addr>
+bool BasicCache<Addr>::restoreState(const uint8_t *&p, const uint8_t *end,
+                                    bool withData) {
+    if (!CheckpointBase::read(p, end, keys.data(),
+                              keys.size() * sizeof(Addr)) ||
+        !CheckpointBase::read(p, end, modified.data(), modified.size()) ||
+        !replacement->restoreState(p, end)) {
+        return false;
+    }
+    if (withData) {
+        size_t size = size_t(policy.blockNum) * policy.blockSize;
+        if (size_t(end - p) < size)
+            return false;
+        if (!timingOnly)
+            memcpy(data.data(), p, size);
+        p += size;
+    }
+    if (victimCache != nullptr &&
+        !victimCache->restoreState(p, end, withData)) {
+        return false;
+    }
+    prefetched.assign(policy.blockNum, NOT_PREFETCHED);
+    if (prefetcher != nullptr) {
+        prefetchTimes.assign(policy.blockNum, 0);
+    }
+    prefetchQueue.clear();
+    evictions.clear();
+    return true;
+}
+
+// Starts or stops recording evicted blocks
+template <typename Addr>
+void BasicCache<Addr>::trackEvictions(bool enable) {
+    evictionTracking = enable;
+    evictions.clear();
+}
+
+// Moves the blocks evicted since the last call to out
+template <typename Addr>
+void BasicCache<Addr>::takeEvictions(std::vector<Addr> &out) {
+    out.clear();
+    out.swap(evictions);
+}
+
 // Checks if a number is a power of two
-bool Cache::isPowerOfTwo(uint32_t n) {
+bool CacheBase::isPowerOfTwo(uint32_t n) {
     return n > 0 && (n & (n - 1)) == 0;
 }
 
 // Calculates the integer log base 2 of a value
-uint32_t Cache::log2i(uint32_t val) {
+template <typename Addr>
+uint32_t BasicCache<Addr>::log2i(uint32_t val) {
     if (val == 0)
         return uint32_t(-1);
     if (val == 1)
@@ -296,32 +1514,74 @@ uint32_t Cache::log2i(uint32_t val) {
     return ret;
 }
 
+// Derives the address decoding from the policy and picks the block lookup.
+// The tag is everything above the set ID, so shifting is enough to extract
+// it; tagShift is always below 32 because the cache is smaller than 4 GB
+template <typename Addr>
+void BasicCache<Addr>::initAddressDecoding() {
+    offsetBits = log2i(policy.blockSize);
+    idBits = log2i(policy.blockNum / policy.associativity);
+    offsetMask = policy.blockSize - 1;
+    idMask = (1u << idBits) - 1;
+    tagShift = offsetBits + idBits;
+    wayBits = log2i(policy.associativity);
+    wayMask = policy.associativity - 1;
+
+    // Specializations for the block sizes and associativities used by the
+    // bundled hierarchy and sweeps
+    struct Specialization {
+        uint32_t blockSize;
+        uint32_t associativity;
+        LookupFn lookup;
+    };
+    static const Specialization specializations[] = {
+        {32, 1, &BasicCache::lookupFixed<32, 1>},
+        {32, 2, &BasicCache::lookupFixed<32, 2>},
+        {32, 4, &BasicCache::lookupFixed<32, 4>},
+        {32, 8, &BasicCache::lookupFixed<32, 8>},
+        {32, 16, &BasicCache::lookupFixed<32, 16>},
+        {32, 32, &BasicCache::lookupFixed<32, 32>},
+        {64, 1, &BasicCache::lookupFixed<64, 1>},
+        {64, 2, &BasicCache::lookupFixed<64, 2>},
+        {64, 4, &BasicCache::lookupFixed<64, 4>},
+        {64, 8, &BasicCache::lookupFixed<64, 8>},
+        {64, 16, &BasicCache::lookupFixed<64, 16>},
+        {64, 32, &BasicCache::lookupFixed<64, 32>},
+    };
+
+    lookup = &BasicCache::lookupGeneric;
+    for (const Specialization &s : specializations) {
+        if (s.blockSize == policy.blockSize &&
+            s.associativity == policy.associativity) {
+            lookup = s.lookup;
+        }
+    }
+}
+
 // Extracts the tag from an address
-uint32_t Cache::getTag(uint32_t addr) {
-    uint32_t offsetBits = log2i(policy.blockSize);
-    uint32_t idBits = log2i(policy.blockNum / policy.associativity);
-    uint32_t mask = (1 << (32 - offsetBits - idBits)) - 1;
-    return (addr >> (offsetBits + idBits)) & mask;
+template <typename Addr>
+Addr BasicCache<Addr>::getTag(Addr addr) {
+    return addr >> tagShift;
 }
 
 // Extracts the set ID from an address
-uint32_t Cache::getId(uint32_t addr) {
-    uint32_t offsetBits = log2i(policy.blockSize);
-    uint32_t idBits = log2i(policy.blockNum / policy.associativity);
-    uint32_t mask = (1 << idBits) - 1;
-    return (addr >> offsetBits) & mask;
+template <typename Addr>
+uint32_t BasicCache<Addr>::getId(Addr addr) {
+    return (addr >> offsetBits) & idMask;
 }
 
 // Extracts the byte offset within a block from an address
-uint32_t Cache::getOffset(uint32_t addr) {
-    uint32_t bits = log2i(policy.blockSize);
-    uint32_t mask = (1 << bits) - 1;
-    return addr & mask;
-}
-
-// Reconstructs the address from a block's tag and ID
-uint32_t Cache::getAddr(Cache::Block &b) {
-    uint32_t offsetBits = log2i(policy.blockSize);
-    uint32_t idBits = log2i(policy.blockNum / policy.associativity);
-    return (b.tag << (offsetBits + idBits)) | (b.id << offsetBits);
-}
\ No newline at end of file
+template <typename Addr>
+uint32_t BasicCache<Addr>::getOffset(Addr addr) {
+    return addr & offsetMask;
+}
+
+// Reconstructs the address from a block's tag and set
+template <typename Addr>
+Addr BasicCache<Addr>::getAddr(uint32_t blockId) {
+    uint32_t id = blockId >> wayBits;
+    return (keyTag(keys[blockId]) << tagShift) | (id << offsetBits);
+}
+
+template class BasicCache<uint32_t>;
+template class BasicCache<uint64_t>;
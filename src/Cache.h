@@ -8,15 +8,40 @@
 #define CACHE_H
 
 #include <cstdint>
+#include <cstdio>
+#include <string>
 #include <vector>
+#ifdef CACHESIM_PROFILE
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
+#endif
 #include "MemoryManager.h"
+#include "Prefetcher.h"
+#include "ReplacementPolicy.h"
+#include "Trace.h"
 
 // Forward declaration of MemoryManager
-class MemoryManager;
+template <typename Addr>
+class BasicMemoryManager;
 
-// Cache class simulating a multi-level cache system
-class Cache {
+// Cache configuration and statistics shared by every address width
+class CacheBase {
 public:
+    // How a level relates to the blocks of the levels above it
+    enum Inclusion {
+        NON_INCLUSIVE,            // Fills and evictions ignore the levels above
+        INCLUSIVE,                // Holds every block of the levels above;
+                                  // its evictions back-invalidate them
+        EXCLUSIVE,                // Holds only blocks the level above evicted;
+                                  // a hit moves the block up
+    };
+
+    // Converts between inclusion policies and their names ("inclusive",
+    // "non-inclusive", "exclusive")
+    static const char *getInclusionName(Inclusion inclusion);
+    static bool parseInclusion(const char *name, Inclusion &inclusion);
+
     // Policy structure defining cache configuration
     struct Policy {
         uint32_t cacheSize;       // Total cache size in bytes (power of 2)
@@ -25,99 +50,474 @@ public:
         uint32_t associativity;   // Number of blocks per set
         uint32_t hitLatency;      // Cycles for a cache hit
         uint32_t missLatency;     // Cycles for a cache miss
+        ReplacementPolicy::Type replacement;   // Victim selection, LRU if 0
+        Inclusion inclusion;      // Relation to the levels above, none if 0
+        uint32_t victimBlocks;    // Victim cache blocks (power of 2), or 0
     };
 
-    // Block structure representing a single cache block
-    struct Block {
-        bool valid;                     // Valid bit
-        bool modified;                  // Modified bit for write-back
-        uint32_t tag;                   // Tag portion of the address
-        uint32_t id;                    // Set ID
-        uint32_t size;                  // Size of the block
-        uint32_t lastReference;         // LRU counter
-        std::vector<uint8_t> data;      // Data stored in the block
-
-        Block() {}
-        Block(const Block &b)
-            : valid(b.valid), modified(b.modified), tag(b.tag), id(b.id),
-              size(b.size), lastReference(b.lastReference), data(b.data) {}
-    };
+    // Checks that a policy describes a geometry the cache can simulate. The
+    // first problem goes to error if given, otherwise to stderr
+    static bool isPolicyValid(const Policy &policy,
+                              std::string *error = nullptr);
 
-    // Statistics structure tracking cache performance
+    // Statistics structure tracking cache performance. Hits and misses
+    // count demand reads and writes only; prefetches and write-backs from
+    // the level above have their own counters
     struct Statistics {
-        uint32_t numRead;       // Number of read operations
-        uint32_t numWrite;      // Number of write operations
-        uint32_t numHit;        // Number of cache hits
-        uint32_t numMiss;       // Number of cache misses
-        uint64_t totalCycles;   // Total cycles consumed
+        uint64_t numRead;             // Demand reads
+        uint64_t numWrite;            // Demand writes
+        uint64_t numHit;              // Demand hits
+        uint64_t numMiss;             // Demand misses
+        uint64_t numPrefetch;         // Prefetch requests, from above or own
+        uint64_t numPrefetchFill;     // Prefetches that filled a block
+        uint64_t numUsefulPrefetch;   // Prefetched blocks used on demand
+        uint64_t numUselessPrefetch;  // Prefetched blocks evicted unused
+        uint64_t numWritebackIn;      // Write-backs from the level above
+        uint64_t numWritebackMiss;    // Of those, ones that missed
+        uint64_t numWriteback;        // Writes to the level below
+        uint64_t numEviction;         // Valid blocks evicted
+        uint64_t numInvalidation;     // Blocks invalidated from outside
+        uint64_t numBackInvalidation; // Blocks dropped above for inclusion
+        uint64_t totalCycles;         // Total cycles consumed
+    };
+
+    // A counter of Statistics with its JSON and CSV key and its text label
+    struct StatisticsField {
+        const char *key;
+        const char *label;
+        uint64_t Statistics::*field;
     };
 
-    // Constructor to initialize the cache
-    Cache(MemoryManager *manager, Policy policy, Cache *lowerCache = nullptr,
-          bool writeBack = true, bool writeAllocate = true);
+    // All counters in output order
+    static const StatisticsField STATISTICS_FIELDS[];
+    static const size_t STATISTICS_FIELD_NUM;
+
+    // Output formats of writeStatistics()
+    enum StatisticsFormat {
+        TEXT,                         // What printStatistics() prints
+        JSON,                         // One object per level in "levels"
+        CSV,                          // A header and one row per level
+    };
+
+    // Writes the CSV header row matching writeStatisticsRecord()
+    static void writeStatisticsHeader(FILE *out);
+
+    // Access and miss counts of one set, kept while sampling sets
+    struct SetStatistics {
+        uint64_t numAccess;     // Demand reads and writes to the set
+        uint64_t numMiss;       // Demand misses in the set
+    };
+
+#ifdef CACHESIM_PROFILE
+    // Demand misses split by the 3C model, kept for the level and for each
+    // set in builds with CACHESIM_PROFILE. A first reference to a block is
+    // a compulsory miss; any other miss is a conflict miss if a fully
+    // associative LRU cache of the same capacity would have hit, and a
+    // capacity miss if it misses as well
+    struct Profile {
+        uint64_t numAccess;     // Demand reads and writes
+        uint64_t numMiss;       // Demand misses
+        uint64_t numCompulsory;
+        uint64_t numCapacity;
+        uint64_t numConflict;
+    };
+
+    // Writes the CSV header row matching writeSetProfile()
+    static void writeSetProfileHeader(FILE *out);
+#endif
+
+protected:
+    // Checks if a number is a power of two
+    static bool isPowerOfTwo(uint32_t n);
+};
+
+// Cache class simulating a multi-level cache system with Addr-wide
+// addresses; Cache and Cache64 below. Tags and the block keys are Addr
+// wide as well, so 32-bit traces keep the 32-bit layout and lookups
+template <typename Addr>
+class BasicCache : public CacheBase {
+public:
+    typedef typename BasicTrace<Addr>::Record Record;
+    typedef BasicMemoryManager<Addr> Memory;
+
+    // Constructor to initialize the cache. A timing-only cache tracks tags
+    // and statistics but no data: it allocates no data arena, never touches
+    // the memory manager's pages and returns 0 for every read. Hit, miss and
+    // cycle counts are the same as for a data-carrying cache. All levels of
+    // a hierarchy should use the same mode
+    //
+    // An inclusive level needs blocks at least as large as the level above,
+    // an exclusive one the same block size. A victim cache is a small fully
+    // associative LRU buffer, exclusive of this level, between it and the
+    // level below: it takes every block this level evicts and gives a block
+    // back on a miss that finds it there. It shares this level's hit
+    // latency and has its statistics printed with this level
+    //
+    // The policy must pass isPolicyValid(); create() checks it first
+    BasicCache(Memory *manager, Policy policy,
+               BasicCache *lowerCache = nullptr, bool writeBack = true,
+               bool writeAllocate = true, bool timingOnly = false);
+    ~BasicCache();
+
+    // Constructs a cache if its policy is valid, or returns nullptr with
+    // the problem in error, never ending the process
+    static BasicCache *create(Memory *manager, Policy policy,
+                              BasicCache *lowerCache = nullptr,
+                              bool writeBack = true, bool writeAllocate = true,
+                              bool timingOnly = false,
+                              std::string *error = nullptr);
+
+    BasicCache(const BasicCache &) = delete;
+    BasicCache &operator=(const BasicCache &) = delete;
 
     // Checks if an address is present in the cache
-    bool inCache(uint32_t addr);
+    bool inCache(Addr addr);
 
     // Retrieves the block ID for a given address
-    uint32_t getBlockId(uint32_t addr);
+    uint32_t getBlockId(Addr addr);
 
     // Retrieves a byte from the cache with optional cycle count and prefetch flag
-    uint8_t getByte(uint32_t addr, uint32_t *cycles = nullptr, bool is_prefetch = false);
+    uint8_t getByte(Addr addr, uint32_t *cycles = nullptr, bool is_prefetch = false);
 
     // Sets a byte in the cache with optional cycle count
-    void setByte(uint32_t addr, uint8_t val, uint32_t *cycles = nullptr);
+    void setByte(Addr addr, uint8_t val, uint32_t *cycles = nullptr);
+
+    // Runs a batch of trace records through the cache: writes behave like
+    // setByte() with a value of 0, reads like getByte() and PREFETCH reads
+    // like prefetching getByte() calls. The statistics are the same as for
+    // the equivalent single calls. WRITEBACK records are write-backs from
+    // the level above, and a record with a repeat count runs that many more
+    // times, in O(1) where the repeats cannot differ from hits
+    void access(const Record *begin, const Record *end);
+
+    // Block transfers from the level above: reads size bytes at addr into
+    // out, or writes them back from src. Each block of this cache the range
+    // touches is one read or write access. out and src may be nullptr for a
+    // timing-only cache
+    void fillBlock(Addr addr, uint32_t size, uint8_t *out,
+                   uint32_t *cycles = nullptr, bool is_prefetch = false);
+    void writebackBlock(Addr addr, uint32_t size, const uint8_t *src);
+
+    // A timing-only cache queues its block transfers to the lower level and
+    // forwards them in order as one batch, since the lower level returns no
+    // data it would need. The queue is forwarded when it fills,
+    // at the end of every access() batch and by flush(), which also flushes
+    // all lower levels; printStatistics() flushes first
+    void flush();
+
+    // Attaches a prefetcher, which the cache then owns; nullptr detaches
+    // it. The prefetcher observes the demand accesses to this level and the
+    // blocks it names are filled as prefetches after each access. A
+    // prefetch is counted late if its block is used within the number of
+    // accesses, at one per hit latency, that the level below takes to
+    // deliver it
+    void setPrefetcher(Prefetcher *prefetcher);
+    Prefetcher *getPrefetcher();
 
     // Prints cache configuration and optionally detailed block information
     void printInfo(bool verbose);
 
-    // Prints cache access statistics
+    // Prints cache access statistics of this level and the levels below
     void printStatistics();
 
+    // Writes the statistics of this level and every level below it, level
+    // 1 first, flushing queued transfers before
+    void writeStatistics(FILE *out, StatisticsFormat format);
+
+    // Writes the statistics of this level alone, labelled name, for callers
+    // laying out several caches themselves: a text block, a JSON object
+    // preceded by a comma unless first, or a CSV row
+    void writeStatisticsRecord(FILE *out, StatisticsFormat format,
+                               const char *name, bool first);
+
+    // Set sampling: simulates only the sets picked by a hash of the set ID,
+    // about one in ratio, and counts accesses and misses per set. Accesses
+    // to other sets return at once without touching state or statistics.
+    // Call before the first access; meant for a single cache level, since
+    // lower levels see only the misses of the sampled sets
+    void sampleSets(uint32_t ratio);
+
+    // Whether accesses to an address are simulated
+    bool isSampled(Addr addr);
+
+    // Number of sets, whether a set is simulated and its counts while
+    // sampling sets
+    uint32_t getSetNum();
+    bool isSetSampled(uint32_t id);
+    const SetStatistics &getSetStatistics(uint32_t id);
+
+    // Checks the block state of every set for internal consistency. Builds
+    // with CACHE_VALIDATE also check the affected set after every fill
+    bool validate();
+
+#ifdef CACHESIM_PROFILE
+    // Miss classes of this level and of one set
+    const Profile &getProfile() const { return profile; }
+    const Profile &getSetProfile(uint32_t id) const { return setProfiles[id]; }
+
+    // Writes one CSV row per set, for a heatmap of where the level misses
+    void writeSetProfile(FILE *out, const char *name);
+#endif
+
+    // Coherence and inclusion support. invalidateBlock() drops the block
+    // holding addr, writing it back first if modified: to the level below,
+    // or straight to memory if toMemory. cleanBlock() writes a modified
+    // block back to the level below and keeps it. They return whether the
+    // block was present and dirty respectively. A timing-only cache queues
+    // the write-backs like any other
+    bool invalidateBlock(Addr addr, bool toMemory = false);
+    bool cleanBlock(Addr addr);
+
+    // Functional data access without timing or statistics, for data that
+    // moves between caches outside the hierarchy. peekBlock() copies size
+    // bytes at addr if its block is present; pokeBlock() stores them in
+    // the first level from this one down holding the block, or in memory.
+    // The range lies within one block. A timing-only cache has no data
+    bool peekBlock(Addr addr, uint32_t size, uint8_t *out);
+    void pokeBlock(Addr addr, uint32_t size, const uint8_t *src);
+
+    // Records the address of every valid block this level evicts to make
+    // room, until takeEvictions() moves the list to out
+    void trackEvictions(bool enable);
+    void takeEvictions(std::vector<Addr> &out);
+
+    // Checkpoint support. saveState() appends the block tags, dirty bits,
+    // replacement state and, if withData, the block data of this level;
+    // restoreState() reads them back into a cache of the same geometry,
+    // skipping the data if timing-only, and drops prefetch bookkeeping.
+    // Queued transfers must have been flushed before either
+    void saveState(std::vector<uint8_t> &out, bool withData);
+    bool restoreState(const uint8_t *&p, const uint8_t *end, bool withData);
+
+    // Victim cache of this level, or nullptr
+    BasicCache *getVictimCache() { return victimCache; }
+
+    // Bytes of the valid blocks of this level and its victim cache
+    uint64_t getEffectiveCapacity() const;
+
+    // Configuration of this level
+    const Policy &getPolicy() const { return policy; }
+    bool isTimingOnly() const { return timingOnly; }
+    bool isWriteAllocate() const { return writeAllocate; }
+
     // Public statistics member
     Statistics statistics;
 
 private:
-    uint32_t referenceCounter;     // Global reference counter for LRU
     bool writeBack;                // Write-back policy flag
     bool writeAllocate;            // Write-allocate policy flag
-    MemoryManager *memory;         // Pointer to the memory manager
-    Cache *lowerCache;             // Pointer to the lower cache level
+    bool timingOnly;               // Track tags and statistics only
+    bool inclusiveBelow;           // Some level below is inclusive
+    Memory *memory;                // Pointer to the memory manager
+    BasicCache *lowerCache;        // Pointer to the lower cache level
+    BasicCache *upperCache;        // Level above, whose lowerCache this is
+    BasicCache *victimCache;       // Owned victim cache, the lowerCache
+    bool victimBuffer;             // Whether this is a victim cache
+    bool fillDirty;                // Exclusive level: the last block moved
+                                   // up was modified
     Policy policy;                 // Cache configuration policy
-    std::vector<Block> blocks;     // Vector of cache blocks
+
+    // Address decoding derived from the policy once at construction
+    uint32_t offsetBits;           // log2(blockSize)
+    uint32_t idBits;               // log2(number of sets)
+    uint32_t offsetMask;           // Selects the byte offset within a block
+    uint32_t idMask;               // Selects the set ID after the shift
+    uint32_t tagShift;             // offsetBits + idBits
+    uint32_t wayBits;              // log2(associativity)
+    uint32_t wayMask;              // Selects the way from a block ID
+
+    // Block lookup, possibly specialized for the block size and
+    // associativity at compile time
+    typedef uint32_t (BasicCache::*LookupFn)(Addr addr);
+    LookupFn lookup;
+
+    // Block state as a structure of arrays. Block i of set s lives at index
+    // s * associativity + i, so the keys of one set are contiguous and can
+    // be compared with a few SIMD instructions
+    std::vector<Addr> keys;              // Packed (tag << 1) | valid, 0 if invalid
+    std::vector<uint8_t> modified;       // Modified bit for write-back
+    std::vector<uint8_t> data;           // Data arena, blockSize bytes per block
+    std::vector<uint8_t> fillBuffer;     // Staging area for a block being loaded
+    ReplacementPolicy *replacement;      // Owns the per-set replacement state
+
+    // Source of each block's fill until its first demand use
+    enum PrefetchSource : uint8_t {
+        NOT_PREFETCHED,                  // Demand fill or already used
+        PREFETCH_FILL,                   // Prefetch from above or a record
+        OWN_PREFETCH,                    // Named by this level's prefetcher
+    };
+    std::vector<uint8_t> prefetched;     // PrefetchSource per block
+
+    // Prefetcher state, empty unless a prefetcher is attached
+    Prefetcher *prefetcher;              // Owned prefetcher or nullptr
+    std::vector<uint64_t> prefetchTimes; // Demand access count at the fill
+                                         // of an unused prefetched block,
+                                         // else 0
+    std::vector<uint64_t> prefetchQueue; // Addresses named by the last access
+    uint64_t lateAccesses;               // Uses within this many accesses
+                                         // of the fill are late
+
+    // A block transfer queued for the lower level by a timing-only cache
+    struct Transfer {
+        Addr addr;                 // First byte
+        uint32_t size;             // Length in bytes
+        bool isWrite;              // Write-back (true) or fill
+        bool isPrefetch;           // Fill on behalf of a prefetch
+        bool isVictim;             // Evicted block for an exclusive level,
+                                   // modified if isWrite
+    };
+    std::vector<Transfer> lowerBatch;    // Queued lower-level transfers
+
+    bool evictionTracking;               // Record evicted blocks
+    std::vector<Addr> evictions;         // Evicted since takeEvictions()
+
+    // Queued lower-level transfers that trigger a flush
+    static const size_t LOWER_BATCH_TRANSFERS = 4096;
+
+    // Set sampling state, empty unless sampling sets
+    std::vector<uint8_t> sampledSets;          // Whether a set is simulated
+    std::vector<SetStatistics> setStatistics;  // Counts per sampled set
+
+#ifdef CACHESIM_PROFILE
+    // 3C classification against a shadow fully associative LRU cache of
+    // blockNum blocks, most recent first, and every block ever referenced
+    Profile profile;
+    std::vector<Profile> setProfiles;
+    std::list<Addr> shadowBlocks;
+    std::unordered_map<Addr, typename std::list<Addr>::iterator> shadowIndex;
+    std::unordered_set<Addr> referencedBlocks;
+
+    // Classifies a demand access the real cache hit or missed
+    void profileAccess(Addr addr, bool miss);
+#endif
 
     // Initializes all cache blocks based on the policy
     void initCache();
 
-    // Loads a block from the lower cache level or memory
-    void loadBlockFromLowerLevel(uint32_t addr, uint32_t *cycles = nullptr, bool is_prefetch = false);
+    // Derives the address decoding and picks the block lookup
+    void initAddressDecoding();
+
+    // Block lookup for any configuration
+    uint32_t lookupGeneric(Addr addr);
+
+    // Block lookup with block size and associativity known at compile time,
+    // so the address split folds into constants and the way search unrolls
+    template <uint32_t BlockSize, uint32_t Associativity>
+    uint32_t lookupFixed(Addr addr);
+
+    // Filters an access while sampling sets, counting it for its set
+    bool sampleAccess(Addr addr, bool isDemand);
 
-    // Determines which block to replace using LRU policy
+    // Read and write paths shared by the single, batched and block
+    // accesses, charging their statistics to stats. readBlock() returns the
+    // ID of the block holding addr, or -1 if its set is not sampled;
+    // writeBytes() writes a range within one block, on demand or as a
+    // write-back from the level above
+    uint32_t readBlock(Addr addr, uint32_t *cycles, bool is_prefetch,
+                       Statistics &stats);
+    void writeBytes(Addr addr, const uint8_t *src, uint32_t size,
+                    uint32_t *cycles, bool isDemand, Statistics &stats);
+
+    // Runs one trace record of a batch, without its repeats, and fills the
+    // prefetches it triggered
+    void accessRecord(const Record &record, Statistics &stats);
+
+    // Runs the repeats of a record that has just run
+    void repeatRecord(const Record &record, Statistics &stats);
+
+    // Counts the first use of a prefetched block on a demand hit and shows
+    // the hit to the prefetcher, if any
+    void observeHit(Addr addr, uint32_t blockId, Statistics &stats);
+
+    // Shows a demand access to the prefetcher, counting the first use of a
+    // block it prefetched, and queues the addresses it names
+    void observeAccess(Addr addr, uint32_t blockId, bool miss,
+                       bool ownPrefetchHit);
+
+    // Fills the queued prefetches that are not present. Called once the
+    // access that queued them is done with its block, which they may evict
+    void issuePrefetches(Statistics &stats);
+
+    // Block transfers split into this cache's blocks, charged to stats
+    void fill(Addr addr, uint32_t size, uint8_t *out, uint32_t *cycles,
+              bool is_prefetch, Statistics &stats);
+    void writeback(Addr addr, uint32_t size, const uint8_t *src,
+                   Statistics &stats);
+
+    // Block fill of an exclusive level: a hit hands the block up and drops
+    // it here, a miss is passed on without allocating
+    void fillExclusive(Addr addr, uint32_t size, uint8_t *out,
+                       uint32_t *cycles, bool is_prefetch, Statistics &stats);
+
+    // Places a block the level above evicted into an exclusive level
+    void insertVictim(Addr addr, uint32_t size, const uint8_t *src,
+                      bool dirty, Statistics &stats);
+
+    // Runs a batch of transfers queued by the level above
+    void transfer(const Transfer *begin, const Transfer *end);
+
+    // Transfers a block to or from the lower cache level, through the
+    // queue if timing-only
+    void forwardFill(Addr addr, uint32_t size, uint8_t *out,
+                     uint32_t *cycles, bool is_prefetch);
+    void forwardWriteback(Addr addr, uint32_t size, const uint8_t *src);
+    void forwardVictim(uint32_t blockId);
+
+    // Loads a block from the lower cache level or memory, charging a dirty
+    // victim's write-back to stats; returns the ID of the filled block
+    uint32_t loadBlockFromLowerLevel(Addr addr, uint32_t *cycles,
+                                     bool is_prefetch, Statistics &stats);
+
+    // Determines which block to replace: an invalid block if the set has
+    // one, otherwise the replacement policy's victim
     uint32_t getReplacementBlockId(uint32_t begin, uint32_t end);
 
-    // Writes a block to the lower cache level or memory
-    void writeBlockToLowerLevel(Block &b);
+    // Evicts the valid block blockId to make room, handing it to an
+    // exclusive level below or writing it back if dirty, and
+    // back-invalidating it above if inclusive. The block stays allocated
+    void evictBlock(uint32_t blockId, Statistics &stats);
 
-    // Validates the cache configuration policy
-    bool isPolicyValid();
+    // Drops the copies of a block of this level from every level above,
+    // folding modified data into it
+    void backInvalidate(uint32_t blockId, Statistics &stats);
 
-    // Checks if a number is a power of two
-    bool isPowerOfTwo(uint32_t n);
+    // Checks if any level above holds the block of an address
+    bool isHeldAbove(Addr addr);
+
+    // Drops a block without writing it back
+    void dropBlock(uint32_t blockId);
+
+    // Writes a block to the lower cache level or memory, counted in stats
+    void writeBlockToLowerLevel(uint32_t blockId, Statistics &stats);
+
+    // Checks the block state of one set for internal consistency
+    bool validateSet(uint32_t id);
 
     // Calculates the integer log base 2 of a value
     uint32_t log2i(uint32_t val);
 
     // Extracts the tag from an address
-    uint32_t getTag(uint32_t addr);
+    Addr getTag(Addr addr);
 
     // Extracts the set ID from an address
-    uint32_t getId(uint32_t addr);
+    uint32_t getId(Addr addr);
 
     // Extracts the byte offset within a block from an address
-    uint32_t getOffset(uint32_t addr);
+    uint32_t getOffset(Addr addr);
+
+    // Reconstructs the address from a block's tag and set
+    Addr getAddr(uint32_t blockId);
 
-    // Reconstructs the address from a block's tag and ID
-    uint32_t getAddr(Block &b);
+    // Packs a tag into the key of a valid block and back
+    static Addr makeKey(Addr tag) { return (tag << 1) | 1; }
+    static Addr keyTag(Addr key) { return key >> 1; }
+
+    // Checks the valid bit of a block
+    bool isValid(uint32_t blockId) const { return keys[blockId] & 1; }
 };
 
-#endif#endif
\ No newline at end of file
+// Caches of 32-bit and 64-bit addresses
+typedef BasicCache<uint32_t> Cache;
+typedef BasicCache<uint64_t> Cache64;
+
+#endif
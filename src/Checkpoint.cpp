@@ -0,0 +1,145 @@
+/*
+ * Implementation of the cache state checkpoints
+ */
+
+#include <cstdio>
+
+#include "Cache.h"
+#include "Checkpoint.h"
+#include "MemoryManager.h"
+
+const char CheckpointBase::MAGIC[4] = {'C', 'C', 'K', 'P'};
+
+// Writes the header, the state of every level and, with data, the pages
+template <typename Addr>
+bool BasicCheckpoint<Addr>::save(const char *path,
+                                 const std::vector<BasicCache<Addr> *> &levels,
+                                 BasicMemoryManager<Addr> *memory,
+                                 uint64_t recordOffset) {
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr) {
+        printf("Unable to open file %s\n", path);
+        return false;
+    }
+
+    levels[0]->flush();
+    bool withData = !levels[0]->isTimingOnly();
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MAGIC, sizeof(header.magic));
+    header.version = VERSION;
+    header.addrBits = sizeof(Addr) * 8;
+    header.levelNum = levels.size();
+    header.flags = withData ? HAS_DATA : 0;
+    header.recordOffset = recordOffset;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    std::vector<uint8_t> state;
+    for (BasicCache<Addr> *level : levels) {
+        const CacheBase::Policy &policy = level->getPolicy();
+        state.clear();
+        level->saveState(state, withData);
+        LevelHeader levelHeader = {policy.cacheSize, policy.blockSize,
+                                   policy.associativity,
+                                   uint32_t(policy.replacement),
+                                   state.size()};
+        ok = ok && fwrite(&levelHeader, sizeof(levelHeader), 1, file) == 1 &&
+             fwrite(state.data(), 1, state.size(), file) == state.size();
+    }
+    if (withData) {
+        state.clear();
+        memory->saveState(state);
+        ok = ok && fwrite(state.data(), 1, state.size(), file) == state.size();
+    }
+
+    ok = fclose(file) == 0 && ok;
+    if (!ok) {
+        printf("Unable to write file %s\n", path);
+    }
+    return ok;
+}
+
+// Checks the header and the geometry of every level before restoring it
+template <typename Addr>
+bool BasicCheckpoint<Addr>::load(const char *path,
+                                 const std::vector<BasicCache<Addr> *> &levels,
+                                 BasicMemoryManager<Addr> *memory,
+                                 uint64_t &recordOffset) {
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr) {
+        printf("Unable to open file %s\n", path);
+        return false;
+    }
+
+    Header header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1;
+    if (!ok || memcmp(header.magic, MAGIC, sizeof(header.magic)) != 0) {
+        printf("Not a checkpoint file %s\n", path);
+        fclose(file);
+        return false;
+    }
+    bool withData = (header.flags & HAS_DATA) != 0;
+    if (header.version != VERSION) {
+        printf("Unsupported checkpoint version %d in %s\n", header.version,
+               path);
+        ok = false;
+    } else if (header.addrBits != sizeof(Addr) * 8 ||
+               header.levelNum != levels.size()) {
+        printf("Checkpoint %s is of a %d-level %d-bit hierarchy\n", path,
+               header.levelNum, header.addrBits);
+        ok = false;
+    } else if (!withData && !levels[0]->isTimingOnly()) {
+        printf("Checkpoint %s has no data; restore it with -t\n", path);
+        ok = false;
+    }
+
+    std::vector<uint8_t> state;
+    for (size_t i = 0; ok && i < levels.size(); ++i) {
+        const CacheBase::Policy &policy = levels[i]->getPolicy();
+        LevelHeader levelHeader;
+        if (fread(&levelHeader, sizeof(levelHeader), 1, file) != 1) {
+            printf("Truncated checkpoint file %s\n", path);
+            ok = false;
+            break;
+        }
+        if (levelHeader.cacheSize != policy.cacheSize ||
+            levelHeader.blockSize != policy.blockSize ||
+            levelHeader.associativity != policy.associativity ||
+            levelHeader.replacement != uint32_t(policy.replacement)) {
+            printf("Checkpoint %s does not match cache level %d\n", path,
+                   int(i + 1));
+            ok = false;
+            break;
+        }
+        state.resize(levelHeader.size);
+        const uint8_t *p = state.data();
+        ok = fread(state.data(), 1, state.size(), file) == state.size() &&
+             levels[i]->restoreState(p, state.data() + state.size(),
+                                     withData) &&
+             p == state.data() + state.size();
+        if (!ok) {
+            printf("Corrupt checkpoint file %s\n", path);
+        }
+    }
+
+    if (ok && withData) {
+        state.clear();
+        uint8_t buffer[65536];
+        for (size_t n; (n = fread(buffer, 1, sizeof(buffer), file)) > 0;) {
+            state.insert(state.end(), buffer, buffer + n);
+        }
+        const uint8_t *p = state.data();
+        if (!levels[0]->isTimingOnly() &&
+            !memory->restoreState(p, state.data() + state.size())) {
+            printf("Corrupt checkpoint file %s\n", path);
+            ok = false;
+        }
+    }
+
+    fclose(file);
+    recordOffset = header.recordOffset;
+    return ok;
+}
+
+template class BasicCheckpoint<uint32_t>;
+template class BasicCheckpoint<uint64_t>;
@@ -0,0 +1,97 @@
+/*
+ * Checkpoints of warmed cache state
+ * A checkpoint holds the block tags, dirty bits and replacement state of
+ * every level of a hierarchy after a number of trace records, and for a
+ * data-carrying hierarchy the block data and the memory pages as well. A
+ * later run restores it and goes on from that trace offset instead of
+ * paying for the warmup again. Statistics and prefetcher training are not
+ * part of a checkpoint: a restored run counts from zero, and blocks filled
+ * by prefetches count as demand fills
+ *
+ * The file starts with a Header, followed per level by a LevelHeader and
+ * its state, and then by the memory pages if the checkpoint has data. All
+ * fields are in host byte order
+ */
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+template <typename Addr>
+class BasicCache;
+template <typename Addr>
+class BasicMemoryManager;
+
+// File layout and the state buffer helpers shared by every address width
+class CheckpointBase {
+public:
+    struct Header {
+        char magic[4];            // MAGIC
+        uint16_t version;         // VERSION
+        uint16_t addrBits;        // Address width of the hierarchy
+        uint16_t levelNum;        // Cache levels, first level first
+        uint16_t flags;           // Combination of Flag bits
+        uint32_t reserved;        // Zero
+        uint64_t recordOffset;    // Trace records simulated before it
+    };
+
+    enum Flag : uint16_t {
+        HAS_DATA = 1 << 0,        // Block data and memory pages included
+    };
+
+    // Geometry a level must have to be restored, and its state size
+    struct LevelHeader {
+        uint32_t cacheSize;
+        uint32_t blockSize;
+        uint32_t associativity;
+        uint32_t replacement;
+        uint64_t size;            // Bytes of state that follow
+    };
+
+    static const char MAGIC[4];
+    static const uint16_t VERSION = 1;
+
+    // Appends size bytes to a state buffer
+    static void append(std::vector<uint8_t> &out, const void *src,
+                       size_t size) {
+        const uint8_t *bytes = static_cast<const uint8_t *>(src);
+        out.insert(out.end(), bytes, bytes + size);
+    }
+
+    // Reads size bytes from a state buffer, advancing p; false if fewer
+    // than size bytes are left before end
+    static bool read(const uint8_t *&p, const uint8_t *end, void *dst,
+                     size_t size) {
+        if (size_t(end - p) < size)
+            return false;
+        memcpy(dst, p, size);
+        p += size;
+        return true;
+    }
+};
+
+template <typename Addr>
+class BasicCheckpoint : public CheckpointBase {
+public:
+    // Writes the state of levels, first level first, and of memory if the
+    // hierarchy carries data, as reached after recordOffset trace records
+    static bool save(const char *path,
+                     const std::vector<BasicCache<Addr> *> &levels,
+                     BasicMemoryManager<Addr> *memory, uint64_t recordOffset);
+
+    // Restores a checkpoint into a hierarchy of the same geometry. A
+    // timing-only hierarchy can restore any checkpoint, a data-carrying one
+    // only checkpoints with data. Sets recordOffset to the trace records
+    // the checkpoint covers
+    static bool load(const char *path,
+                     const std::vector<BasicCache<Addr> *> &levels,
+                     BasicMemoryManager<Addr> *memory, uint64_t &recordOffset);
+};
+
+typedef BasicCheckpoint<uint32_t> Checkpoint;
+typedef BasicCheckpoint<uint64_t> Checkpoint64;
+
+#endif
@@ -0,0 +1,441 @@
+/*
+ * Implementation of the coherence directory
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "Coherence.h"
+
+// Counters in output order, with their JSON key and text label
+static const struct {
+    const char *key;
+    const char *label;
+    uint64_t CoherenceBase::Statistics::*field;
+} coherenceFields[] = {
+    {"numReadMiss", "Read Misses", &CoherenceBase::Statistics::numReadMiss},
+    {"numWriteMiss", "Write Misses",
+     &CoherenceBase::Statistics::numWriteMiss},
+    {"numUpgrade", "Upgrades", &CoherenceBase::Statistics::numUpgrade},
+    {"numInvalidation", "Invalidations",
+     &CoherenceBase::Statistics::numInvalidation},
+    {"numFalseSharing", "False Sharing Invalidations",
+     &CoherenceBase::Statistics::numFalseSharing},
+    {"numCoherenceMiss", "Coherence Misses",
+     &CoherenceBase::Statistics::numCoherenceMiss},
+    {"numDowngrade", "Downgrades", &CoherenceBase::Statistics::numDowngrade},
+    {"numCoherenceWriteback", "Coherence Writebacks",
+     &CoherenceBase::Statistics::numCoherenceWriteback},
+    {"numCacheToCache", "Cache to Cache Transfers",
+     &CoherenceBase::Statistics::numCacheToCache},
+    {"numOwnershipTransfer", "Ownership Transfers",
+     &CoherenceBase::Statistics::numOwnershipTransfer},
+    {"numBackInvalidation", "Back Invalidations",
+     &CoherenceBase::Statistics::numBackInvalidation},
+};
+
+static const char *const protocolNames[] = {"mesi", "moesi"};
+static const char *const stateNames[] = {
+    "invalid", "shared", "exclusive", "owned", "modified",
+};
+
+// Returns the name of a protocol
+const char *CoherenceBase::getName(Protocol protocol) {
+    return protocolNames[protocol];
+}
+
+// Looks up a protocol by name
+bool CoherenceBase::parseName(const char *name, Protocol &protocol) {
+    for (uint32_t i = 0; i < sizeof(protocolNames) / sizeof(protocolNames[0]);
+         ++i) {
+        if (strcmp(name, protocolNames[i]) == 0) {
+            protocol = static_cast<Protocol>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns the name of a state
+const char *CoherenceBase::getStateName(State state) {
+    return stateNames[state];
+}
+
+template <typename Addr>
+BasicCoherence<Addr>::BasicCoherence(Protocol protocol, uint32_t blockSize,
+                                     bool inclusive)
+    : statistics(Statistics()), protocol(protocol), blockSize(blockSize),
+      offsetBits(0), inclusive(inclusive), l3cache(nullptr),
+      blockData(blockSize) {
+    while ((1u << offsetBits) < blockSize)
+        ++offsetBits;
+}
+
+// Adds the private stack of the next core
+template <typename Addr>
+void BasicCoherence<Addr>::addCore(BasicCache<Addr> *l1,
+                                   BasicCache<Addr> *l2) {
+    l1caches.push_back(l1);
+    l2caches.push_back(l2);
+}
+
+// Sets the shared L3, which tracks its evictions if inclusive
+template <typename Addr>
+void BasicCoherence<Addr>::setShared(BasicCache<Addr> *l3) {
+    l3cache = l3;
+    l3cache->trackEvictions(inclusive);
+}
+
+template <typename Addr>
+uint32_t BasicCoherence<Addr>::getCoreNum() const {
+    return l1caches.size();
+}
+
+// Gets the block into a state that allows the access, then runs it through
+// the core's caches. Prefetch records acquire the block like reads but do
+// not count as accesses to its words
+template <typename Addr>
+void BasicCoherence<Addr>::access(uint32_t core, const Record &record) {
+    uint32_t id = getLine(record.addr);
+    uint32_t offset = record.addr & (blockSize - 1);
+    uint64_t word = uint64_t(1) << ((uint64_t(offset) << 6) >> offsetBits);
+    if (record.isWrite()) {
+        acquireWrite(core, id, word);
+    } else {
+        acquireRead(core, id);
+    }
+    if (!record.isPrefetch()) {
+        words[id * getCoreNum() + core] |= word;
+    }
+
+    l1caches[core]->access(&record, &record + 1);
+    if (inclusive) {
+        backInvalidate();
+    }
+}
+
+// Coherence state of a block in a core's stack, as the directory sees it
+template <typename Addr>
+CoherenceBase::State BasicCoherence<Addr>::getState(uint32_t core,
+                                                    Addr addr) const {
+    typename std::unordered_map<Addr, uint32_t>::const_iterator it =
+        index.find(addr & ~Addr(blockSize - 1));
+    if (it == index.end()) {
+        return INVALID;
+    }
+    const Line &line = lines[it->second];
+    if (line.owner == int32_t(core)) {
+        return line.ownerState;
+    }
+    return (line.holders >> core) & 1 ? SHARED : INVALID;
+}
+
+// Directory entry of the block holding addr, created if new
+template <typename Addr>
+uint32_t BasicCoherence<Addr>::getLine(Addr addr) {
+    Addr block = addr & ~Addr(blockSize - 1);
+    typename std::unordered_map<Addr, uint32_t>::iterator it =
+        index.find(block);
+    if (it != index.end()) {
+        return it->second;
+    }
+
+    uint32_t id = lines.size();
+    Line line = Line();
+    line.addr = block;
+    line.owner = -1;
+    line.ownerState = INVALID;
+    line.lastWriter = -1;
+    lines.push_back(line);
+    words.resize(words.size() + getCoreNum(), 0);
+    index.emplace(block, id);
+    return id;
+}
+
+// A read by a core that holds the block needs nothing. Otherwise holders
+// that silently evicted it are dropped, a remaining owner is downgraded and
+// the reader joins, exclusively if it is alone
+template <typename Addr>
+void BasicCoherence<Addr>::acquireRead(uint32_t core, uint32_t id) {
+    uint64_t self = uint64_t(1) << core;
+    Line &line = lines[id];
+    if (line.holders & self) {
+        // A sharer refetching a block it evicted gets it from the owner
+        if (line.owner >= 0 && line.owner != int32_t(core) &&
+            line.ownerState == OWNED && !l1caches[core]->inCache(line.addr) &&
+            !l2caches[core]->inCache(line.addr)) {
+            downgradeOwner(id);
+        }
+        return;
+    }
+    statistics.numReadMiss++;
+    if (line.invalidated & self) {
+        statistics.numCoherenceMiss++;
+        line.numCoherenceMiss++;
+        line.invalidated &= ~self;
+    }
+
+    for (uint32_t c = 0; c < getCoreNum(); ++c) {
+        if (((line.holders >> c) & 1) && !l1caches[c]->inCache(line.addr) &&
+            !l2caches[c]->inCache(line.addr)) {
+            line.holders &= ~(uint64_t(1) << c);
+            if (line.owner == int32_t(c)) line.owner = -1;
+        }
+    }
+    if (line.owner >= 0) {
+        downgradeOwner(id);
+    }
+    if (line.lastWriter >= 0 && line.lastWriter != int32_t(core)) {
+        dropCopy(core, id);
+    }
+    if (line.holders == 0) {
+        line.owner = core;
+        line.ownerState = EXCLUSIVE;
+    }
+    line.holders |= self;
+    words[id * getCoreNum() + core] = 0;
+}
+
+// A write by the exclusive owner needs nothing; any other write invalidates
+// every other holder and leaves the writer owning the block modified
+template <typename Addr>
+void BasicCoherence<Addr>::acquireWrite(uint32_t core, uint32_t id,
+                                        uint64_t word) {
+    uint64_t self = uint64_t(1) << core;
+    Line &line = lines[id];
+    bool holds = (line.holders & self) != 0;
+    if (holds && line.owner == int32_t(core) &&
+        (line.ownerState == EXCLUSIVE || line.ownerState == MODIFIED)) {
+        line.ownerState = MODIFIED;
+        line.lastWriter = core;
+        return;
+    }
+
+    if (holds) {
+        statistics.numUpgrade++;
+    } else {
+        statistics.numWriteMiss++;
+        if (line.invalidated & self) {
+            statistics.numCoherenceMiss++;
+            line.numCoherenceMiss++;
+            line.invalidated &= ~self;
+        }
+        words[id * getCoreNum() + core] = 0;
+    }
+    if (line.lastWriter >= 0 && line.lastWriter != int32_t(core)) {
+        statistics.numOwnershipTransfer++;
+        line.numOwnershipTransfer++;
+        if (!holds) dropCopy(core, id);
+    }
+    for (uint32_t c = 0; c < getCoreNum(); ++c) {
+        if (c != core && ((line.holders >> c) & 1)) {
+            invalidateCore(c, id, word);
+        }
+    }
+
+    line.holders = self;
+    line.owner = core;
+    line.ownerState = MODIFIED;
+    line.lastWriter = core;
+}
+
+// Downgrades the block's owner for a reader. A clean exclusive owner just
+// becomes a sharer. A dirty one is cleaned into the L3 under MESI; under
+// MOESI it keeps the block dirty as its owner and supplies the data
+template <typename Addr>
+void BasicCoherence<Addr>::downgradeOwner(uint32_t id) {
+    Line &line = lines[id];
+    uint32_t owner = line.owner;
+    State state = line.ownerState;
+    if (state == EXCLUSIVE) {
+        statistics.numDowngrade++;
+        line.owner = -1;
+        return;
+    }
+
+    if (protocol == MESI) {
+        statistics.numDowngrade++;
+        statistics.numCoherenceWriteback++;
+        line.owner = -1;
+        l1caches[owner]->cleanBlock(line.addr);
+        l1caches[owner]->flush();
+        l2caches[owner]->cleanBlock(line.addr);
+        l2caches[owner]->flush();
+        return;
+    }
+
+    if (state == MODIFIED) {
+        statistics.numDowngrade++;
+        line.ownerState = OWNED;
+    }
+    statistics.numCacheToCache++;
+    if (l1caches[owner]->peekBlock(line.addr, blockSize, blockData.data()) ||
+        l2caches[owner]->peekBlock(line.addr, blockSize, blockData.data())) {
+        l3cache->pokeBlock(line.addr, blockSize, blockData.data());
+    }
+}
+
+// Drops a core's copy of the block for another core's write to word. Dirty
+// data is written back through the core's L2 into the L3; the flushes keep
+// a timing-only hierarchy in the same order as a data-carrying one
+template <typename Addr>
+void BasicCoherence<Addr>::invalidateCore(uint32_t core, uint32_t id,
+                                          uint64_t word) {
+    Addr addr = lines[id].addr;
+    bool present = l1caches[core]->invalidateBlock(addr);
+    l1caches[core]->flush();
+    present = l2caches[core]->invalidateBlock(addr) || present;
+    l2caches[core]->flush();
+    if (!present) {
+        return;
+    }
+
+    Line &line = lines[id];
+    statistics.numInvalidation++;
+    line.numInvalidation++;
+    line.invalidated |= uint64_t(1) << core;
+    if ((words[id * getCoreNum() + core] & word) == 0) {
+        statistics.numFalseSharing++;
+        line.numFalseSharing++;
+    }
+}
+
+// Drops a copy a prefetcher brought into a core's caches behind the
+// directory's back, which another core's write may have left stale; it is
+// clean, as any write would have made the core a holder
+template <typename Addr>
+void BasicCoherence<Addr>::dropCopy(uint32_t core, uint32_t id) {
+    Addr addr = lines[id].addr;
+    l1caches[core]->invalidateBlock(addr);
+    l2caches[core]->invalidateBlock(addr);
+}
+
+// Drops the private copies of the blocks the inclusive L3 evicted, held
+// or prefetched by any core. The L2 goes first so that memory ends up with
+// the newer data of a dirty L1
+template <typename Addr>
+void BasicCoherence<Addr>::backInvalidate() {
+    l3cache->takeEvictions(evicted);
+    for (Addr addr : evicted) {
+        for (uint32_t c = 0; c < getCoreNum(); ++c) {
+            bool present = l2caches[c]->invalidateBlock(addr, true);
+            present = l1caches[c]->invalidateBlock(addr, true) || present;
+            if (present) statistics.numBackInvalidation++;
+        }
+        typename std::unordered_map<Addr, uint32_t>::iterator it =
+            index.find(addr);
+        if (it != index.end()) {
+            lines[it->second].holders = 0;
+            lines[it->second].owner = -1;
+        }
+    }
+}
+
+// Coherence traffic of a directory entry, for ranking hot lines
+template <typename Line>
+static uint64_t getTraffic(const Line &line) {
+    return line.numInvalidation + line.numCoherenceMiss +
+           line.numOwnershipTransfer;
+}
+
+// Prints the statistics and the count hot lines as text or as JSON object
+// members; CSV output only has the cache table
+template <typename Addr>
+void BasicCoherence<Addr>::writeStatistics(FILE *out,
+                                           CacheBase::StatisticsFormat format,
+                                           uint32_t count) {
+    const size_t fieldNum =
+        sizeof(coherenceFields) / sizeof(coherenceFields[0]);
+    if (format == CacheBase::CSV) {
+        return;
+    }
+
+    std::vector<uint32_t> hot;
+    for (uint32_t id = 0; id < lines.size(); ++id) {
+        if (getTraffic(lines[id]) > 0)
+            hot.push_back(id);
+    }
+    std::sort(hot.begin(), hot.end(), [this](uint32_t a, uint32_t b) {
+        uint64_t x = getTraffic(lines[a]), y = getTraffic(lines[b]);
+        return x != y ? x > y : lines[a].addr < lines[b].addr;
+    });
+    if (hot.size() > count) {
+        hot.resize(count);
+    }
+
+    if (format == CacheBase::TEXT) {
+        fprintf(out, "-------- COHERENCE ----------\n");
+        fprintf(out, "Protocol: %s, %s L3\n", getName(protocol),
+                inclusive ? "inclusive" : "non-inclusive");
+        for (size_t i = 0; i < fieldNum; ++i) {
+            fprintf(out, "%s: %llu\n", coherenceFields[i].label,
+                    (unsigned long long)(statistics.*coherenceFields[i].field));
+        }
+        if (!hot.empty())
+            fprintf(out, "Hot Lines:\n");
+        for (uint32_t id : hot) {
+            const Line &line = lines[id];
+            fprintf(out,
+                    "0x%llx: %llu invalidations (%llu false sharing), "
+                    "%llu coherence misses, %llu ownership transfers\n",
+                    (unsigned long long)line.addr,
+                    (unsigned long long)line.numInvalidation,
+                    (unsigned long long)line.numFalseSharing,
+                    (unsigned long long)line.numCoherenceMiss,
+                    (unsigned long long)line.numOwnershipTransfer);
+        }
+        return;
+    }
+
+    fprintf(out, "  \"coherence\": {\"protocol\": \"%s\", \"inclusive\": %s",
+            getName(protocol), inclusive ? "true" : "false");
+    for (size_t i = 0; i < fieldNum; ++i) {
+        fprintf(out, ", \"%s\": %llu", coherenceFields[i].key,
+                (unsigned long long)(statistics.*coherenceFields[i].field));
+    }
+    fprintf(out, "},\n  \"hotLines\": [");
+    for (size_t i = 0; i < hot.size(); ++i) {
+        const Line &line = lines[hot[i]];
+        fprintf(out,
+                "%s\n    {\"line\": \"0x%llx\", \"invalidations\": %llu, "
+                "\"falseSharing\": %llu, \"coherenceMisses\": %llu, "
+                "\"ownershipTransfers\": %llu}",
+                i == 0 ? "" : ",", (unsigned long long)line.addr,
+                (unsigned long long)line.numInvalidation,
+                (unsigned long long)line.numFalseSharing,
+                (unsigned long long)line.numCoherenceMiss,
+                (unsigned long long)line.numOwnershipTransfer);
+    }
+    fprintf(out, "%s]", hot.empty() ? "" : "\n  ");
+}
+
+// Writes the counters of every line with coherence traffic as CSV
+template <typename Addr>
+bool BasicCoherence<Addr>::writeLines(const char *path) {
+    FILE *file = fopen(path, "w");
+    if (file == nullptr) {
+        printf("Unable to open file %s\n", path);
+        return false;
+    }
+    fprintf(file, "line,invalidations,falseSharing,coherenceMisses,"
+                  "ownershipTransfers\n");
+    for (const Line &line : lines) {
+        if (getTraffic(line) == 0)
+            continue;
+        fprintf(file, "0x%llx,%llu,%llu,%llu,%llu\n",
+                (unsigned long long)line.addr,
+                (unsigned long long)line.numInvalidation,
+                (unsigned long long)line.numFalseSharing,
+                (unsigned long long)line.numCoherenceMiss,
+                (unsigned long long)line.numOwnershipTransfer);
+    }
+    bool ok = !ferror(file);
+    ok = fclose(file) == 0 && ok;
+    if (!ok) {
+        printf("Unable to write file %s\n", path);
+    }
+    return ok;
+}
+
+template class BasicCoherence<uint32_t>;
+template class BasicCoherence<uint64_t>;
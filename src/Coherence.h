@@ -0,0 +1,166 @@
+/*
+ * Directory-based MESI / MOESI coherence between private cache stacks
+ * Every core has a private L1 and L2; the L2s share one L3. A directory
+ * beside the L3 tracks, per block, which cores may hold it and which one
+ * owns it. Each core's stack is one coherence agent: the directory leaves
+ * the private caches to their normal fills, evictions and write-backs and
+ * only steps in when a core reads a block it does not hold, or writes one
+ * it does not own exclusively. Private evictions are silent, so the
+ * directory may list stale holders, which are dropped before it decides
+ * on a sharing state. Prefetchers fill private caches without the
+ * directory; such a copy is dropped when its core first accesses the
+ * block if another core has written it
+ *
+ * MESI writes a modified block back to the L3 when another core reads it.
+ * MOESI keeps it dirty in the OWNED state and supplies the data cache to
+ * cache, modelled as a functional copy to the L3 without any traffic. With
+ * an inclusive L3 every block it evicts is invalidated in the private
+ * caches, dirty copies going straight to memory
+ *
+ * An invalidation is counted as false sharing when the invalidated core
+ * never accessed the word the writer is writing, with 64 word slots per
+ * block. Per-block counters of invalidations, coherence misses and
+ * ownership transfers point at ping-pong lines
+ */
+
+#ifndef COHERENCE_H
+#define COHERENCE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <unordered_map>
+#include <vector>
+
+#include "Cache.h"
+
+// Protocol, states and statistics shared by every address width
+class CoherenceBase {
+public:
+    enum Protocol {
+        MESI,
+        MOESI,
+    };
+
+    // State of a block in one core's private stack
+    enum State : uint8_t {
+        INVALID,
+        SHARED,
+        EXCLUSIVE,
+        OWNED,
+        MODIFIED,
+    };
+
+    struct Statistics {
+        uint64_t numReadMiss;         // Reads of blocks the core did not hold
+        uint64_t numWriteMiss;        // Writes of blocks the core did not hold
+        uint64_t numUpgrade;          // Writes to SHARED or OWNED blocks
+        uint64_t numInvalidation;     // Private copies invalidated
+        uint64_t numFalseSharing;     // Of those, false sharing
+        uint64_t numCoherenceMiss;    // Accesses missing after invalidation
+        uint64_t numDowngrade;        // Owners downgraded by a reader
+        uint64_t numCoherenceWriteback;  // Dirty blocks cleaned for a reader
+        uint64_t numCacheToCache;     // Dirty blocks supplied by an owner
+        uint64_t numOwnershipTransfer;   // Exclusive owner changed cores
+        uint64_t numBackInvalidation; // Private copies dropped by inclusion
+    };
+
+    // Cores the sharer masks can hold
+    static const uint32_t MAX_CORES = 64;
+
+    // Converts between protocols and their names ("mesi", "moesi")
+    static const char *getName(Protocol protocol);
+    static bool parseName(const char *name, Protocol &protocol);
+
+    // Name of a state for verbose output
+    static const char *getStateName(State state);
+};
+
+template <typename Addr>
+class BasicCoherence : public CoherenceBase {
+public:
+    typedef typename BasicCache<Addr>::Record Record;
+
+    // Coherence over caches of the given block size, which every level
+    // must use. With inclusive set the shared L3 tracks its evictions
+    BasicCoherence(Protocol protocol, uint32_t blockSize, bool inclusive);
+
+    // Adds the private stack of the next core, whose L2 must have l3 below
+    // it; the caches stay owned by the caller
+    void addCore(BasicCache<Addr> *l1, BasicCache<Addr> *l2);
+    void setShared(BasicCache<Addr> *l3);
+
+    uint32_t getCoreNum() const;
+
+    // Runs one record of the given core through its stack, after the
+    // directory has made the block's state allow the access
+    void access(uint32_t core, const Record &record);
+
+    // Coherence state of a block in a core's stack
+    State getState(uint32_t core, Addr addr) const;
+
+    // Prints the coherence statistics and the count lines with the most
+    // coherence traffic, as text or as JSON object members
+    void writeStatistics(FILE *out, CacheBase::StatisticsFormat format,
+                         uint32_t count);
+
+    // Writes the coherence counters of every line with any traffic as CSV
+    bool writeLines(const char *path);
+
+    Statistics statistics;
+
+private:
+    // Directory entry of a block
+    struct Line {
+        Addr addr;                    // First byte of the block
+        uint64_t holders;             // Cores that may hold the block
+        uint64_t invalidated;         // Cores invalidated since their last
+                                      // access to the block
+        int32_t owner;                // Core in EXCLUSIVE, MODIFIED or
+                                      // OWNED state, -1 if none
+        State ownerState;
+        int32_t lastWriter;           // Last core to own it modified
+        uint64_t numInvalidation;     // Traffic counters of the block
+        uint64_t numFalseSharing;
+        uint64_t numCoherenceMiss;
+        uint64_t numOwnershipTransfer;
+    };
+
+    Protocol protocol;
+    uint32_t blockSize;
+    uint32_t offsetBits;              // log2(blockSize)
+    bool inclusive;
+    std::vector<BasicCache<Addr> *> l1caches;
+    std::vector<BasicCache<Addr> *> l2caches;
+    BasicCache<Addr> *l3cache;
+
+    std::unordered_map<Addr, uint32_t> index;   // Block to line entry
+    std::vector<Line> lines;
+    std::vector<uint64_t> words;      // Words accessed per line and core
+                                      // since the core got the block
+    std::vector<Addr> evicted;        // Blocks the L3 just evicted
+    std::vector<uint8_t> blockData;   // Staging for cache-to-cache data
+
+    // Directory entry of the block holding addr, created if new
+    uint32_t getLine(Addr addr);
+
+    // Makes way for a read or write by core
+    void acquireRead(uint32_t core, uint32_t id);
+    void acquireWrite(uint32_t core, uint32_t id, uint64_t word);
+
+    // Downgrades the block's owner for a reader
+    void downgradeOwner(uint32_t id);
+
+    // Drops a core's copy for another core's write
+    void invalidateCore(uint32_t core, uint32_t id, uint64_t word);
+
+    // Drops a core's prefetched copy that may be stale
+    void dropCopy(uint32_t core, uint32_t id);
+
+    // Drops the private copies of blocks the inclusive L3 evicted
+    void backInvalidate();
+};
+
+typedef BasicCoherence<uint32_t> Coherence;
+typedef BasicCoherence<uint64_t> Coherence64;
+
+#endif
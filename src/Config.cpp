@@ -0,0 +1,348 @@
+/*
+ * Implementation of the simulation config file
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+#include "Config.h"
+
+// Largest number of values a sweep range may expand to
+static const uint32_t MAX_RANGE_VALUES = 4096;
+
+// Strips leading and trailing blanks
+static std::string trim(const std::string &s) {
+    size_t begin = s.find_first_not_of(" \t\r");
+    if (begin == std::string::npos)
+        return "";
+    size_t end = s.find_last_not_of(" \t\r");
+    return s.substr(begin, end - begin + 1);
+}
+
+// Splits a comma separated list into its trimmed items
+static std::vector<std::string> split(const std::string &s) {
+    std::vector<std::string> items;
+    size_t begin = 0;
+    while (begin <= s.size()) {
+        size_t end = s.find(',', begin);
+        if (end == std::string::npos)
+            end = s.size();
+        items.push_back(trim(s.substr(begin, end - begin)));
+        begin = end + 1;
+    }
+    return items;
+}
+
+// Parses a number with an optional K, M or G suffix
+static bool parseSize(const std::string &s, uint32_t &value) {
+    const char *p = s.c_str();
+    char *end;
+    unsigned long long n = strtoull(p, &end, 10);
+    if (end == p || *p == '-')
+        return false;
+    switch (*end) {
+    case 'k':
+    case 'K':
+        n <<= 10;
+        ++end;
+        break;
+    case 'm':
+    case 'M':
+        n <<= 20;
+        ++end;
+        break;
+    case 'g':
+    case 'G':
+        n <<= 30;
+        ++end;
+        break;
+    }
+    if (*end != '\0' || n > UINT32_MAX)
+        return false;
+    value = n;
+    return true;
+}
+
+// Parses a list of numbers, each item a number or a range
+// "first..last [*factor|+step]"
+static bool parseNumbers(const std::string &s, std::vector<uint32_t> &out) {
+    out.clear();
+    for (const std::string &item : split(s)) {
+        size_t dots = item.find("..");
+        if (dots == std::string::npos) {
+            uint32_t value;
+            if (!parseSize(item, value))
+                return false;
+            out.push_back(value);
+            continue;
+        }
+
+        std::string rest = item.substr(dots + 2);
+        size_t op = rest.find_first_of("*+");
+        uint32_t first, last, step = 2;
+        bool multiply = true;
+        if (op != std::string::npos) {
+            multiply = rest[op] == '*';
+            if (!parseSize(trim(rest.substr(op + 1)), step))
+                return false;
+            rest = rest.substr(0, op);
+        }
+        if (!parseSize(trim(item.substr(0, dots)), first) ||
+            !parseSize(trim(rest), last) || first > last ||
+            (multiply ? step < 2 || first == 0 : step == 0))
+            return false;
+        for (uint64_t v = first; v <= last;
+             v = multiply ? v * step : v + step) {
+            if (out.size() >= MAX_RANGE_VALUES)
+                return false;
+            out.push_back(v);
+        }
+    }
+    return true;
+}
+
+// Parses yes/no as well as true/false and 1/0
+static bool parseFlag(const std::string &s, bool &value) {
+    if (s == "yes" || s == "true" || s == "1") {
+        value = true;
+    } else if (s == "no" || s == "false" || s == "0") {
+        value = false;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Parses a write policy, back or through
+static bool parseWrite(const std::string &s, bool &writeBack) {
+    if (s == "back") {
+        writeBack = true;
+    } else if (s == "through") {
+        writeBack = false;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+Config::Config() {
+    sweep.cacheSizes = {4 * 1024, 16 * 1024, 64 * 1024, 256 * 1024,
+                        1024 * 1024};
+    sweep.blockSizes = {32, 64, 128, 256};
+    sweep.associativities = {2, 4, 8, 16, 32};
+    sweep.writeBacks = {true, false};
+    sweep.writeAllocates = {true, false};
+    sweep.hitLatency = 1;
+    sweep.missLatency = 8;
+    timing.window = 32;
+    timing.memoryLatency = 0;
+    timing.memoryBandwidth = 16;
+    hasInstructionLevel = false;
+}
+
+// Level with the given name and the default policy
+Config::Level Config::makeLevel(const std::string &name) {
+    Level level;
+    level.name = name;
+    level.policy = {16 * 1024, 64, (16 * 1024) / 64, 1, 1, 0,
+                    ReplacementPolicy::LRU};
+    level.writeBack = true;
+    level.writeAllocate = true;
+    level.prefetch = false;
+    level.prefetcher = Prefetcher::STRIDE;
+    level.prefetchDegree = 0;
+    level.mshrs = 8;
+    return level;
+}
+
+// Reads the config file line by line
+bool Config::load(const char *path) {
+    std::ifstream file(path);
+    if (!file) {
+        printf("Unable to open file %s\n", path);
+        return false;
+    }
+
+    levels.clear();
+    hasInstructionLevel = false;
+    Level *level = nullptr;
+    enum { NONE, LEVEL, SWEEP, TIMING } section = NONE;
+    std::string line;
+    for (int lineNum = 1; std::getline(file, line); ++lineNum) {
+        line = trim(line);
+        if (line.empty() || line[0] == ';' || line[0] == '#')
+            continue;
+
+        if (line[0] == '[') {
+            std::string name = trim(line.substr(1, line.find(']') - 1));
+            if (line.back() != ']') {
+                printf("%s:%d: Malformed section header\n", path, lineNum);
+                return false;
+            }
+            if (name == "sweep") {
+                section = SWEEP;
+            } else if (name == "timing") {
+                section = TIMING;
+            } else if (name == "L1I" && !hasInstructionLevel) {
+                section = LEVEL;
+                instructionLevel = makeLevel(name);
+                hasInstructionLevel = true;
+                level = &instructionLevel;
+            } else if (name == "L" + std::to_string(levels.size() + 1) &&
+                       levels.size() < MAX_LEVELS) {
+                section = LEVEL;
+                levels.push_back(makeLevel(name));
+                level = &levels.back();
+            } else {
+                printf("%s:%d: Unknown section %s, expected sweep, timing, "
+                       "L1I or L%d\n",
+                       path, lineNum, name.c_str(), (int)levels.size() + 1);
+                return false;
+            }
+            continue;
+        }
+
+        size_t equals = line.find('=');
+        if (equals == std::string::npos || section == NONE) {
+            printf("%s:%d: Expected key = value in a section\n", path,
+                   lineNum);
+            return false;
+        }
+        std::string key = trim(line.substr(0, equals));
+        std::string value = line.substr(equals + 1);
+        size_t comment = value.find_first_of(";#");
+        value = trim(value.substr(0, comment));
+        bool ok = section == SWEEP    ? setSweepKey(key, value)
+                  : section == TIMING ? setTimingKey(key, value)
+                                      : setLevelKey(*level, key, value);
+        if (!ok) {
+            printf("%s:%d: Invalid %s = %s\n", path, lineNum, key.c_str(),
+                   value.c_str());
+            return false;
+        }
+    }
+
+    for (Level &level : levels) {
+        if (level.policy.blockSize > 0)
+            level.policy.blockNum =
+                level.policy.cacheSize / level.policy.blockSize;
+    }
+    CacheBase::Policy &policy = instructionLevel.policy;
+    if (hasInstructionLevel && policy.blockSize > 0)
+        policy.blockNum = policy.cacheSize / policy.blockSize;
+    return true;
+}
+
+// Sets a key of a level section
+bool Config::setLevelKey(Level &level, const std::string &key,
+                         const std::string &value) {
+    CacheBase::Policy &policy = level.policy;
+    if (key == "size") {
+        return parseSize(value, policy.cacheSize);
+    } else if (key == "block") {
+        return parseSize(value, policy.blockSize);
+    } else if (key == "associativity") {
+        return parseSize(value, policy.associativity);
+    } else if (key == "hit") {
+        return parseSize(value, policy.hitLatency);
+    } else if (key == "miss") {
+        return parseSize(value, policy.missLatency);
+    } else if (key == "write") {
+        return parseWrite(value, level.writeBack);
+    } else if (key == "allocate") {
+        return parseFlag(value, level.writeAllocate);
+    } else if (key == "replacement") {
+        return ReplacementPolicy::parseName(value.c_str(), policy.replacement);
+    } else if (key == "prefetcher") {
+        level.prefetch = value != "none";
+        if (!level.prefetch)
+            return true;
+        std::string name = value;
+        level.prefetchDegree = 0;
+        size_t colon = name.find(':');
+        if (colon != std::string::npos) {
+            if (!parseSize(name.substr(colon + 1), level.prefetchDegree) ||
+                level.prefetchDegree == 0)
+                return false;
+            name = name.substr(0, colon);
+        }
+        return Prefetcher::parseName(name.c_str(), level.prefetcher);
+    } else if (key == "mshrs") {
+        return parseSize(value, level.mshrs) && level.mshrs > 0;
+    } else if (key == "inclusion") {
+        return CacheBase::parseInclusion(value.c_str(), policy.inclusion);
+    } else if (key == "victim") {
+        return parseSize(value, policy.victimBlocks);
+    }
+    return false;
+}
+
+// Sets a dimension of the sweep section
+bool Config::setSweepKey(const std::string &key, const std::string &value) {
+    if (key == "size") {
+        return parseNumbers(value, sweep.cacheSizes);
+    } else if (key == "block") {
+        return parseNumbers(value, sweep.blockSizes);
+    } else if (key == "associativity") {
+        return parseNumbers(value, sweep.associativities);
+    } else if (key == "hit") {
+        return parseSize(value, sweep.hitLatency);
+    } else if (key == "miss") {
+        return parseSize(value, sweep.missLatency);
+    } else if (key == "replacement") {
+        sweep.replacements.clear();
+        for (const std::string &item : split(value)) {
+            ReplacementPolicy::Type type;
+            if (!ReplacementPolicy::parseName(item.c_str(), type))
+                return false;
+            sweep.replacements.push_back(type);
+        }
+        return true;
+    } else if (key != "write" && key != "allocate") {
+        return false;
+    }
+
+    std::vector<bool> flags;
+    for (const std::string &item : split(value)) {
+        bool flag;
+        if (key == "write" ? !parseWrite(item, flag) : !parseFlag(item, flag))
+            return false;
+        flags.push_back(flag);
+    }
+    if (key == "write") {
+        sweep.writeBacks = flags;
+    } else {
+        sweep.writeAllocates = flags;
+    }
+    return true;
+}
+
+const std::vector<Config::Level> &Config::getLevels() const {
+    return levels;
+}
+
+const Config::Level *Config::getInstructionLevel() const {
+    return hasInstructionLevel ? &instructionLevel : nullptr;
+}
+
+const Config::SweepSpace &Config::getSweep() const {
+    return sweep;
+}
+
+// Sets a parameter of the timing section
+bool Config::setTimingKey(const std::string &key, const std::string &value) {
+    if (key == "window") {
+        return parseSize(value, timing.window) && timing.window > 0;
+    } else if (key == "latency") {
+        return parseSize(value, timing.memoryLatency);
+    } else if (key == "bandwidth") {
+        return parseSize(value, timing.memoryBandwidth);
+    }
+    return false;
+}
+
+const TimingBase::Params &Config::getTiming() const {
+    return timing;
+}
@@ -0,0 +1,128 @@
+/*
+ * Simulation config file
+ * An INI file describing the cache hierarchy CacheMulti builds and the
+ * design space CacheSingle sweeps, so new hierarchies and grids need no
+ * rebuild. Every [L1], [L2], ... section is one cache level, first level
+ * first:
+ *
+ *   [L1]
+ *   size = 16K               ; bytes, with an optional K, M or G suffix
+ *   block = 64
+ *   associativity = 1
+ *   hit = 1                  ; hit and miss latency in cycles
+ *   miss = 0
+ *   write = back             ; back or through
+ *   allocate = yes           ; allocate on write misses
+ *   replacement = lru
+ *   prefetcher = stride:2    ; name[:degree], none by default
+ *   mshrs = 8                ; misses in flight in timing mode
+ *   inclusion = exclusive    ; of the level above: inclusive, exclusive
+ *                            ; or non-inclusive (default)
+ *   victim = 16              ; blocks of a victim cache, none by default
+ *
+ * CacheElf splits the first level into an instruction cache, described by
+ * an optional [L1I] section with the same keys, and the [L1] data cache;
+ * without one the instruction cache takes the geometry of [L1].
+ *
+ * The [sweep] section lists the value of each dimension, as a comma
+ * separated list or a range "first..last" stepped by "*factor" (default *2)
+ * or "+step":
+ *
+ *   [sweep]
+ *   size = 4K..1M *4
+ *   block = 32..256
+ *   associativity = 2..32
+ *   write = back, through
+ *   allocate = yes, no
+ *   replacement = lru, srrip
+ *   hit = 1
+ *   miss = 8
+ *
+ * The [timing] section sets up the event-driven timing model of CacheMulti:
+ *
+ *   [timing]
+ *   window = 32              ; demand accesses the core keeps in flight
+ *   latency = 0              ; memory cycles on top of the last level's miss
+ *   bandwidth = 16           ; memory bytes per cycle, 0 for unlimited
+ *
+ * Keys left out keep the defaults above and the sweep of the built-in grid.
+ * Lines starting with ';' or '#' are comments
+ */
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Cache.h"
+#include "Prefetcher.h"
+#include "ReplacementPolicy.h"
+#include "Timing.h"
+
+class Config {
+public:
+    // One cache level of the hierarchy
+    struct Level {
+        std::string name;             // Section name, "L1" and so on
+        CacheBase::Policy policy;
+        bool writeBack;
+        bool writeAllocate;
+        bool prefetch;                // Whether a prefetcher is attached
+        Prefetcher::Type prefetcher;
+        uint32_t prefetchDegree;      // 0 for the type's default
+        uint32_t mshrs;               // Misses in flight in timing mode
+    };
+
+    // Values of every sweep dimension, swept as their cross product
+    struct SweepSpace {
+        std::vector<uint32_t> cacheSizes;
+        std::vector<uint32_t> blockSizes;
+        std::vector<uint32_t> associativities;
+        std::vector<bool> writeBacks;
+        std::vector<bool> writeAllocates;
+        std::vector<ReplacementPolicy::Type> replacements;  // Empty if not
+                                                             // given
+        uint32_t hitLatency;
+        uint32_t missLatency;
+    };
+
+    // Most cache levels a config can describe
+    static const uint32_t MAX_LEVELS = 8;
+
+    // Starts with no levels and the built-in sweep
+    Config();
+
+    // Reads a config file, printing the first error with its line number.
+    // Returns false on any error
+    bool load(const char *path);
+
+    // Levels in order from the first; empty if the file has none
+    const std::vector<Level> &getLevels() const;
+
+    // First level instruction cache, nullptr if the file has no [L1I]
+    const Level *getInstructionLevel() const;
+
+    const SweepSpace &getSweep() const;
+
+    // Core and memory parameters of the timing model
+    const TimingBase::Params &getTiming() const;
+
+    // Level with the given name and the defaults above
+    static Level makeLevel(const std::string &name);
+
+private:
+    std::vector<Level> levels;
+    Level instructionLevel;
+    bool hasInstructionLevel;
+    SweepSpace sweep;
+    TimingBase::Params timing;
+
+    bool setLevelKey(Level &level, const std::string &key,
+                     const std::string &value);
+    bool setSweepKey(const std::string &key, const std::string &value);
+    bool setTimingKey(const std::string &key, const std::string &value);
+};
+
+#endif
@@ -0,0 +1,140 @@
+/*
+ * Implementation of the embeddable cache hierarchy
+ */
+
+#include "Hierarchy.h"
+#include "Prefetcher.h"
+
+// Reports a hierarchy error to error, or prints it without one
+static bool hierarchyError(std::string *error, const std::string &message) {
+    if (error != nullptr) {
+        *error = message;
+    } else {
+        printf("%s\n", message.c_str());
+    }
+    return false;
+}
+
+// Checks the levels of a hierarchy before any of them is built
+bool HierarchyBase::checkLevels(const std::vector<Config::Level> &levels,
+                                std::string *error) {
+    if (levels.empty()) {
+        return hierarchyError(error, "No cache levels");
+    }
+    for (const Config::Level &level : levels) {
+        std::string problem;
+        if (!CacheBase::isPolicyValid(level.policy, &problem)) {
+            return hierarchyError(error, level.name + ": " + problem);
+        }
+    }
+    if (levels[0].policy.inclusion != CacheBase::NON_INCLUSIVE) {
+        return hierarchyError(
+            error, "The first cache level has no level above to include");
+    }
+    for (size_t i = 1; i < levels.size(); ++i) {
+        const CacheBase::Policy &policy = levels[i].policy;
+        uint32_t upperBlockSize = levels[i - 1].policy.blockSize;
+        if (policy.inclusion == CacheBase::EXCLUSIVE &&
+            policy.blockSize != upperBlockSize) {
+            return hierarchyError(
+                error, "Exclusive cache level " + std::to_string(i + 1) +
+                           " needs the block size of the level above");
+        }
+        if (policy.inclusion == CacheBase::INCLUSIVE &&
+            policy.blockSize < upperBlockSize) {
+            return hierarchyError(
+                error, "Inclusive cache level " + std::to_string(i + 1) +
+                           " needs blocks at least as large as the level "
+                           "above");
+        }
+    }
+    return true;
+}
+
+template <typename Addr>
+BasicHierarchy<Addr>::BasicHierarchy() {
+    memory = nullptr;
+}
+
+template <typename Addr>
+BasicHierarchy<Addr>::~BasicHierarchy() {
+    clear();
+}
+
+// Builds the levels from the last one up, each over the one below, and
+// attaches the prefetchers, which train on each level's demand accesses
+template <typename Addr>
+bool BasicHierarchy<Addr>::build(const std::vector<Config::Level> &config,
+                                 bool timingOnly, std::string *error) {
+    if (!checkLevels(config, error)) {
+        return false;
+    }
+    clear();
+
+    memory = new BasicMemoryManager<Addr>();
+    levels.assign(config.size(), nullptr);
+    for (size_t i = config.size(); i-- > 0;) {
+        levels[i] = new BasicCache<Addr>(
+            memory, config[i].policy,
+            i + 1 < levels.size() ? levels[i + 1] : nullptr,
+            config[i].writeBack, config[i].writeAllocate, timingOnly);
+    }
+    memory->setCache(levels[0]);
+
+    for (size_t i = 0; i < levels.size(); ++i) {
+        if (config[i].prefetch) {
+            levels[i]->setPrefetcher(
+                Prefetcher::create(config[i].prefetcher,
+                                   config[i].policy.blockSize,
+                                   config[i].prefetchDegree));
+        }
+        names.push_back(config[i].name);
+    }
+    return true;
+}
+
+template <typename Addr>
+void BasicHierarchy<Addr>::clear() {
+    for (BasicCache<Addr> *cache : levels) {
+        delete cache;
+    }
+    levels.clear();
+    names.clear();
+    delete memory;
+    memory = nullptr;
+}
+
+template <typename Addr>
+void BasicHierarchy<Addr>::access(const Record *begin, const Record *end) {
+    levels[0]->access(begin, end);
+}
+
+template <typename Addr>
+void BasicHierarchy<Addr>::flush() {
+    levels[0]->flush();
+}
+
+// Writes every level like BasicCache::writeStatistics(), but under the
+// names of the config
+template <typename Addr>
+void BasicHierarchy<Addr>::writeStatistics(
+    FILE *out, CacheBase::StatisticsFormat format) {
+    flush();
+    if (format == CacheBase::CSV) {
+        CacheBase::writeStatisticsHeader(out);
+    } else if (format == CacheBase::JSON) {
+        fprintf(out, "{\n  \"levels\": [");
+    }
+    for (size_t i = 0; i < levels.size(); ++i) {
+        if (format == CacheBase::TEXT && i > 0)
+            fprintf(out, "---------- LOWER CACHE ----------\n");
+        levels[i]->writeStatisticsRecord(out, format, names[i].c_str(),
+                                         i == 0);
+    }
+    if (format == CacheBase::JSON) {
+        fprintf(out, "\n  ]\n}\n");
+    }
+}
+
+template class BasicHierarchy<uint32_t>;
+template class BasicHierarchy<uint64_t>;
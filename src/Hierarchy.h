@@ -0,0 +1,83 @@
+/*
+ * Embeddable cache hierarchy
+ * Owns a memory manager and the cache levels of a config, first level
+ * first, with their prefetchers, so a caller can build a hierarchy, feed it
+ * batches of records and read back the statistics of every level. Nothing
+ * here ends the process: an invalid hierarchy comes back as false with the
+ * reason, so one process can run many short simulations in turn
+ */
+
+#ifndef HIERARCHY_H
+#define HIERARCHY_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "Cache.h"
+#include "Config.h"
+#include "MemoryManager.h"
+
+// Checks shared by every address width
+class HierarchyBase {
+public:
+    // Checks that there is at least one level, that every policy is valid
+    // and that each level can keep its inclusion policy towards the level
+    // above: an exclusive level takes whole victim blocks from it, and an
+    // inclusive one holds every block of it. The first problem goes to
+    // error if given, otherwise it is printed
+    static bool checkLevels(const std::vector<Config::Level> &levels,
+                            std::string *error = nullptr);
+};
+
+template <typename Addr>
+class BasicHierarchy : public HierarchyBase {
+public:
+    typedef typename BasicCache<Addr>::Record Record;
+
+    BasicHierarchy();
+    ~BasicHierarchy();
+
+    BasicHierarchy(const BasicHierarchy &) = delete;
+    BasicHierarchy &operator=(const BasicHierarchy &) = delete;
+
+    // Builds the levels over a new memory manager, replacing the hierarchy
+    // built before. Returns false, with nothing built, if checkLevels()
+    // rejects them
+    bool build(const std::vector<Config::Level> &levels,
+               bool timingOnly = false, std::string *error = nullptr);
+
+    // Releases the levels and the memory manager
+    void clear();
+
+    // Runs a batch of trace records through the first level
+    void access(const Record *begin, const Record *end);
+
+    // Forwards the queued transfers of every level, so their statistics are
+    // final
+    void flush();
+
+    size_t getLevelNum() const { return levels.size(); }
+    BasicCache<Addr> *getLevel(size_t i) const { return levels[i]; }
+    const std::vector<BasicCache<Addr> *> &getLevels() const { return levels; }
+    const std::string &getName(size_t i) const { return names[i]; }
+    const CacheBase::Statistics &getStatistics(size_t i) const {
+        return levels[i]->statistics;
+    }
+    BasicMemoryManager<Addr> *getMemory() const { return memory; }
+
+    // Flushes and writes the statistics of every level under its config
+    // name, as writeStatistics() of the first level does
+    void writeStatistics(FILE *out, CacheBase::StatisticsFormat format);
+
+private:
+    BasicMemoryManager<Addr> *memory;
+    std::vector<BasicCache<Addr> *> levels;     // First level first
+    std::vector<std::string> names;
+};
+
+typedef BasicHierarchy<uint32_t> Hierarchy;
+typedef BasicHierarchy<uint64_t> Hierarchy64;
+
+#endif
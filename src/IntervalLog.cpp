@@ -0,0 +1,163 @@
+/*
+ * Implementation of the interval statistics log
+ */
+
+#include <cstring>
+
+#include "IntervalLog.h"
+
+const char IntervalLog::BINARY_MAGIC[4] = {'C', 'I', 'N', 'T'};
+
+IntervalLog::IntervalLog()
+    : file(nullptr), path(nullptr), format(CSV), unit(ACCESSES), length(0),
+      interval(0), accesses(0), snapshotAccesses(0), intervalEnd(0),
+      ok(true) {}
+
+IntervalLog::~IntervalLog() {
+    close();
+}
+
+// Adds the statistics of the next cache level
+void IntervalLog::addLevel(const char *name,
+                           const CacheBase::Statistics *stats) {
+    levels.push_back(stats);
+    names.push_back(name);
+}
+
+// Opens the log and writes its header. The counters at this point are the
+// base of the first interval
+bool IntervalLog::open(const char *path, Format format, Unit unit,
+                       uint64_t length) {
+    close();
+    file = fopen(path, format == BINARY ? "wb" : "w");
+    if (file == nullptr) {
+        printf("Unable to open file %s\n", path);
+        return false;
+    }
+    this->path = path;
+    this->format = format;
+    this->unit = unit;
+    this->length = length > 0 ? length : 1;
+    interval = 0;
+    accesses = 0;
+    snapshotAccesses = 0;
+    intervalEnd = unit == CYCLES ? getCycles() + this->length : this->length;
+    ok = true;
+
+    previous.clear();
+    for (const CacheBase::Statistics *stats : levels) {
+        previous.push_back(*stats);
+    }
+
+    std::string keys;
+    for (size_t i = 0; i < CacheBase::STATISTICS_FIELD_NUM; ++i) {
+        keys += i > 0 ? "," : "";
+        keys += CacheBase::STATISTICS_FIELDS[i].key;
+    }
+    if (format == CSV) {
+        ok = fprintf(file, "interval,accesses,cycles,cache,%s\n",
+                     keys.c_str()) > 0;
+    } else {
+        Header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, BINARY_MAGIC, sizeof(header.magic));
+        header.version = BINARY_VERSION;
+        header.levelNum = levels.size();
+        header.fieldNum = CacheBase::STATISTICS_FIELD_NUM;
+        header.unit = unit;
+        header.keysSize = keys.size();
+        header.length = this->length;
+        ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             fwrite(keys.data(), 1, keys.size(), file) == keys.size();
+    }
+    return ok;
+}
+
+// Accesses to run before the next check for an interval boundary
+uint64_t IntervalLog::getBatchSize() const {
+    if (unit == CYCLES) {
+        return CYCLE_BATCH;
+    }
+    return intervalEnd - accesses;
+}
+
+// Counts the accesses run and ends the interval once its length is reached.
+// In CYCLES mode an interval ends at the first check past its end, and the
+// next one ends at the following multiple of the length
+void IntervalLog::advance(uint64_t accesses) {
+    if (file == nullptr) {
+        return;
+    }
+    this->accesses += accesses;
+    if (unit == ACCESSES) {
+        if (this->accesses >= intervalEnd) {
+            snapshot();
+            intervalEnd = this->accesses + length;
+        }
+    } else {
+        uint64_t cycles = getCycles();
+        if (cycles >= intervalEnd) {
+            snapshot();
+            intervalEnd = (cycles / length + 1) * length;
+        }
+    }
+}
+
+// Writes the partial last interval, if it has any accesses, and closes
+bool IntervalLog::close() {
+    if (file == nullptr) {
+        return ok;
+    }
+    if (accesses > snapshotAccesses) {
+        snapshot();
+    }
+    ok = fclose(file) == 0 && ok;
+    file = nullptr;
+    if (!ok) {
+        printf("Unable to write file %s\n", path);
+    }
+    return ok;
+}
+
+// Simulated time: the total cycles of all levels
+uint64_t IntervalLog::getCycles() const {
+    uint64_t cycles = 0;
+    for (const CacheBase::Statistics *stats : levels) {
+        cycles += stats->totalCycles;
+    }
+    return cycles;
+}
+
+// Writes the difference of every level's counters to the previous snapshot
+void IntervalLog::snapshot() {
+    uint64_t cycles = getCycles();
+    if (format == BINARY) {
+        uint64_t head[2] = {accesses, cycles};
+        ok = fwrite(head, sizeof(head), 1, file) == 1 && ok;
+    }
+    for (size_t level = 0; level < levels.size(); ++level) {
+        const CacheBase::Statistics &stats = *levels[level];
+        std::vector<uint64_t> deltas(CacheBase::STATISTICS_FIELD_NUM);
+        for (size_t i = 0; i < CacheBase::STATISTICS_FIELD_NUM; ++i) {
+            uint64_t CacheBase::Statistics::*field =
+                CacheBase::STATISTICS_FIELDS[i].field;
+            deltas[i] = stats.*field - previous[level].*field;
+        }
+        previous[level] = stats;
+
+        if (format == BINARY) {
+            ok = fwrite(deltas.data(), sizeof(uint64_t), deltas.size(),
+                        file) == deltas.size() && ok;
+            continue;
+        }
+        fprintf(file, "%llu,%llu,%llu,%s", (unsigned long long)interval,
+                (unsigned long long)accesses, (unsigned long long)cycles,
+                names[level].c_str());
+        for (size_t i = 0; i < CacheBase::STATISTICS_FIELD_NUM; ++i) {
+            fprintf(file, ",%llu", (unsigned long long)deltas[i]);
+        }
+        ok = fprintf(file, "\n") > 0 && ok;
+    }
+    interval++;
+    snapshotAccesses = accesses;
+}
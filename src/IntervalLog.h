@@ -0,0 +1,102 @@
+/*
+ * Interval statistics log
+ * Streams snapshots of the statistics of every cache level, one per
+ * interval of a fixed number of trace records or simulated cycles, so
+ * phases with different miss rates show up. The counters are only read at
+ * interval boundaries and written as the difference to the previous
+ * snapshot; nothing is logged per access. The simulated time is the sum of
+ * the total cycles of all levels
+ *
+ * A CSV log has one row per level and interval. A binary log starts with a
+ * Header and the comma separated counter keys, followed per interval by the
+ * access count, the simulated time and the counter deltas of every level in
+ * the order they were added, all as uint64_t
+ */
+
+#ifndef INTERVAL_LOG_H
+#define INTERVAL_LOG_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "Cache.h"
+
+class IntervalLog {
+public:
+    // What the interval length counts
+    enum Unit {
+        ACCESSES,   // Trace records run through the first level
+        CYCLES,     // Simulated cycles, checked every CYCLE_BATCH accesses
+    };
+
+    enum Format {
+        CSV,
+        BINARY,
+    };
+
+    // Layout of the binary log header
+    struct Header {
+        char magic[4];          // BINARY_MAGIC
+        uint16_t version;       // BINARY_VERSION
+        uint16_t levelNum;      // Cache levels per interval
+        uint16_t fieldNum;      // Counters per level
+        uint16_t unit;          // Unit of the interval length
+        uint32_t keysSize;      // Bytes of counter keys after the header
+        uint64_t length;        // Interval length
+    };
+    static const char BINARY_MAGIC[4];
+    static const uint16_t BINARY_VERSION = 1;
+
+    // Accesses between checks of the simulated time in CYCLES mode
+    static const uint64_t CYCLE_BATCH = 256;
+
+    IntervalLog();
+    ~IntervalLog();
+
+    IntervalLog(const IntervalLog &) = delete;
+    IntervalLog &operator=(const IntervalLog &) = delete;
+
+    // Adds the statistics of the next cache level, named in the CSV log.
+    // Call before open()
+    void addLevel(const char *name, const CacheBase::Statistics *stats);
+
+    // Starts a log of intervals of length units at path
+    bool open(const char *path, Format format, Unit unit, uint64_t length);
+
+    // Accesses to run before the next call to advance(), so that interval
+    // boundaries fall between calls
+    uint64_t getBatchSize() const;
+
+    // Counts accesses run since the last call, writing a snapshot when an
+    // interval is complete
+    void advance(uint64_t accesses);
+
+    // Writes the last, partial interval and closes the log; false if any
+    // write failed
+    bool close();
+
+private:
+    std::vector<const CacheBase::Statistics *> levels;
+    std::vector<std::string> names;               // Name per level
+    std::vector<CacheBase::Statistics> previous;  // Last snapshot per level
+    FILE *file;
+    const char *path;
+    Format format;
+    Unit unit;
+    uint64_t length;
+    uint64_t interval;             // Index of the current interval
+    uint64_t accesses;             // Accesses so far
+    uint64_t snapshotAccesses;     // Accesses at the previous snapshot
+    uint64_t intervalEnd;          // Accesses or cycles ending the interval
+    bool ok;                       // No write has failed
+
+    // Simulated time: the total cycles of all levels
+    uint64_t getCycles() const;
+
+    // Writes the counter deltas since the previous snapshot
+    void snapshot();
+};
+
+#endif
@@ -0,0 +1,294 @@
+/*
+ * Simulator throughput benchmark and regression check
+ * Runs a single cache and the L1/L2/L3 hierarchy over the bundled traces
+ * and over synthetic sequential, strided, random and zipfian streams, and
+ * reports the accesses per second, nanoseconds per access and peak RSS of
+ * each workload. The configurations of the checked-in test.trace.csv are
+ * replayed first, through both the byte API and the batch path, and any
+ * drift from its miss rates and cycle counts fails the run
+ */
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "Cache.h"
+#include "MemoryManager.h"
+#include "Prefetcher.h"
+#include "Trace.h"
+
+typedef Trace::Record Record;
+
+// One row of the reference CSV
+struct Reference {
+    CacheBase::Policy policy;
+    bool writeBack;
+    bool writeAllocate;
+    std::string missRate;          // As printed with %g
+    uint64_t totalCycles;
+};
+
+// Latencies of the reference sweep, which the CSV does not list
+const uint32_t REFERENCE_HIT_LATENCY = 1;
+const uint32_t REFERENCE_MISS_LATENCY = 8;
+
+// Records of each synthetic stream, unless given with -n
+uint64_t syntheticRecords = 4 * 1000 * 1000;
+
+bool loadReferences(const std::string &path, std::vector<Reference> &refs);
+bool checkReferences(const Trace &trace, const std::vector<Reference> &refs);
+void runSingle(const char *name, const Record *begin, const Record *end);
+void runHierarchy(const char *name, const Record *begin, const Record *end);
+void makeStream(const char *kind, std::vector<Record> &records);
+void report(const char *name, uint64_t accesses, double seconds);
+void printUsage();
+
+int main(int argc, char **argv) {
+    std::string dir = "test_trace";
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            syntheticRecords = strtoull(argv[++i], nullptr, 10);
+        } else if (argv[i][0] != '-') {
+            dir = argv[i];
+        } else {
+            printUsage();
+            return -1;
+        }
+    }
+    if (syntheticRecords == 0) {
+        printUsage();
+        return -1;
+    }
+
+    Trace test, prefetch;
+    std::vector<Reference> refs;
+    if (!test.load((dir + "/test.trace").c_str()) ||
+        !prefetch.load((dir + "/test_prefetch.trace").c_str()) ||
+        !loadReferences(dir + "/test.trace.csv", refs)) {
+        return -1;
+    }
+
+    printf("%-24s %12s %10s %14s %10s %11s\n", "workload", "accesses",
+           "seconds", "accesses/s", "ns/access", "peak RSS");
+    bool ok = checkReferences(test, refs);
+    runSingle("single test.trace", test.begin(), test.end());
+    runHierarchy("hierarchy test.trace", test.begin(), test.end());
+    runHierarchy("hierarchy test_prefetch", prefetch.begin(), prefetch.end());
+
+    const char *const streams[] = {"sequential", "strided", "random",
+                                   "zipfian"};
+    for (const char *kind : streams) {
+        std::vector<Record> records;
+        makeStream(kind, records);
+        std::string name = std::string("hierarchy ") + kind;
+        runHierarchy(name.c_str(), records.data(),
+                     records.data() + records.size());
+    }
+
+    if (!ok) {
+        printf("Simulation results drifted from %s/test.trace.csv\n",
+               dir.c_str());
+        return 1;
+    }
+    printf("Results match %s/test.trace.csv\n", dir.c_str());
+    return 0;
+}
+
+// Reads the rows of the reference CSV, skipping its header
+bool loadReferences(const std::string &path, std::vector<Reference> &refs) {
+    std::ifstream file(path);
+    if (!file) {
+        printf("Unable to open file %s\n", path.c_str());
+        return false;
+    }
+    std::string line;
+    std::getline(file, line);
+    while (std::getline(file, line)) {
+        if (line.empty() || line == "\r")
+            continue;
+        Reference ref = Reference();
+        unsigned size, block, ways, writeBack, writeAllocate;
+        char missRate[32];
+        unsigned long long cycles;
+        if (sscanf(line.c_str(), "%u,%u,%u,%u,%u,%31[^,],%llu", &size,
+                   &block, &ways, &writeBack, &writeAllocate, missRate,
+                   &cycles) != 7 ||
+            block == 0) {
+            printf("Malformed reference line in %s: %s\n", path.c_str(),
+                   line.c_str());
+            return false;
+        }
+        ref.policy = {size, block, size / block, ways, REFERENCE_HIT_LATENCY,
+                      REFERENCE_MISS_LATENCY};
+        ref.writeBack = writeBack != 0;
+        ref.writeAllocate = writeAllocate != 0;
+        ref.missRate = missRate;
+        ref.totalCycles = cycles;
+        refs.push_back(ref);
+    }
+    return true;
+}
+
+// Whether a cache's results match a reference row. The miss rate is
+// compared as the sweep prints it, a float with six significant digits
+static bool matches(const Cache &cache, const Reference &ref) {
+    const CacheBase::Statistics &stats = cache.statistics;
+    char missRate[32];
+    snprintf(missRate, sizeof(missRate), "%g",
+             (float)stats.numMiss / (stats.numHit + stats.numMiss));
+    return stats.totalCycles == ref.totalCycles && ref.missRate == missRate;
+}
+
+// Replays every reference configuration through the byte API and through
+// batches of records, timing each path over all configurations
+bool checkReferences(const Trace &trace, const std::vector<Reference> &refs) {
+    bool ok = true;
+    for (int batch = 0; batch < 2; ++batch) {
+        std::chrono::duration<double> elapsed(0);
+        for (const Reference &ref : refs) {
+            MemoryManager *memory = new MemoryManager();
+            Cache *cache = new Cache(memory, ref.policy, nullptr,
+                                     ref.writeBack, ref.writeAllocate);
+            memory->setCache(cache);
+            auto start = std::chrono::steady_clock::now();
+            if (batch) {
+                cache->access(trace.begin(), trace.end());
+            } else {
+                for (const Record *r = trace.begin(); r != trace.end(); ++r) {
+                    if (r->isWrite()) {
+                        cache->setByte(r->addr, 0);
+                    } else {
+                        cache->getByte(r->addr);
+                    }
+                }
+            }
+            elapsed += std::chrono::steady_clock::now() - start;
+            if (!matches(*cache, ref)) {
+                const CacheBase::Statistics &s = cache->statistics;
+                printf("DRIFT (%s) %u,%u,%u,%d,%d: %llu misses, %llu cycles, "
+                       "expected miss rate %s, %llu cycles\n",
+                       batch ? "batch" : "byte API", ref.policy.cacheSize,
+                       ref.policy.blockSize, ref.policy.associativity,
+                       ref.writeBack, ref.writeAllocate,
+                       (unsigned long long)s.numMiss,
+                       (unsigned long long)s.totalCycles, ref.missRate.c_str(),
+                       (unsigned long long)ref.totalCycles);
+                ok = false;
+            }
+            delete cache;
+            delete memory;
+        }
+        report(batch ? "reference batch" : "reference byte API",
+               uint64_t(trace.size()) * refs.size(), elapsed.count());
+    }
+    return ok;
+}
+
+// A 32K 8-way cache with 64 byte blocks on its own
+void runSingle(const char *name, const Record *begin, const Record *end) {
+    MemoryManager *memory = new MemoryManager();
+    Cache::Policy policy = {32 * 1024, 64, (32 * 1024) / 64, 8, 1, 8};
+    Cache *cache = new Cache(memory, policy);
+    memory->setCache(cache);
+    auto start = std::chrono::steady_clock::now();
+    cache->access(begin, end);
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    report(name, end - begin, elapsed.count());
+    delete cache;
+    delete memory;
+}
+
+// The built-in CacheMulti hierarchy: 16K L1 with a stride prefetcher,
+// 128K L2 and 2M L3
+void runHierarchy(const char *name, const Record *begin, const Record *end) {
+    MemoryManager *memory = new MemoryManager();
+    Cache::Policy p3 = {2 * 1024 * 1024, 64, (2 * 1024 * 1024) / 64, 16, 20,
+                        100};
+    Cache::Policy p2 = {128 * 1024, 64, (128 * 1024) / 64, 8, 8, 0};
+    Cache::Policy p1 = {16 * 1024, 64, (16 * 1024) / 64, 1, 1, 0};
+    Cache *l3 = new Cache(memory, p3, nullptr);
+    Cache *l2 = new Cache(memory, p2, l3);
+    Cache *l1 = new Cache(memory, p1, l2);
+    l1->setPrefetcher(Prefetcher::create(Prefetcher::STRIDE, 64));
+    memory->setCache(l1);
+    auto start = std::chrono::steady_clock::now();
+    l1->access(begin, end);
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    report(name, end - begin, elapsed.count());
+    delete l1;
+    delete l2;
+    delete l3;
+    delete memory;
+}
+
+// Fills records with a synthetic stream over a 64M footprint, a quarter of
+// the accesses writes. Streams are deterministic, so runs compare
+void makeStream(const char *kind, std::vector<Record> &records) {
+    const uint32_t footprint = 64 * 1024 * 1024;
+    uint64_t state = 0x9e3779b97f4a7c15ull;
+    auto next = [&state]() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    };
+
+    // Zipfian ranks by inverting the CDF of 1/rank over the 64 byte
+    // blocks, with the alpha = 1 approximation of the harmonic numbers
+    const uint32_t blocks = footprint / 64;
+    const double harmonic = std::log(double(blocks)) + 0.5772156649;
+
+    records.resize(syntheticRecords);
+    uint32_t addr = 0;
+    for (uint64_t i = 0; i < syntheticRecords; ++i) {
+        uint64_t r = next();
+        if (strcmp(kind, "sequential") == 0) {
+            addr = (addr + 4) % footprint;
+        } else if (strcmp(kind, "strided") == 0) {
+            addr = (addr + 4096 + 64) % footprint;
+        } else if (strcmp(kind, "random") == 0) {
+            addr = uint32_t(r >> 16) % footprint;
+        } else {
+            double u = double(r >> 11) / double(1ull << 53);
+            uint32_t rank = uint32_t(std::exp(u * harmonic));
+            if (rank >= blocks)
+                rank = blocks - 1;
+            // Scatter the ranks so hot blocks do not share a set
+            addr = uint32_t((rank * 2654435761u) % blocks) * 64 +
+                   uint32_t(r & 60);
+        }
+        records[i].addr = addr;
+        records[i].flags = (r >> 62) == 0 ? TraceBase::WRITE : 0;
+    }
+}
+
+// Prints a result row with the peak resident set size so far
+void report(const char *name, uint64_t accesses, double seconds) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double rate = seconds > 0 ? accesses / seconds : 0;
+    printf("%-24s %12llu %10.3f %14.0f %10.2f %8ld MB\n", name,
+           (unsigned long long)accesses, seconds, rate,
+           accesses > 0 ? seconds * 1e9 / accesses : 0.0,
+           usage.ru_maxrss / 1024);
+    fflush(stdout);
+}
+
+// Displays usage instructions for the program
+void printUsage() {
+    printf("Usage: CacheBench [trace-directory] [-n records]\n");
+    printf("Parameters: trace-directory holds test.trace, "
+           "test_prefetch.trace and the test.trace.csv reference "
+           "(default: test_trace), -n records of each synthetic stream "
+           "(default: 4000000)\n");
+}
@@ -0,0 +1,334 @@
+/*
+ * Entry point of the split instruction/data cache simulator
+ * Loads an ELF executable into memory and runs an address stream of it
+ * through an L1 instruction cache and an L1 data cache over shared lower
+ * levels. The stream is a text or binary trace whose FETCH records are
+ * instruction fetches; given as "-" it is read live from standard input,
+ * so an instrumentation tool can pipe it in without an intermediate file
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "Cache.h"
+#include "Config.h"
+#include "Hierarchy.h"
+#include "MemoryManager.h"
+#include "Prefetcher.h"
+#include "Trace.h"
+#include "TraceReader.h"
+
+// Function to parse command-line parameters
+bool parseParameters(int argc, char **argv);
+const char *getOptionValue(int argc, char **argv, int &i);
+bool parseFormat(const char *name);
+bool getLevels(std::vector<Config::Level> &levels,
+               Config::Level &instruction);
+uint16_t getElfAddrBits(const char *path);
+
+// Function to display usage instructions
+void printUsage();
+
+// Function to run the stream through the split hierarchy with Addr-wide
+// addresses
+template <typename Addr>
+int simulate();
+
+// Global variables for the input paths and simulation mode
+const char *elfFilePath = nullptr;
+const char *traceFilePath = nullptr;
+const char *configFilePath = nullptr;
+bool timingOnly = false;
+CacheBase::StatisticsFormat statisticsFormat = CacheBase::TEXT;
+
+int main(int argc, char **argv) {
+    // Parse input parameters
+    if (!parseParameters(argc, argv)) {
+        printUsage();
+        return -1;
+    }
+
+    // The class of the executable decides the address width, as a stream
+    // from a pipe cannot be scanned ahead
+    uint16_t addrBits = getElfAddrBits(elfFilePath);
+    if (addrBits == 0) {
+        exit(-1);
+    }
+    return addrBits == 64 ? simulate<uint64_t>() : simulate<uint32_t>();
+}
+
+// Simulates an L1I and an L1D over the shared levels of the hierarchy
+template <typename Addr>
+int simulate() {
+    typedef typename BasicCache<Addr>::Record Record;
+
+    // Cache policies of the split first level and every level below
+    std::vector<Config::Level> config;
+    Config::Level instruction;
+    if (!getLevels(config, instruction)) {
+        exit(-1);
+    }
+
+    // Load the executable before any cache is attached, so the image goes
+    // straight to memory
+    BasicMemoryManager<Addr> *memory = new BasicMemoryManager<Addr>();
+    Addr entry;
+    if (!memory->loadElf(elfFilePath, entry)) {
+        exit(-1);
+    }
+
+    // Build the shared levels from the last one up, then both first level
+    // caches over them. The data cache goes last so that it is the level
+    // above L2 and memory writes go through it
+    std::vector<BasicCache<Addr> *> levels(config.size());
+    for (size_t i = config.size(); i-- > 1;) {
+        levels[i] = new BasicCache<Addr>(
+            memory, config[i].policy,
+            i + 1 < levels.size() ? levels[i + 1] : nullptr,
+            config[i].writeBack, config[i].writeAllocate, timingOnly);
+    }
+    BasicCache<Addr> *lower = levels.size() > 1 ? levels[1] : nullptr;
+    BasicCache<Addr> *l1icache = new BasicCache<Addr>(
+        memory, instruction.policy, lower, instruction.writeBack,
+        instruction.writeAllocate, timingOnly);
+    levels[0] = new BasicCache<Addr>(memory, config[0].policy, lower,
+                                     config[0].writeBack,
+                                     config[0].writeAllocate, timingOnly);
+    BasicCache<Addr> *l1dcache = levels[0];
+    memory->setCache(l1dcache);
+
+    // Attach the prefetchers, which train on each level's demand accesses
+    if (instruction.prefetch) {
+        l1icache->setPrefetcher(Prefetcher::create(
+            instruction.prefetcher, instruction.policy.blockSize,
+            instruction.prefetchDegree));
+    }
+    for (size_t i = 0; i < levels.size(); ++i) {
+        if (config[i].prefetch) {
+            levels[i]->setPrefetcher(
+                Prefetcher::create(config[i].prefetcher,
+                                   config[i].policy.blockSize,
+                                   config[i].prefetchDegree));
+        }
+    }
+
+    // Stream the trace; decoding runs ahead in the background
+    BasicTraceReader<Addr> trace;
+    if (!trace.open(traceFilePath)) {
+        exit(-1);
+    }
+    if (statisticsFormat == CacheBase::TEXT) {
+        printf("Loaded %s, entry point 0x%llx\n", elfFilePath,
+               (unsigned long long)entry);
+    }
+
+    // Each run of fetches goes to the instruction cache as one batch, each
+    // run of data accesses to the data cache
+    uint64_t fetchNum = 0;
+    uint64_t dataNum = 0;
+    const Record *chunkBegin, *chunkEnd;
+    while (trace.next(chunkBegin, chunkEnd)) {
+        while (chunkBegin != chunkEnd) {
+            bool fetch = chunkBegin->isFetch();
+            const Record *run = chunkBegin + 1;
+            while (run != chunkEnd && run->isFetch() == fetch)
+                ++run;
+            if (fetch) {
+                l1icache->access(chunkBegin, run);
+                fetchNum += run - chunkBegin;
+            } else {
+                l1dcache->access(chunkBegin, run);
+                dataNum += run - chunkBegin;
+            }
+            chunkBegin = run;
+        }
+    }
+    if (trace.failed()) {
+        exit(-1);
+    }
+
+    // Display the statistics of both first level caches and every level
+    // below
+    l1icache->flush();
+    l1dcache->flush();
+    std::vector<BasicCache<Addr> *> caches(1, l1icache);
+    caches.insert(caches.end(), levels.begin(), levels.end());
+    std::vector<std::string> names(1, instruction.name);
+    for (const Config::Level &level : config) {
+        names.push_back(level.name);
+    }
+    if (statisticsFormat == CacheBase::TEXT) {
+        printf("Instruction Fetches: %llu\n", (unsigned long long)fetchNum);
+        printf("Data Accesses: %llu\n", (unsigned long long)dataNum);
+    } else if (statisticsFormat == CacheBase::CSV) {
+        CacheBase::writeStatisticsHeader(stdout);
+    } else {
+        printf("{\n  \"numFetch\": %llu,\n  \"numData\": %llu,\n"
+               "  \"levels\": [",
+               (unsigned long long)fetchNum, (unsigned long long)dataNum);
+    }
+    for (size_t i = 0; i < caches.size(); ++i) {
+        if (statisticsFormat == CacheBase::TEXT) {
+            printf("%s Cache:\n", names[i].c_str());
+        }
+        caches[i]->writeStatisticsRecord(stdout, statisticsFormat,
+                                         names[i].c_str(), i == 0);
+    }
+    if (statisticsFormat == CacheBase::JSON) {
+        printf("\n  ]\n}\n");
+    }
+
+    // Clean up allocated memory
+    delete l1icache;
+    for (BasicCache<Addr> *cache : levels) {
+        delete cache;
+    }
+    delete memory;
+
+    return 0;
+}
+
+// Parses command-line arguments to retrieve the input paths and options
+bool parseParameters(int argc, char **argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            switch (argv[i][1]) {
+                case 't':
+                    timingOnly = true;
+                    break;
+                case 'o': {
+                    const char *value = getOptionValue(argc, argv, i);
+                    if (value == nullptr || !parseFormat(value))
+                        return false;
+                    break;
+                }
+                case 'f':
+                    configFilePath = getOptionValue(argc, argv, i);
+                    if (configFilePath == nullptr)
+                        return false;
+                    break;
+                default:
+                    return false;
+            }
+        } else if (elfFilePath == nullptr) {
+            elfFilePath = argv[i];
+        } else if (traceFilePath == nullptr) {
+            traceFilePath = argv[i];
+        } else {
+            return false;
+        }
+    }
+    return traceFilePath != nullptr;
+}
+
+// Returns the value of the option at argv[i], accepting both "-ojson"
+// and "-o json"
+const char *getOptionValue(int argc, char **argv, int &i) {
+    if (argv[i][2] != '\0')
+        return &argv[i][2];
+    if (i + 1 < argc)
+        return argv[++i];
+    return nullptr;
+}
+
+// Parses the statistics output format
+bool parseFormat(const char *name) {
+    if (strcmp(name, "text") == 0) {
+        statisticsFormat = CacheBase::TEXT;
+    } else if (strcmp(name, "json") == 0) {
+        statisticsFormat = CacheBase::JSON;
+    } else if (strcmp(name, "csv") == 0) {
+        statisticsFormat = CacheBase::CSV;
+    } else {
+        fprintf(stderr, "Unknown output format %s\n", name);
+        return false;
+    }
+    return true;
+}
+
+// Reads the levels of the config file, or sets up the built-in hierarchy:
+// a 16K L1I and L1D over a 128K L2 and a 2M L3. Without an [L1I] section
+// the instruction cache copies [L1]
+bool getLevels(std::vector<Config::Level> &levels,
+               Config::Level &instruction) {
+    Config config;
+    if (configFilePath != nullptr) {
+        if (!config.load(configFilePath)) {
+            return false;
+        }
+        levels = config.getLevels();
+        if (levels.empty()) {
+            printf("No cache levels in %s\n", configFilePath);
+            return false;
+        }
+    } else {
+        levels.clear();
+        levels.push_back(Config::makeLevel("L1"));
+        levels.push_back(Config::makeLevel("L2"));
+        levels.push_back(Config::makeLevel("L3"));
+        levels[0].policy = {16 * 1024, 64, (16 * 1024) / 64, 1, 1, 0};
+        levels[1].policy = {128 * 1024, 64, (128 * 1024) / 64, 8, 8, 0};
+        levels[2].policy = {2 * 1024 * 1024, 64, (2 * 1024 * 1024) / 64,
+                            16, 20, 100};
+    }
+    const Config::Level *level = config.getInstructionLevel();
+    instruction = level != nullptr ? *level : levels[0];
+    instruction.name = "L1I";
+    levels[0].name = "L1D";
+    std::string error;
+    if (!CacheBase::isPolicyValid(instruction.policy, &error)) {
+        printf("%s: %s\n", instruction.name.c_str(), error.c_str());
+        return false;
+    }
+
+    // Inclusion policies keep track of a single level above, and L2 has
+    // two here
+    if (instruction.policy.inclusion != CacheBase::NON_INCLUSIVE ||
+        levels[0].policy.inclusion != CacheBase::NON_INCLUSIVE) {
+        printf("The first cache level has no level above to include\n");
+        return false;
+    }
+    if (levels.size() > 1 &&
+        levels[1].policy.inclusion != CacheBase::NON_INCLUSIVE) {
+        printf("L2 cannot be inclusive or exclusive of split L1 caches\n");
+        return false;
+    }
+    return HierarchyBase::checkLevels(levels);
+}
+
+// Address width of an ELF file from its class, 0 if it is no ELF file
+uint16_t getElfAddrBits(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr) {
+        printf("Unable to open file %s\n", path);
+        return 0;
+    }
+    unsigned char ident[EI_NIDENT];
+    bool ok = fread(ident, 1, sizeof(ident), file) == sizeof(ident) &&
+              ident[EI_MAG0] == ELFMAG0 && ident[EI_MAG1] == ELFMAG1 &&
+              ident[EI_MAG2] == ELFMAG2 && ident[EI_MAG3] == ELFMAG3;
+    fclose(file);
+    if (!ok || (ident[EI_CLASS] != ELFCLASS32 &&
+                ident[EI_CLASS] != ELFCLASS64)) {
+        printf("Not an ELF file %s\n", path);
+        return 0;
+    }
+    return ident[EI_CLASS] == ELFCLASS64 ? 64 : 32;
+}
+
+// Displays usage instructions for the program
+void printUsage() {
+    printf("Usage: CacheElf elf-file trace-file|- [-t] [-o format] "
+           "[-f config-file]\n");
+    printf("Parameters: the trace holds the fetches (\"i 0xADDR\" lines or "
+           "FETCH records) and data accesses of the executable, read from "
+           "standard input if -, "
+           "-t timing-only simulation without data, "
+           "-o statistics format: text, json or csv (default: text), "
+           "-f build the hierarchy from the [L1I], [L1], [L2], ... sections "
+           "of an INI config file (default: 16K L1I and L1D, 128K L2, "
+           "2M L3)\n");
+}
@@ -4,160 +4,815 @@
  * Created by He, Hao at 2019/04/30
  */
 
+#include <algorithm>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <string>
 #include <vector>
 #include "Cache.h"
+#include "Checkpoint.h"
+#include "Coherence.h"
+#include "Config.h"
 #include "Debug.h"
+#include "Hierarchy.h"
+#include "IntervalLog.h"
 #include "MemoryManager.h"
+#include "Prefetcher.h"
+#include "Timing.h"
+#include "Trace.h"
+#include "TraceReader.h"
 
 // Function to parse command-line parameters
 bool parseParameters(int argc, char **argv);
+const char *getOptionValue(int argc, char **argv, int &i);
+bool parsePrefetcher(const char *spec);
+bool parseFormat(const char *name);
+bool parseInterval(const char *spec);
+bool parseCores(const char *spec);
+bool parseCheckpoint(const char *spec);
+bool parseVictim(const char *spec);
+bool getLevels(std::vector<Config::Level> &levels);
+template <typename Addr>
+bool writeProfile(const std::vector<BasicCache<Addr> *> &levels,
+                  const std::vector<Config::Level> &config,
+                  BasicMemoryManager<Addr> *memory);
 
 // Function to display usage instructions
 void printUsage();
 
-// Global variable for trace file path
+// Function to run the trace through the hierarchy with Addr-wide addresses
+template <typename Addr>
+int simulate();
+
+// Function to run the trace through private stacks per core over a shared L3
+template <typename Addr>
+int simulateCores();
+
+// Global variables for trace file path and simulation mode
 const char *traceFilePath;
+const char *configFilePath = nullptr;
+bool timingOnly = false;
+bool wideAddresses = false;        // Text trace addresses are 64-bit
+CacheBase::StatisticsFormat statisticsFormat = CacheBase::TEXT;
+
+// Interval statistics, logged when an interval length is given with -i
+uint64_t intervalLength = 0;
+IntervalLog::Unit intervalUnit = IntervalLog::ACCESSES;
+const char *intervalLogPath = nullptr;
+
+// Checkpoints of the warmed hierarchy. With -W the run stops after
+// checkpointRecords trace records and saves its state; with -R it starts
+// from a saved state and skips the records the checkpoint covers
+uint64_t checkpointRecords = 0;
+const char *checkpointSavePath = nullptr;
+const char *checkpointLoadPath = nullptr;
+
+// Event-driven timing with MSHRs and a memory channel, enabled with -T;
+// the parameters come from the config file
+bool eventTiming = false;
+TimingBase::Params timingParams;
+
+// Blocks of a victim cache attached to L1 with -V, none if 0
+uint32_t victimBlocks = 0;
+
+// Per-set and per-page miss profiles, written to profilePrefix.sets.csv
+// and profilePrefix.pages.csv with -P in builds with CACHESIM_PROFILE
+const char *profilePrefix = nullptr;
+
+// Multi-core mode with coherent private L1/L2 stacks, enabled with -c
+uint32_t coreNum = 1;
+CoherenceBase::Protocol coherenceProtocol = CoherenceBase::MESI;
+bool inclusiveL3 = false;
+const char *hotLinePath = nullptr;
+
+// Hot lines listed with the coherence statistics
+const uint32_t HOT_LINES = 10;
+
+// Prefetcher of each cache level. A stride prefetcher at L1 unless
+// prefetchers are given with -p or by the config file
+struct PrefetchOption {
+    bool enabled;
+    Prefetcher::Type type;
+    uint32_t degree;               // 0 for the type's default
+};
+PrefetchOption prefetchOptions[Config::MAX_LEVELS] = {
+    {true, Prefetcher::STRIDE, 0},
+};
+bool prefetchDefault = true;
 
 int main(int argc, char **argv) {
     // Parse input parameters
     if (!parseParameters(argc, argv)) {
+        printUsage();
+        return -1;
+    }
+
+    // Traces with addresses beyond 32 bits need the 64-bit hierarchy
+    uint16_t addrBits = TraceBase::getAddrBits(traceFilePath, wideAddresses);
+    if (addrBits == 0) {
+        printf("Unable to open file %s\n", traceFilePath);
         return -1;
     }
+    if (coreNum > 1) {
+        if (checkpointSavePath != nullptr || checkpointLoadPath != nullptr) {
+            printf("Checkpoints are not supported in multi-core mode\n");
+            return -1;
+        }
+        if (eventTiming) {
+            printf("Timing mode is not supported in multi-core mode\n");
+            return -1;
+        }
+        if (profilePrefix != nullptr) {
+            printf("Miss profiles are not supported in multi-core mode\n");
+            return -1;
+        }
+        return addrBits == 64 ? simulateCores<uint64_t>()
+                              : simulateCores<uint32_t>();
+    }
+    return addrBits == 64 ? simulate<uint64_t>() : simulate<uint32_t>();
+}
 
-    // Define cache policies for L1, L2, and L3 caches
-    Cache::Policy l1policy = {16 * 1024, 64, (16 * 1024) / 64, 1, 1, 0};
-    Cache::Policy l2policy = {128 * 1024, 64, (128 * 1024) / 64, 8, 8, 0};
-    Cache::Policy l3policy = {2 * 1024 * 1024, 64, (2 * 1024 * 1024) / 64, 16, 20, 100};
+// Simulates the L1/L2/L3 hierarchy over the trace
+template <typename Addr>
+int simulate() {
+    typedef typename BasicCache<Addr>::Record Record;
 
-    // Initialize memory manager and cache hierarchy
-    MemoryManager *memory = new MemoryManager();
-    Cache *l3cache = new Cache(memory, l3policy, nullptr, true, true);
-    Cache *l2cache = new Cache(memory, l2policy, l3cache, true, true);
-    Cache *l1cache = new Cache(memory, l1policy, l2cache, true, true);
-    memory->setCache(l1cache);
+    // Cache policies of every level, L1 first
+    std::vector<Config::Level> config;
+    if (!getLevels(config)) {
+        exit(-1);
+    }
 
-    // Open the trace file for reading
-    std::ifstream trace(traceFilePath);
-    if (!trace.is_open()) {
-        printf("Unable to open file %s\n", traceFilePath);
+    // Initialize memory manager and cache hierarchy with its prefetchers
+    BasicHierarchy<Addr> hierarchy;
+    if (!hierarchy.build(config, timingOnly)) {
         exit(-1);
     }
+    BasicMemoryManager<Addr> *memory = hierarchy.getMemory();
+    const std::vector<BasicCache<Addr> *> &levels = hierarchy.getLevels();
+    BasicCache<Addr> *l1cache = levels[0];
 
-    char type;            // Operation type: 'r' for read, 'w' for write
-    uint32_t addr;        // Address for the operation
-    uint32_t last_addr = 0;    // Previous address for stride calculation
-    int64_t stride = 0;         // Current stride value
-    bool is_prefetch = false;   // Prefetching flag
-    int same_stride_count = 0;  // Count of consistent strides
-    int diff_stride_count = 0;  // Count of inconsistent strides during prefetch
-
-    // Process each operation in the trace file
-    while (trace >> type >> std::hex >> addr) {
-        // Ensure the memory page exists
-        if (!memory->isPageExist(addr)) {
-            memory->addPage(addr);
-        }
-
-        // Perform the read or write operation
-        switch (type) {
-            case 'r':
-                memory->getByte(addr);
-                break;
-            case 'w':
-                memory->setByte(addr, 0);
-                break;
-            default:
-                dbgprintf("Illegal type %c\n", type);
-                exit(-1);
-        }
-
-        // Calculate the stride between current and last address
-        int64_t new_stride = static_cast<int64_t>(addr) - static_cast<int64_t>(last_addr);
-        last_addr = addr;
-
-        if (!is_prefetch) {
-            // Check for consistent stride
-            if (new_stride == stride) {
-                same_stride_count++;
+    // Stream the trace file; decoding runs ahead in the background
+    BasicTraceReader<Addr> trace;
+    if (!trace.open(traceFilePath)) {
+        exit(-1);
+    }
+
+    // Time the accesses against MSHRs and the memory channel with -T
+    BasicTimingModel<Addr> *timing = nullptr;
+    if (eventTiming) {
+        std::vector<uint32_t> mshrs;
+        for (const Config::Level &level : config) {
+            mshrs.push_back(level.mshrs);
+        }
+        timing = new BasicTimingModel<Addr>(levels, mshrs, timingParams);
+    }
+
+    // Start from a warmed state; the statistics still count from zero
+    uint64_t skipRecords = 0;
+    if (checkpointLoadPath != nullptr) {
+        if (!BasicCheckpoint<Addr>::load(checkpointLoadPath, levels, memory,
+                                         skipRecords)) {
+            exit(-1);
+        }
+        if (statisticsFormat == CacheBase::TEXT) {
+            printf("Restored %s, skipping %llu trace records\n",
+                   checkpointLoadPath, (unsigned long long)skipRecords);
+        }
+    }
+    if (checkpointSavePath != nullptr && checkpointRecords <= skipRecords) {
+        printf("Checkpoint at record %llu is not after the restored one\n",
+               (unsigned long long)checkpointRecords);
+        exit(-1);
+    }
+
+    // Log every level's statistics per interval; chunks are cut at the
+    // interval boundaries
+    IntervalLog intervals;
+    std::string logPath;
+    if (intervalLength > 0) {
+        logPath = intervalLogPath != nullptr
+                      ? intervalLogPath
+                      : std::string(traceFilePath) + ".intervals.csv";
+        bool binary = logPath.size() >= 4 &&
+                      logPath.compare(logPath.size() - 4, 4, ".bin") == 0;
+        for (size_t i = 0; i < levels.size(); ++i) {
+            intervals.addLevel(config[i].name.c_str(), &levels[i]->statistics);
+        }
+        if (!intervals.open(logPath.c_str(),
+                            binary ? IntervalLog::BINARY : IntervalLog::CSV,
+                            intervalUnit, intervalLength)) {
+            exit(-1);
+        }
+    }
+
+    // Process each operation in the trace, one chunk at a time, from the
+    // restored offset up to the checkpoint to save
+    uint64_t position = 0;         // Trace records read so far
+    const Record *chunkBegin, *chunkEnd;
+    while (trace.next(chunkBegin, chunkEnd)) {
+        uint64_t begin = position;
+        position += chunkEnd - chunkBegin;
+        if (position <= skipRecords)
+            continue;
+        if (begin < skipRecords)
+            chunkBegin += skipRecords - begin;
+        if (checkpointSavePath != nullptr && position >= checkpointRecords) {
+            chunkEnd -= position - checkpointRecords;
+            position = checkpointRecords;
+        }
+
+        while (chunkBegin != chunkEnd) {
+            uint64_t n = uint64_t(chunkEnd - chunkBegin);
+            if (intervalLength > 0 && n > intervals.getBatchSize())
+                n = intervals.getBatchSize();
+            if (timing != nullptr) {
+                timing->access(chunkBegin, chunkBegin + n);
             } else {
-                stride = new_stride;
-                same_stride_count = 1;
+                l1cache->access(chunkBegin, chunkBegin + n);
             }
+            if (intervalLength > 0)
+                intervals.advance(n);
+            chunkBegin += n;
+        }
+        if (checkpointSavePath != nullptr && position == checkpointRecords)
+            break;
+    }
+
+    if (trace.failed() || !intervals.close()) {
+        exit(-1);
+    }
 
-            // Enable prefetching after consistent strides
-            if (same_stride_count >= 3) {
-                is_prefetch = true;
-                diff_stride_count = 0;
+    // Save the warmed state for later runs
+    if (checkpointSavePath != nullptr) {
+        if (position < checkpointRecords) {
+            printf("Trace has only %llu records\n",
+                   (unsigned long long)position);
+            exit(-1);
+        }
+        if (!BasicCheckpoint<Addr>::save(checkpointSavePath, levels, memory,
+                                         position)) {
+            exit(-1);
+        }
+        if (statisticsFormat == CacheBase::TEXT) {
+            printf("Checkpoint after %llu trace records written to %s\n",
+                   (unsigned long long)position, checkpointSavePath);
+        }
+    }
 
-                // Prefetch the next 3 blocks
-                for (int i = 1; i <= 3; ++i) {
-                    uint32_t prefetch_addr = addr + i * stride;
+    // Display the statistics of all levels, starting at L1
+    if (statisticsFormat == CacheBase::TEXT) {
+        printf("L1 Cache:\n");
+    }
+    if (timing == nullptr || statisticsFormat != CacheBase::JSON) {
+        l1cache->writeStatistics(stdout, statisticsFormat);
+    } else {
+        l1cache->flush();
+        printf("{\n  \"levels\": [");
+        for (size_t i = 0; i < levels.size(); ++i) {
+            levels[i]->writeStatisticsRecord(stdout, statisticsFormat,
+                                             config[i].name.c_str(), i == 0);
+        }
+        printf("\n  ],\n");
+    }
+    if (timing != nullptr) {
+        std::vector<std::string> names;
+        for (const Config::Level &level : config) {
+            names.push_back(level.name);
+        }
+        timing->writeStatistics(stdout, statisticsFormat, names);
+        if (statisticsFormat == CacheBase::JSON) {
+            printf("\n}\n");
+        }
+    }
+    if (profilePrefix != nullptr && !writeProfile(levels, config, memory)) {
+        exit(-1);
+    }
 
-                    if (!l1cache->inCache(prefetch_addr)) {
-                        if (!memory->isPageExist(prefetch_addr)) {
-                            memory->addPage(prefetch_addr);
-                        }
-                        l1cache->getByte(prefetch_addr, nullptr, true);
-                    }
-                }
-            }
-        } else {
-            // Prefetching is active: verify stride consistency
-            if (new_stride == stride) {
-                diff_stride_count = 0;
-
-                // Continue prefetching the next 2 blocks
-                for (int i = 1; i <= 2; ++i) {
-                    uint32_t prefetch_addr = addr + i * stride;
-
-                    if (!l1cache->inCache(prefetch_addr)) {
-                        if (!memory->isPageExist(prefetch_addr)) {
-                            memory->addPage(prefetch_addr);
-                        }
-                        l1cache->getByte(prefetch_addr, nullptr, true);
-                    }
-                }
-            } else {
-                // Increment inconsistency count and potentially disable prefetching
-                diff_stride_count++;
-                if (diff_stride_count > 3) {
-                    is_prefetch = false;
-                    stride = new_stride;
-                    same_stride_count = 1;
+    // Clean up allocated memory; the hierarchy releases its levels
+    delete timing;
+
+    return 0;
+}
+
+// Simulates a private L1/L2 per core over a shared L3, kept coherent by a
+// directory. Each record runs on the core its trace line names
+template <typename Addr>
+int simulateCores() {
+    typedef typename BasicCache<Addr>::Record Record;
+
+    // The directory works on whole blocks of a private L1 and L2 per core
+    // and a shared L3
+    std::vector<Config::Level> config;
+    if (!getLevels(config)) {
+        exit(-1);
+    }
+    if (config.size() != 3) {
+        printf("Multi-core mode needs three cache levels\n");
+        exit(-1);
+    }
+    uint32_t blockSize = config[2].policy.blockSize;
+    if (config[0].policy.blockSize != blockSize ||
+        config[1].policy.blockSize != blockSize) {
+        printf("Multi-core mode needs the same block size at every level\n");
+        exit(-1);
+    }
+    for (const Config::Level &level : config) {
+        if (level.policy.victimBlocks > 0 ||
+            level.policy.inclusion != CacheBase::NON_INCLUSIVE) {
+            printf("Multi-core mode has no victim caches or inclusion "
+                   "policies; use -I for an inclusive L3\n");
+            exit(-1);
+        }
+    }
+
+    // Build the shared L3 and one stack per core above it
+    BasicMemoryManager<Addr> *memory = new BasicMemoryManager<Addr>();
+    BasicCache<Addr> *l3cache = new BasicCache<Addr>(
+        memory, config[2].policy, nullptr, config[2].writeBack,
+        config[2].writeAllocate, timingOnly);
+    BasicCoherence<Addr> coherence(coherenceProtocol, blockSize, inclusiveL3);
+    coherence.setShared(l3cache);
+    std::vector<BasicCache<Addr> *> caches;   // L1 and L2 of every core
+    std::vector<std::string> names;
+    for (uint32_t core = 0; core < coreNum; ++core) {
+        BasicCache<Addr> *l2cache = new BasicCache<Addr>(
+            memory, config[1].policy, l3cache, config[1].writeBack,
+            config[1].writeAllocate, timingOnly);
+        BasicCache<Addr> *l1cache = new BasicCache<Addr>(
+            memory, config[0].policy, l2cache, config[0].writeBack,
+            config[0].writeAllocate, timingOnly);
+        coherence.addCore(l1cache, l2cache);
+        caches.push_back(l1cache);
+        caches.push_back(l2cache);
+        std::string prefix = "core" + std::to_string(core) + ".";
+        names.push_back(prefix + config[0].name);
+        names.push_back(prefix + config[1].name);
+    }
+    caches.push_back(l3cache);
+    names.push_back(config[2].name);
+    memory->setCache(caches[0]);
+
+    // Attach the prefetchers of each level to every core's cache of it
+    for (size_t i = 0; i < caches.size(); ++i) {
+        const Config::Level &level = config[i + 1 == caches.size() ? 2 : i % 2];
+        if (level.prefetch) {
+            caches[i]->setPrefetcher(Prefetcher::create(
+                level.prefetcher, blockSize, level.prefetchDegree));
+        }
+    }
+
+    BasicTraceReader<Addr> trace;
+    if (!trace.open(traceFilePath)) {
+        exit(-1);
+    }
+
+    IntervalLog intervals;
+    std::string logPath;
+    if (intervalLength > 0) {
+        logPath = intervalLogPath != nullptr
+                      ? intervalLogPath
+                      : std::string(traceFilePath) + ".intervals.csv";
+        bool binary = logPath.size() >= 4 &&
+                      logPath.compare(logPath.size() - 4, 4, ".bin") == 0;
+        for (size_t i = 0; i < caches.size(); ++i) {
+            intervals.addLevel(names[i].c_str(), &caches[i]->statistics);
+        }
+        if (!intervals.open(logPath.c_str(),
+                            binary ? IntervalLog::BINARY : IntervalLog::CSV,
+                            intervalUnit, intervalLength)) {
+            exit(-1);
+        }
+    }
+
+    // Hand every record to the directory, which runs it on its core
+    const Record *chunkBegin, *chunkEnd;
+    while (trace.next(chunkBegin, chunkEnd)) {
+        while (chunkBegin != chunkEnd) {
+            uint64_t n = uint64_t(chunkEnd - chunkBegin);
+            if (intervalLength > 0 && n > intervals.getBatchSize())
+                n = intervals.getBatchSize();
+            for (const Record *r = chunkBegin; r != chunkBegin + n; ++r) {
+                if (r->getCore() >= coreNum) {
+                    printf("Core %u in trace beyond the %u simulated\n",
+                           r->getCore(), coreNum);
+                    exit(-1);
                 }
+                coherence.access(r->getCore(), *r);
             }
+            if (intervalLength > 0)
+                intervals.advance(n);
+            chunkBegin += n;
         }
     }
 
-    // Display cache statistics for L1 cache
-    printf("L1 Cache:\n");
-    l1cache->printStatistics();
+    if (trace.failed() || !intervals.close()) {
+        exit(-1);
+    }
+
+    // Display the statistics of every cache, then of the coherence
+    if (statisticsFormat == CacheBase::CSV) {
+        CacheBase::writeStatisticsHeader(stdout);
+    } else if (statisticsFormat == CacheBase::JSON) {
+        printf("{\n  \"caches\": [");
+    }
+    for (size_t i = 0; i < caches.size(); ++i) {
+        if (statisticsFormat == CacheBase::TEXT) {
+            if (i + 1 == caches.size())
+                printf("Shared %s Cache:\n", names[i].c_str());
+            else
+                printf("Core %zu %s Cache:\n", i / 2,
+                       config[i % 2].name.c_str());
+        }
+        caches[i]->writeStatisticsRecord(stdout, statisticsFormat,
+                                         names[i].c_str(), i == 0);
+    }
+    if (statisticsFormat == CacheBase::JSON) {
+        printf("\n  ],\n");
+    }
+    coherence.writeStatistics(stdout, statisticsFormat, HOT_LINES);
+    if (statisticsFormat == CacheBase::JSON) {
+        printf("\n}\n");
+    }
+    if (hotLinePath != nullptr && !coherence.writeLines(hotLinePath)) {
+        exit(-1);
+    }
 
     // Clean up allocated memory
-    delete l1cache;
-    delete l2cache;
-    delete l3cache;
+    for (BasicCache<Addr> *cache : caches) {
+        delete cache;
+    }
     delete memory;
 
     return 0;
 }
 
-// Parses command-line arguments to retrieve the trace file path
+// Parses command-line arguments to retrieve the trace file path and options
 bool parseParameters(int argc, char **argv) {
-    if (argc > 1) {
-        traceFilePath = argv[1];
+    for (int i = 1; i < argc; ++i) {
+        if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            switch (argv[i][1]) {
+                case 't':
+                    timingOnly = true;
+                    break;
+                case 'w':
+                    wideAddresses = true;
+                    break;
+                case 'o': {
+                    const char *value = getOptionValue(argc, argv, i);
+                    if (value == nullptr || !parseFormat(value))
+                        return false;
+                    break;
+                }
+                case 'i': {
+                    const char *value = getOptionValue(argc, argv, i);
+                    if (value == nullptr || !parseInterval(value))
+                        return false;
+                    break;
+                }
+                case 'l':
+                    intervalLogPath = getOptionValue(argc, argv, i);
+                    if (intervalLogPath == nullptr)
+                        return false;
+                    break;
+                case 'p': {
+                    const char *value = getOptionValue(argc, argv, i);
+                    if (value == nullptr || !parsePrefetcher(value))
+                        return false;
+                    break;
+                }
+                case 'c': {
+                    const char *value = getOptionValue(argc, argv, i);
+                    if (value == nullptr || !parseCores(value))
+                        return false;
+                    break;
+                }
+                case 'm': {
+                    const char *value = getOptionValue(argc, argv, i);
+                    if (value == nullptr ||
+                        !CoherenceBase::parseName(value, coherenceProtocol)) {
+                        fprintf(stderr, "Unknown coherence protocol %s\n",
+                                value != nullptr ? value : "");
+                        return false;
+                    }
+                    break;
+                }
+                case 'I':
+                    inclusiveL3 = true;
+                    break;
+                case 'T':
+                    eventTiming = true;
+                    break;
+                case 'V': {
+                    const char *value = getOptionValue(argc, argv, i);
+                    if (value == nullptr || !parseVictim(value))
+                        return false;
+                    break;
+                }
+                case 'f':
+                    configFilePath = getOptionValue(argc, argv, i);
+                    if (configFilePath == nullptr)
+                        return false;
+                    break;
+                case 'W': {
+                    const char *value = getOptionValue(argc, argv, i);
+                    if (value == nullptr || !parseCheckpoint(value))
+                        return false;
+                    break;
+                }
+                case 'R':
+                    checkpointLoadPath = getOptionValue(argc, argv, i);
+                    if (checkpointLoadPath == nullptr)
+                        return false;
+                    break;
+                case 'H':
+                    hotLinePath = getOptionValue(argc, argv, i);
+                    if (hotLinePath == nullptr)
+                        return false;
+                    break;
+                case 'P':
+                    profilePrefix = getOptionValue(argc, argv, i);
+                    if (profilePrefix == nullptr)
+                        return false;
+#ifndef CACHESIM_PROFILE
+                    printf("Miss profiles need a build with "
+                           "CACHESIM_PROFILE\n");
+                    return false;
+#endif
+                    break;
+                default:
+                    return false;
+            }
+        } else if (traceFilePath == nullptr) {
+            traceFilePath = argv[i];
+        } else {
+            return false;
+        }
+    }
+    return traceFilePath != nullptr;
+}
+
+// Writes the per-set profile of every level and the memory reads per page,
+// the pages that missed most first
+template <typename Addr>
+bool writeProfile(const std::vector<BasicCache<Addr> *> &levels,
+                  const std::vector<Config::Level> &config,
+                  BasicMemoryManager<Addr> *memory) {
+#ifdef CACHESIM_PROFILE
+    std::string setPath = std::string(profilePrefix) + ".sets.csv";
+    std::string pagePath = std::string(profilePrefix) + ".pages.csv";
+    FILE *sets = fopen(setPath.c_str(), "w");
+    if (sets == nullptr) {
+        printf("Unable to open file %s\n", setPath.c_str());
+        return false;
+    }
+    CacheBase::writeSetProfileHeader(sets);
+    for (size_t i = 0; i < levels.size(); ++i) {
+        levels[i]->writeSetProfile(sets, config[i].name.c_str());
+    }
+    fclose(sets);
+
+    FILE *pages = fopen(pagePath.c_str(), "w");
+    if (pages == nullptr) {
+        printf("Unable to open file %s\n", pagePath.c_str());
+        return false;
+    }
+    std::vector<std::pair<Addr, uint64_t> > counts(
+        memory->getPageMisses().begin(), memory->getPageMisses().end());
+    std::sort(counts.begin(), counts.end(),
+              [](const std::pair<Addr, uint64_t> &a,
+                 const std::pair<Addr, uint64_t> &b) {
+                  return a.second != b.second ? a.second > b.second
+                                              : a.first < b.first;
+              });
+    fprintf(pages, "page,misses\n");
+    for (const std::pair<Addr, uint64_t> &count : counts) {
+        fprintf(pages, "0x%llx,%llu\n",
+                (unsigned long long)count.first << 12,
+                (unsigned long long)count.second);
+    }
+    fclose(pages);
+    return true;
+#else
+    (void)levels;
+    (void)config;
+    (void)memory;
+    return false;
+#endif
+}
+
+// Returns the value of the option at argv[i], accepting both "-pstride"
+// and "-p stride"
+const char *getOptionValue(int argc, char **argv, int &i) {
+    if (argv[i][2] != '\0')
+        return &argv[i][2];
+    if (i + 1 < argc)
+        return argv[++i];
+    return nullptr;
+}
+
+// Parses a prefetcher option "[level=]name[:degree]" or "none". The first
+// -p replaces the default L1 stride prefetcher
+bool parsePrefetcher(const char *spec) {
+    if (prefetchDefault) {
+        prefetchOptions[0].enabled = false;
+        prefetchDefault = false;
+    }
+    if (strcmp(spec, "none") == 0) {
         return true;
+    }
+
+    std::string name(spec);
+    int level = 1;
+    if (name.size() > 2 && name[1] == '=') {
+        level = name[0] - '0';
+        name = name.substr(2);
+    }
+    if (level < 1 || level > int(Config::MAX_LEVELS)) {
+        fprintf(stderr, "Invalid cache level in %s\n", spec);
+        return false;
+    }
+
+    PrefetchOption &option = prefetchOptions[level - 1];
+    option.degree = 0;
+    size_t colon = name.find(':');
+    if (colon != std::string::npos) {
+        int degree = atoi(name.c_str() + colon + 1);
+        if (degree < 1) {
+            fprintf(stderr, "Invalid prefetch degree in %s\n", spec);
+            return false;
+        }
+        option.degree = degree;
+        name = name.substr(0, colon);
+    }
+    if (!Prefetcher::parseName(name.c_str(), option.type)) {
+        fprintf(stderr, "Unknown prefetcher %s\n", name.c_str());
+        return false;
+    }
+    option.enabled = true;
+    return true;
+}
+
+// Parses the statistics output format
+bool parseFormat(const char *name) {
+    if (strcmp(name, "text") == 0) {
+        statisticsFormat = CacheBase::TEXT;
+    } else if (strcmp(name, "json") == 0) {
+        statisticsFormat = CacheBase::JSON;
+    } else if (strcmp(name, "csv") == 0) {
+        statisticsFormat = CacheBase::CSV;
     } else {
+        fprintf(stderr, "Unknown output format %s\n", name);
+        return false;
+    }
+    return true;
+}
+
+// Parses an interval length: a number of trace records, or of simulated
+// cycles with a "c" suffix
+bool parseInterval(const char *spec) {
+    char *end;
+    intervalLength = strtoull(spec, &end, 10);
+    intervalUnit = IntervalLog::ACCESSES;
+    if (*end == 'c') {
+        intervalUnit = IntervalLog::CYCLES;
+        ++end;
+    }
+    if (end == spec || *end != '\0' || intervalLength == 0) {
+        fprintf(stderr, "Invalid interval %s\n", spec);
+        return false;
+    }
+    return true;
+}
+
+// Reads the levels of the config file, or sets up the built-in hierarchy.
+// Prefetchers given with -p replace those of the config file
+bool getLevels(std::vector<Config::Level> &levels) {
+    Config config;
+    if (configFilePath != nullptr) {
+        if (!config.load(configFilePath)) {
+            return false;
+        }
+        levels = config.getLevels();
+        if (levels.empty()) {
+            printf("No cache levels in %s\n", configFilePath);
+            return false;
+        }
+    } else {
+        levels.clear();
+        levels.push_back(Config::makeLevel("L1"));
+        levels.push_back(Config::makeLevel("L2"));
+        levels.push_back(Config::makeLevel("L3"));
+        levels[0].policy = {16 * 1024, 64, (16 * 1024) / 64, 1, 1, 0};
+        levels[1].policy = {128 * 1024, 64, (128 * 1024) / 64, 8, 8, 0};
+        levels[2].policy = {2 * 1024 * 1024, 64, (2 * 1024 * 1024) / 64,
+                            16, 20, 100};
+    }
+    timingParams = config.getTiming();
+    if (victimBlocks > 0) {
+        levels[0].policy.victimBlocks = victimBlocks;
+    }
+    if (!HierarchyBase::checkLevels(levels)) {
+        return false;
+    }
+
+    if (configFilePath != nullptr && prefetchDefault) {
+        return true;
+    }
+    for (uint32_t i = 0; i < Config::MAX_LEVELS; ++i) {
+        const PrefetchOption &option = prefetchOptions[i];
+        if (i >= levels.size()) {
+            if (option.enabled) {
+                printf("No cache level %u for a prefetcher\n", i + 1);
+                return false;
+            }
+            continue;
+        }
+        levels[i].prefetch = option.enabled;
+        levels[i].prefetcher = option.type;
+        levels[i].prefetchDegree = option.degree;
+    }
+    return true;
+}
+
+// Parses the block count of the L1 victim cache, a power of two
+bool parseVictim(const char *spec) {
+    char *end;
+    unsigned long blocks = strtoul(spec, &end, 10);
+    if (end == spec || *end != '\0' || blocks == 0 ||
+        (blocks & (blocks - 1)) != 0) {
+        fprintf(stderr, "Invalid victim cache size %s\n", spec);
+        return false;
+    }
+    victimBlocks = blocks;
+    return true;
+}
+
+// Parses a checkpoint to save, "records:file"
+bool parseCheckpoint(const char *spec) {
+    char *end;
+    checkpointRecords = strtoull(spec, &end, 10);
+    if (end == spec || *end != ':' || end[1] == '\0' ||
+        checkpointRecords == 0) {
+        fprintf(stderr, "Invalid checkpoint %s\n", spec);
+        return false;
+    }
+    checkpointSavePath = end + 1;
+    return true;
+}
+
+// Parses the number of cores, at most as many as the directory can track
+bool parseCores(const char *spec) {
+    char *end;
+    unsigned long cores = strtoul(spec, &end, 10);
+    if (end == spec || *end != '\0' || cores == 0 ||
+        cores > CoherenceBase::MAX_CORES) {
+        fprintf(stderr, "Invalid core count %s\n", spec);
         return false;
     }
+    coreNum = cores;
+    return true;
 }
 
 // Displays usage instructions for the program
 void printUsage() {
-    printf("Usage: CacheSim trace-file\n");
+    printf("Usage: CacheSim trace-file [-t] [-w] [-o format] "
+           "[-i interval[c]] [-l log-file] "
+           "[-p [level=]name[:degree]]... "
+           "[-c cores [-m protocol] [-I] [-H line-file]] "
+           "[-f config-file] [-T] [-W records:checkpoint-file] "
+           "[-R checkpoint-file] [-V blocks] [-P prefix]\n");
+    printf("Parameters: trace-file - reads a text or binary trace "
+           "from standard input, "
+           "-t timing-only simulation without data, "
+           "-w 64-bit addresses in a text trace, which is otherwise "
+           "32-bit unless its start shows wider ones, "
+           "-o statistics format: text, json or csv (default: text), "
+           "-i log the statistics of every level per interval of this many "
+           "trace records, or simulated cycles with a c suffix, "
+           "-l interval log, binary if it ends in .bin "
+           "(default: trace-file.intervals.csv), "
+           "-p prefetcher of a cache level (default 1): stride, "
+           "nextline, stream, delta or none, with the blocks prefetched "
+           "per trigger (default: stride at L1), "
+           "-c simulate this many cores with a private L1 and L2 each over "
+           "a coherent shared L3, running every trace record on its core, "
+           "-m coherence protocol: mesi or moesi (default: mesi), "
+           "-I inclusive L3, "
+           "-H write the coherence traffic of every line as CSV, "
+           "-f build the hierarchy from the [L1], [L2], ... sections of an "
+           "INI config file (default: 16K L1, 128K L2, 2M L3), "
+           "-T time the accesses with MSHRs, overlapping misses and a "
+           "memory channel, reporting AMAT, MLP and queueing delay, "
+           "-W stop after this many trace records and save the warmed "
+           "cache state, with the data and memory unless -t, "
+           "-R start from a saved state past the records it covers, "
+           "-V attach a fully associative victim cache of this many blocks "
+           "to L1, "
+           "-P write the accesses and 3C misses of every set to "
+           "prefix.sets.csv and the blocks read from memory per page to "
+           "prefix.pages.csv (builds with CACHESIM_PROFILE)\n");
 }
\ No newline at end of file
@@ -10,52 +10,301 @@
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <string>
 #include <vector>
 
 #include "Cache.h"
+#include "Config.h"
 #include "Debug.h"
 #include "MemoryManager.h"
+#include "Sampling.h"
+#include "StackDistance.h"
+#include "Sweep.h"
+#include "Trace.h"
+#include "TraceReader.h"
+
+// Measure window bookkeeping of one sampled configuration
+struct SampledRun {
+  Sampling sampling;
+  uint64_t index;                    // Trace accesses seen so far
+  bool inWindow;                     // Inside a measure window
+  uint64_t measuredCycles;           // Cycles spent in measure windows
+  CacheBase::Statistics windowBegin;     // Statistics when the window opened
+  std::vector<CacheBase::SetStatistics> setBegin;   // Same, per sampled set
+};
 
 bool parseParameters(int argc, char **argv);
+const char *getOptionValue(int argc, char **argv, int &i);
+bool parseReplacements(const char *list);
+bool parseTimeSampling(const char *spec);
+bool parseShard(const char *spec);
+std::string getShardPath(uint32_t index, uint32_t count);
+std::string getSweepSettings(const Config::SweepSpace &space);
+bool mergeShards(const std::vector<Sweep::Point> &points,
+                 const std::string &settings);
 void printUsage();
-void simulateCache(std::ofstream &csvFile, uint32_t cacheSize,
-                   uint32_t blockSize, uint32_t associativity, bool writeBack,
-                   bool writeAllocate);
+template <typename Addr>
+Sweep::Result simulateCache(const Sweep::Point &point);
+bool isStackEligible(const Sweep::Point &point);
+bool isPowerOfTwo(uint32_t n);
+template <typename Addr>
+void analyseGroup(const std::vector<Sweep::Point> &points,
+                  const std::vector<size_t> &group,
+                  std::vector<Sweep::Result> &results);
+template <typename Addr>
+void replayRecords(BasicCache<Addr> *cache,
+                   const typename BasicCache<Addr>::Record *begin,
+                   const typename BasicCache<Addr>::Record *end);
+template <typename Addr>
+void replaySampled(BasicCache<Addr> *cache, SampledRun &run,
+                   const typename BasicCache<Addr>::Record *begin,
+                   const typename BasicCache<Addr>::Record *end);
+template <typename Addr>
+void accessRecord(BasicCache<Addr> *cache,
+                  const typename BasicCache<Addr>::Record &record);
+template <typename Addr>
+void openWindow(BasicCache<Addr> *cache, SampledRun &run);
+template <typename Addr>
+void closeWindow(BasicCache<Addr> *cache, SampledRun &run);
+template <typename Addr>
+const BasicTrace<Addr> &getTrace();
 
 bool verbose = false;
 bool isSingleStep = false;
+bool isStreaming = false;
+bool timingOnly = false;
+bool wideAddresses = false;          // Text trace addresses are 64-bit
+bool stackDistance = false;
+unsigned jobs = 0;
+uint32_t setSampleRatio = 1;
+uint64_t samplePeriod = 0;
+uint64_t sampleWarmup = 0;
+uint64_t sampleMeasure = 0;
 const char *traceFilePath;
+const char *configFilePath = nullptr;
+
+// Sweeps split across nodes. With -p this run simulates every shardCount-th
+// group of configurations from shardIndex on and appends their rows to a
+// partial result file, keeping the rows an earlier run of the shard wrote
+// with the same settings; -m merges the partial files of mergeCount shards
+// into the full CSV
+uint32_t shardIndex = 0;
+uint32_t shardCount = 0;
+uint32_t mergeCount = 0;
+
+// Replacement policies to sweep, LRU unless given with -r
+std::vector<ReplacementPolicy::Type> replacements;
+
+// Trace decoded once and replayed read-only by every configuration, unless
+// each configuration streams the trace itself. Only the one matching the
+// trace's address width is used
+Trace trace;
+Trace64 trace64;
+bool wideTrace = false;
+
+// The loaded trace of the given address width
+template <>
+const Trace &getTrace<uint32_t>() {
+  return trace;
+}
+
+template <>
+const Trace64 &getTrace<uint64_t>() {
+  return trace64;
+}
+
+// Serializes console output of concurrently running configurations
+std::mutex outputMutex;
 
 int main(int argc, char **argv) {
   if (!parseParameters(argc, argv)) {
+    printUsage();
     return -1;
   }
 
-  // Open CSV file and write header
-  std::ofstream csvFile(std::string(traceFilePath) + ".csv");
-  csvFile << "cacheSize,blockSize,associativity,writeBack,writeAllocate,"
-             "missRate,totalCycles\n";
-
-  // Cache Size: 32 Kb to 32 Mb
-  for (uint32_t cacheSize = 4 * 1024; cacheSize <= 1 * 1024 * 1024;
-       cacheSize *= 4) {
-    // Block Size: 1 byte to 4096 byte
-    // The maximum block size is imposed by VM page size
-    for (uint32_t blockSize = 32; blockSize <= 256; blockSize *= 2) {
-      for (uint32_t associativity = 2; associativity <= 32;
-           associativity *= 2) {
-        uint32_t blockNum = cacheSize / blockSize;
-        if (blockNum % associativity != 0)
+  // The design space comes from the config file, or is the built-in grid.
+  // Replacement policies given with -r take precedence
+  Config config;
+  if (configFilePath != nullptr && !config.load(configFilePath)) {
+    return -1;
+  }
+  const Config::SweepSpace &space = config.getSweep();
+  if (replacements.empty()) {
+    replacements = space.replacements;
+  }
+  if (replacements.empty()) {
+    replacements.push_back(ReplacementPolicy::LRU);
+  }
+
+  // Verbose and single step output only make sense for one configuration at
+  // a time
+  if (verbose || isSingleStep) {
+    jobs = 1;
+    stackDistance = false;
+  }
+
+  // Sampled runs are estimates, which the exact stack distance pass cannot
+  // produce
+  bool sampling = setSampleRatio > 1 || samplePeriod > 0;
+  if (sampling) {
+    stackDistance = false;
+  }
+
+  if (shardCount > 0 && mergeCount > 0) {
+    printf("A run either simulates a shard or merges them\n");
+    return -1;
+  }
+
+  // Traces with addresses beyond 32 bits run on the 64-bit cache; all
+  // others keep the narrower and faster 32-bit one. Merging needs no trace
+  if (mergeCount == 0) {
+    uint16_t addrBits = TraceBase::getAddrBits(traceFilePath, wideAddresses);
+    if (addrBits == 0) {
+      printf("Unable to open file %s\n", traceFilePath);
+      return -1;
+    }
+    wideTrace = addrBits == 64;
+    if (!isStreaming && !(wideTrace ? trace64.load(traceFilePath)
+                                    : trace.load(traceFilePath))) {
+      return -1;
+    }
+  }
+
+  Sweep sweep(jobs);
+
+  // Cache Size: 4 Kb to 1 Mb, block size: 32 to 256 bytes and
+  // associativity: 2 to 32 unless the config file says otherwise. The
+  // maximum block size is imposed by VM page size
+  uint32_t skipped = 0;
+  for (uint32_t cacheSize : space.cacheSizes) {
+    for (uint32_t blockSize : space.blockSizes) {
+      for (uint32_t associativity : space.associativities) {
+        uint32_t blockNum = blockSize > 0 ? cacheSize / blockSize : 0;
+        if (blockNum == 0 || associativity == 0 ||
+            blockNum % associativity != 0)
+          continue;
+        if (!isPowerOfTwo(cacheSize) || !isPowerOfTwo(blockSize) ||
+            !isPowerOfTwo(associativity)) {
+          ++skipped;
           continue;
+        }
 
-        simulateCache(csvFile, cacheSize, blockSize, associativity, true, true);
-        simulateCache(csvFile, cacheSize, blockSize, associativity, true, false);
-        simulateCache(csvFile, cacheSize, blockSize, associativity, false, true);
-        simulateCache(csvFile, cacheSize, blockSize, associativity, false, false);
+        for (ReplacementPolicy::Type r : replacements) {
+          for (bool writeBack : space.writeBacks) {
+            for (bool writeAllocate : space.writeAllocates) {
+              sweep.addPoint({cacheSize, blockSize, associativity, writeBack,
+                              writeAllocate, r, space.hitLatency,
+                              space.missLatency});
+            }
+          }
+        }
       }
     }
   }
+  if (skipped > 0) {
+    printf("Skipped %u configurations whose sizes are not powers of two\n",
+           skipped);
+  }
+
+  // With -d, the LRU write-allocate configurations sharing a block size and
+  // set count are analysed together in one stack distance pass; everything
+  // else is simulated one configuration at a time
+  const std::vector<Sweep::Point> &points = sweep.getPoints();
+  if (mergeCount > 0) {
+    return mergeShards(points, getSweepSettings(space)) ? 0 : -1;
+  }
+  std::vector<std::vector<size_t>> groups;
+  std::map<std::pair<uint32_t, uint32_t>, size_t> stackGroups;
+  for (size_t i = 0; i < points.size(); ++i) {
+    if (stackDistance && isStackEligible(points[i])) {
+      std::pair<uint32_t, uint32_t> key(
+          points[i].blockSize,
+          points[i].cacheSize / points[i].blockSize / points[i].associativity);
+      if (stackGroups.count(key) == 0) {
+        stackGroups[key] = groups.size();
+        groups.push_back(std::vector<size_t>());
+      }
+      groups[stackGroups[key]].push_back(i);
+    } else {
+      groups.push_back(std::vector<size_t>(1, i));
+    }
+  }
+
+  // A shard keeps its groups that still miss a row. The partial file is
+  // rewritten with the rows kept, dropping one cut short, and then grows
+  // by a row per configuration as the groups finish
+  std::vector<std::string> done(points.size());
+  std::ofstream partialFile;
+  std::string partialPath;
+  if (shardCount > 0) {
+    std::string settings = getSweepSettings(space);
+    partialPath = getShardPath(shardIndex, shardCount);
+    if (!Sweep::readPartial(partialPath, settings, points, done)) {
+      return -1;
+    }
+    std::vector<std::vector<size_t>> pending;
+    for (size_t g = shardIndex; g < groups.size(); g += shardCount) {
+      for (size_t i : groups[g]) {
+        if (done[i].empty()) {
+          pending.push_back(groups[g]);
+          break;
+        }
+      }
+    }
+    partialFile.open(partialPath);
+    if (!partialFile) {
+      printf("Unable to open file %s\n", partialPath.c_str());
+      return -1;
+    }
+    Sweep::writePartialHeader(partialFile, settings);
+    size_t kept = 0;
+    for (size_t i = 0; i < points.size(); ++i) {
+      if (!done[i].empty()) {
+        partialFile << i << "," << done[i] << "\n";
+        ++kept;
+      }
+    }
+    partialFile.flush();
+    printf("Shard %u of %u: %zu groups of configurations to simulate, "
+           "%zu results kept from %s\n",
+           shardIndex, shardCount, pending.size(), kept, partialPath.c_str());
+    groups.swap(pending);
+  }
+
+  std::vector<Sweep::Result> results = sweep.run(
+      groups, [&](const std::vector<size_t> &group,
+                  std::vector<Sweep::Result> &out) {
+        if (stackDistance && isStackEligible(points[group[0]])) {
+          if (wideTrace)
+            analyseGroup<uint64_t>(points, group, out);
+          else
+            analyseGroup<uint32_t>(points, group, out);
+        } else {
+          out[group[0]] = wideTrace ? simulateCache<uint64_t>(points[group[0]])
+                                    : simulateCache<uint32_t>(points[group[0]]);
+        }
+        if (shardCount > 0) {
+          std::lock_guard<std::mutex> lock(outputMutex);
+          for (size_t i : group) {
+            if (done[i].empty())
+              Sweep::writePartialRow(partialFile, i, points[i], out[i]);
+          }
+        }
+      });
+  if (shardCount > 0) {
+    printf("Results of shard %u have been written to %s\n", shardIndex,
+           partialPath.c_str());
+    return 0;
+  }
+
+  // Open CSV file and write results in sweep order
+  std::ofstream csvFile(std::string(traceFilePath) + ".csv");
+  Sweep::writeCsvHeader(csvFile);
+  for (size_t i = 0; i < points.size(); ++i) {
+    Sweep::writeCsvRow(csvFile, points[i], results[i]);
+  }
 
   printf("Result has been written to %s\n",
          (std::string(traceFilePath) + ".csv").c_str());
@@ -74,6 +323,62 @@ bool parseParameters(int argc, char **argv) {
       case 's':
         isSingleStep = 1;
         break;
+      case 'b':
+        isStreaming = 1;
+        break;
+      case 't':
+        timingOnly = 1;
+        break;
+      case 'w':
+        wideAddresses = 1;
+        break;
+      case 'd':
+        stackDistance = 1;
+        break;
+      case 'j': {
+        const char *value = getOptionValue(argc, argv, i);
+        if (value == nullptr)
+          return false;
+        jobs = atoi(value);
+        break;
+      }
+      case 'r': {
+        const char *value = getOptionValue(argc, argv, i);
+        if (value == nullptr || !parseReplacements(value))
+          return false;
+        break;
+      }
+      case 'S': {
+        const char *value = getOptionValue(argc, argv, i);
+        if (value == nullptr || atoi(value) < 1)
+          return false;
+        setSampleRatio = atoi(value);
+        break;
+      }
+      case 'T': {
+        const char *value = getOptionValue(argc, argv, i);
+        if (value == nullptr || !parseTimeSampling(value))
+          return false;
+        break;
+      }
+      case 'f':
+        configFilePath = getOptionValue(argc, argv, i);
+        if (configFilePath == nullptr)
+          return false;
+        break;
+      case 'p': {
+        const char *value = getOptionValue(argc, argv, i);
+        if (value == nullptr || !parseShard(value))
+          return false;
+        break;
+      }
+      case 'm': {
+        const char *value = getOptionValue(argc, argv, i);
+        if (value == nullptr || atoi(value) < 1)
+          return false;
+        mergeCount = atoi(value);
+        break;
+      }
       default:
         return false;
       }
@@ -91,74 +396,412 @@ bool parseParameters(int argc, char **argv) {
   return true;
 }
 
+// Returns the value of the option at argv[i], accepting both "-j4" and
+// "-j 4"
+const char *getOptionValue(int argc, char **argv, int &i) {
+  if (argv[i][2] != '\0')
+    return &argv[i][2];
+  if (i + 1 < argc)
+    return argv[++i];
+  return nullptr;
+}
+
+// Parses a comma separated list of replacement policy names
+bool parseReplacements(const char *list) {
+  std::string names(list);
+  size_t begin = 0;
+  while (begin <= names.size()) {
+    size_t end = names.find(',', begin);
+    if (end == std::string::npos)
+      end = names.size();
+    ReplacementPolicy::Type type;
+    if (!ReplacementPolicy::parseName(names.substr(begin, end - begin).c_str(),
+                                      type)) {
+      printf("Unknown replacement policy in %s\n", list);
+      return false;
+    }
+    replacements.push_back(type);
+    begin = end + 1;
+  }
+  return true;
+}
+
+// Parses a time sampling schedule "period,warmup,measure" in records
+bool parseTimeSampling(const char *spec) {
+  unsigned long long period, warmup, measure;
+  char tail;
+  if (sscanf(spec, "%llu,%llu,%llu%c", &period, &warmup, &measure, &tail) !=
+          3 ||
+      measure == 0 || warmup + measure > period) {
+    printf("Invalid time sampling schedule %s\n", spec);
+    return false;
+  }
+  samplePeriod = period;
+  sampleWarmup = warmup;
+  sampleMeasure = measure;
+  return true;
+}
+
+// Parses a shard "index/count", the index counting from 0
+bool parseShard(const char *spec) {
+  unsigned index, count;
+  char tail;
+  if (sscanf(spec, "%u/%u%c", &index, &count, &tail) != 2 || count == 0 ||
+      index >= count) {
+    printf("Invalid shard %s\n", spec);
+    return false;
+  }
+  shardIndex = index;
+  shardCount = count;
+  return true;
+}
+
+// Partial result file of a shard, next to the trace like the full CSV
+std::string getShardPath(uint32_t index, uint32_t count) {
+  return std::string(traceFilePath) + ".shard-" + std::to_string(index) +
+         "-of-" + std::to_string(count) + ".csv";
+}
+
+// Options besides the points that change the results of a sweep, which
+// every shard and the merge must share
+std::string getSweepSettings(const Config::SweepSpace &space) {
+  char settings[256];
+  snprintf(settings, sizeof(settings),
+           "hit=%u,miss=%u,timingOnly=%d,setSampleRatio=%u,"
+           "timeSampling=%llu/%llu/%llu",
+           space.hitLatency, space.missLatency, timingOnly, setSampleRatio,
+           (unsigned long long)samplePeriod, (unsigned long long)sampleWarmup,
+           (unsigned long long)sampleMeasure);
+  return settings;
+}
+
+// Merges the partial results of every shard into the CSV of the full sweep,
+// in point order. Fails if any configuration has no result yet, so a
+// failed shard can be rerun first and resume where it stopped, and if a
+// shard ran with other settings than this run
+bool mergeShards(const std::vector<Sweep::Point> &points,
+                 const std::string &settings) {
+  std::vector<std::string> rows(points.size());
+  for (uint32_t shard = 0; shard < mergeCount; ++shard) {
+    std::vector<std::string> shardRows;
+    if (!Sweep::readPartial(getShardPath(shard, mergeCount), settings, points,
+                            shardRows)) {
+      return false;
+    }
+    for (size_t i = 0; i < points.size(); ++i) {
+      if (!shardRows[i].empty())
+        rows[i] = shardRows[i];
+    }
+  }
+  size_t missing = 0;
+  for (const std::string &row : rows) {
+    missing += row.empty();
+  }
+  if (missing > 0) {
+    printf("%zu of %zu configurations have no result in the %u shards\n",
+           missing, points.size(), mergeCount);
+    return false;
+  }
+
+  std::string path = std::string(traceFilePath) + ".csv";
+  std::ofstream csvFile(path);
+  Sweep::writeCsvHeader(csvFile);
+  for (const std::string &row : rows) {
+    csvFile << row << "\n";
+  }
+  printf("Result has been written to %s\n", path.c_str());
+  return true;
+}
+
 void printUsage() {
-  printf("Usage: CacheSim trace-file [-s] [-v]\n");
-  printf("Parameters: -s single step, -v verbose output\n");
+  printf("Usage: CacheSim trace-file [-s] [-v] [-b] [-t] [-w] [-d] "
+         "[-j jobs] "
+         "[-r policy,...] [-S ratio] [-T period,warmup,measure] "
+         "[-f config-file] [-p index/count | -m count]\n");
+  printf("Parameters: -s single step, -v verbose output, "
+         "-b bounded memory: stream the trace for every configuration "
+         "instead of loading it once, "
+         "-t timing-only simulation without data, "
+         "-w 64-bit addresses in a text trace, which is otherwise 32-bit "
+         "unless its start shows wider ones, "
+         "-d one stack distance pass for all LRU write-allocate "
+         "configurations with the same block size and set count, "
+         "-j number of worker threads (default: all cores), "
+         "-r replacement policies to sweep: lru, plru, srrip, brrip, "
+         "random, fifo (default: lru), "
+         "-S simulate only about one in ratio sets, "
+         "-T simulate only the last warmup + measure records of every "
+         "period and count the measure ones; "
+         "sampled runs report a 95%% confidence bound of the miss rate, "
+         "-f sweep the [sweep] section of an INI config file, "
+         "-p simulate only shard index (from 0) of count and append its "
+         "results to trace-file.shard-index-of-count.csv, resuming from "
+         "the results already there, "
+         "-m merge the results of count shards into trace-file.csv; "
+         "shards and merge take the same -f, -r, -t, -S and -T options\n");
 }
 
-void simulateCache(std::ofstream &csvFile, uint32_t cacheSize,
-                   uint32_t blockSize, uint32_t associativity, bool writeBack,
-                   bool writeAllocate) {
-  Cache::Policy policy;
-  policy.cacheSize = cacheSize;
-  policy.blockSize = blockSize;
-  policy.blockNum = cacheSize / blockSize;
-  policy.associativity = associativity;
-  policy.hitLatency = 1;
-  policy.missLatency = 8;
+// Simulates one configuration. Each call owns its memory manager and cache,
+// so configurations can run concurrently on different worker threads
+template <typename Addr>
+Sweep::Result simulateCache(const Sweep::Point &point) {
+  typedef typename BasicCache<Addr>::Record Record;
+  CacheBase::Policy policy = CacheBase::Policy();
+  policy.cacheSize = point.cacheSize;
+  policy.blockSize = point.blockSize;
+  policy.blockNum = point.cacheSize / point.blockSize;
+  policy.associativity = point.associativity;
+  policy.hitLatency = point.hitLatency;
+  policy.missLatency = point.missLatency;
+  policy.replacement = point.replacement;
 
   // Initialize memory and cache
-  MemoryManager *memory = nullptr;
-  Cache *cache = nullptr;
-  memory = new MemoryManager();
-  cache = new Cache(memory, policy, nullptr, writeBack, writeAllocate);
+  BasicMemoryManager<Addr> *memory = nullptr;
+  BasicCache<Addr> *cache = nullptr;
+  memory = new BasicMemoryManager<Addr>();
+  cache = BasicCache<Addr>::create(memory, policy, nullptr, point.writeBack,
+                                   point.writeAllocate, timingOnly);
+  if (cache == nullptr) {
+    exit(-1);
+  }
   memory->setCache(cache);
 
-  cache->printInfo(false);
+  {
+    std::lock_guard<std::mutex> lock(outputMutex);
+    cache->printInfo(false);
+  }
 
-  // Read and execute trace in cache-trace/ folder
-  std::ifstream trace(traceFilePath);
-  if (!trace.is_open()) {
-    printf("Unable to open file %s\n", traceFilePath);
-    exit(-1);
+  bool sampling = setSampleRatio > 1 || samplePeriod > 0;
+  SampledRun run = {Sampling(samplePeriod, sampleWarmup, sampleMeasure),
+                    0, false, 0, CacheBase::Statistics(),
+                    std::vector<CacheBase::SetStatistics>()};
+  if (setSampleRatio > 1) {
+    cache->sampleSets(setSampleRatio);
   }
 
-  char type; //'r' for read, 'w' for write
-  uint32_t addr;
-  while (trace >> type >> std::hex >> addr) {
-    if (verbose)
-      printf("%c %x\n", type, addr);
-    if (!memory->isPageExist(addr))
-      memory->addPage(addr);
-    switch (type) {
-    case 'r':
-      cache->getByte(addr);
-      break;
-    case 'w':
-      cache->setByte(addr, 0);
-      break;
-    default:
-      dbgprintf("Illegal type %c\n", type);
+  if (isStreaming) {
+    BasicTraceReader<Addr> reader;
+    if (!reader.open(traceFilePath)) {
       exit(-1);
     }
-
-    if (verbose)
-      cache->printInfo(true);
-
-    if (isSingleStep) {
-      printf("Press Enter to Continue...");
-      getchar();
+    const Record *begin, *end;
+    while (reader.next(begin, end)) {
+      if (sampling) {
+        replaySampled(cache, run, begin, end);
+      } else {
+        replayRecords(cache, begin, end);
+      }
+    }
+    if (reader.failed()) {
+      exit(-1);
     }
+  } else if (sampling) {
+    replaySampled(cache, run, getTrace<Addr>().begin(), getTrace<Addr>().end());
+  } else {
+    replayRecords(cache, getTrace<Addr>().begin(), getTrace<Addr>().end());
   }
 
   // Output Simulation Results
-  cache->printStatistics();
-  float missRate = (float)cache->statistics.numMiss /
-                   (cache->statistics.numHit + cache->statistics.numMiss);
-  csvFile << cacheSize << "," << blockSize << "," << associativity << ","
-          << writeBack << "," << writeAllocate << "," << missRate << ","
-          << cache->statistics.totalCycles << std::endl;
+  {
+    std::lock_guard<std::mutex> lock(outputMutex);
+    cache->printStatistics();
+  }
+  Sweep::Result result;
+  result.missRate = (float)cache->statistics.numMiss /
+                    (cache->statistics.numHit + cache->statistics.numMiss);
+  result.missRateError = 0;
+  result.totalCycles = cache->statistics.totalCycles;
+
+  // A sampled run estimates the miss rate over its units and scales the
+  // measured cycles up to the whole trace
+  if (sampling) {
+    if (run.inWindow) {
+      closeWindow(cache, run);
+    }
+    uint64_t units = run.sampling.getPeriodNum(run.index);
+    if (setSampleRatio > 1) {
+      units *= cache->getSetNum();
+    }
+    result.missRate = run.sampling.getMissRate();
+    result.missRateError = run.sampling.getErrorBound(units);
+    uint64_t measured = run.sampling.getAccessNum();
+    result.totalCycles =
+        measured > 0 ? (double)run.measuredCycles * run.index / measured : 0;
+  }
 
   delete cache;
   delete memory;
-}
\ No newline at end of file
+  return result;
+}
+
+// Runs a range of decoded trace records through the cache, as one batch
+// unless every access is to be shown
+template <typename Addr>
+void replayRecords(BasicCache<Addr> *cache,
+                   const typename BasicCache<Addr>::Record *begin,
+                   const typename BasicCache<Addr>::Record *end) {
+  if (verbose || isSingleStep) {
+    for (const typename BasicCache<Addr>::Record *r = begin; r != end; ++r) {
+      accessRecord(cache, *r);
+    }
+    return;
+  }
+
+  cache->access(begin, end);
+}
+
+// Runs a range of decoded trace records through the cache under the time
+// sampling schedule, counting every measure window. The schedule counts
+// accesses, so under time sampling the repeats of a record run one by one
+template <typename Addr>
+void replaySampled(BasicCache<Addr> *cache, SampledRun &run,
+                   const typename BasicCache<Addr>::Record *begin,
+                   const typename BasicCache<Addr>::Record *end) {
+  for (const typename BasicCache<Addr>::Record *r = begin; r != end; ++r) {
+    typename BasicCache<Addr>::Record record = *r;
+    uint32_t count = 1;
+    if (run.sampling.isTimeSampling()) {
+      count += r->getRepeat();
+      record.flags &= ~TraceBase::REPEAT_MASK;
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+      uint64_t index = run.index;
+      run.index += 1 + record.getRepeat();
+      if (run.sampling.getPhase(index) == Sampling::SKIP)
+        continue;
+      if (run.sampling.isMeasureBegin(index))
+        openWindow(cache, run);
+      accessRecord(cache, record);
+      if (run.sampling.isMeasureEnd(index))
+        closeWindow(cache, run);
+    }
+  }
+}
+
+// Runs a single trace record through the cache
+template <typename Addr>
+void accessRecord(BasicCache<Addr> *cache,
+                  const typename BasicCache<Addr>::Record &record) {
+  if (verbose)
+    printf("%c %llx\n", record.isWrite() ? 'w' : 'r',
+           (unsigned long long)record.addr);
+  cache->access(&record, &record + 1);
+
+  if (verbose)
+    cache->printInfo(true);
+
+  if (isSingleStep) {
+    printf("Press Enter to Continue...");
+    getchar();
+  }
+}
+
+// Remembers the counters at the start of a measure window
+template <typename Addr>
+void openWindow(BasicCache<Addr> *cache, SampledRun &run) {
+  run.inWindow = true;
+  run.windowBegin = cache->statistics;
+  if (setSampleRatio > 1) {
+    run.setBegin.resize(cache->getSetNum());
+    for (uint32_t id = 0; id < cache->getSetNum(); ++id) {
+      if (cache->isSetSampled(id))
+        run.setBegin[id] = cache->getSetStatistics(id);
+    }
+  }
+}
+
+// Adds the units of a finished measure window: one per sampled set with set
+// sampling, otherwise the window itself
+template <typename Addr>
+void closeWindow(BasicCache<Addr> *cache, SampledRun &run) {
+  run.inWindow = false;
+  const CacheBase::Statistics &stats = cache->statistics;
+  run.measuredCycles += stats.totalCycles - run.windowBegin.totalCycles;
+  if (setSampleRatio > 1) {
+    for (uint32_t id = 0; id < cache->getSetNum(); ++id) {
+      if (!cache->isSetSampled(id))
+        continue;
+      const CacheBase::SetStatistics &set = cache->getSetStatistics(id);
+      run.sampling.addUnit(set.numAccess - run.setBegin[id].numAccess,
+                           set.numMiss - run.setBegin[id].numMiss);
+    }
+  } else {
+    run.sampling.addUnit(
+        (stats.numRead + stats.numWrite) -
+            (run.windowBegin.numRead + run.windowBegin.numWrite),
+        stats.numMiss - run.windowBegin.numMiss);
+  }
+}
+
+// Checks if a number is a power of two
+bool isPowerOfTwo(uint32_t n) {
+  return n > 0 && (n & (n - 1)) == 0;
+}
+
+// Whether a configuration can be derived from a stack distance pass: the
+// analysis models LRU caches that allocate on write misses
+bool isStackEligible(const Sweep::Point &point) {
+  return point.replacement == ReplacementPolicy::LRU && point.writeAllocate;
+}
+
+// Analyses a group of configurations with the same block size and set count
+// in one stack distance pass over the trace
+template <typename Addr>
+void analyseGroup(const std::vector<Sweep::Point> &points,
+                  const std::vector<size_t> &group,
+                  std::vector<Sweep::Result> &results) {
+  const Sweep::Point &first = points[group[0]];
+  uint32_t maxAssociativity = 0;
+  for (size_t i : group) {
+    if (points[i].associativity > maxAssociativity)
+      maxAssociativity = points[i].associativity;
+  }
+
+  typedef typename BasicTrace<Addr>::Record Record;
+  CacheBase::Policy policy = CacheBase::Policy();
+  policy.cacheSize = first.cacheSize;
+  policy.blockSize = first.blockSize;
+  policy.blockNum = first.cacheSize / first.blockSize;
+  policy.associativity = first.associativity;
+  policy.hitLatency = first.hitLatency;
+  policy.missLatency = first.missLatency;
+  policy.replacement = ReplacementPolicy::LRU;
+
+  BasicStackDistance<Addr> analysis(policy, maxAssociativity);
+  if (isStreaming) {
+    BasicTraceReader<Addr> reader;
+    if (!reader.open(traceFilePath)) {
+      exit(-1);
+    }
+    const Record *begin, *end;
+    while (reader.next(begin, end)) {
+      for (const Record *r = begin; r != end; ++r)
+        analysis.access(r->addr, r->isWrite(), !r->isWriteback(),
+                        r->getRepeat());
+    }
+    if (reader.failed()) {
+      exit(-1);
+    }
+  } else {
+    const BasicTrace<Addr> &loaded = getTrace<Addr>();
+    for (const Record *r = loaded.begin(); r != loaded.end(); ++r)
+      analysis.access(r->addr, r->isWrite(), !r->isWriteback(),
+                      r->getRepeat());
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(outputMutex);
+    printf("Stack distance pass: block size %d bytes, %d sets, "
+           "%d configurations\n",
+           first.blockSize, policy.blockNum / policy.associativity,
+           (int)group.size());
+  }
+  for (size_t i : group) {
+    CacheBase::Statistics stats = analysis.getStatistics(
+        points[i].associativity, points[i].writeBack);
+    results[i].missRate =
+        (float)stats.numMiss / (stats.numHit + stats.numMiss);
+    results[i].missRateError = 0;
+    results[i].totalCycles = stats.totalCycles;
+  }
+}
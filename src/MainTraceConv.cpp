@@ -0,0 +1,294 @@
+/*
+ * Trace converter
+ * Turns a text memory trace ("r|w|i 0xADDR [core]" per line), optionally gzip
+ * or zstd compressed, into the binary trace format that CacheSingle and
+ * CacheMulti memory-map directly.
+ *
+ * Two pre-passes shrink the output for replay. With -d, back to back
+ * records with the same flags on the same granularity-sized block fold into
+ * the first of them with a repeat count, which a cache applies at once; the
+ * statistics are unchanged for caches whose blocks are at least that large,
+ * but the prefetchers see only the first address of a run, so use -d 1 to
+ * fold identical addresses only. With -l, records run through a fixed
+ * write-back, write-allocate LRU L1 and only what it sends below is kept:
+ * a read (or prefetch) per fill and a WRITE|WRITEBACK record per dirty
+ * eviction. Replaying that trace through the levels below the L1 gives
+ * their exact hit, miss and write-back counts, provided they are
+ * non-inclusive and have blocks at least as large as the L1's. Access
+ * timing and I-cache splits are not kept, and multi-core traces, which
+ * need an L1 per core, are refused
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "Cache.h"
+#include "MemoryManager.h"
+#include "Trace.h"
+#include "TraceReader.h"
+
+// Pre-passes requested on the command line
+struct Options {
+    uint32_t granularity;         // Block size that -d folds on, or 0
+    CacheBase::Policy filter;     // Geometry of the -l L1, cacheSize 0 if off
+    bool wide;                    // Text trace addresses are 64-bit
+};
+
+// Displays usage instructions for the program
+void printUsage() {
+    printf("Usage: TraceConvert [-w] [-d granularity] [-l size:block:ways] "
+           "trace-file[.gz|.zst] binary-trace-file\n");
+    printf("Parameters: -w 64-bit addresses in a text trace, which is "
+           "otherwise 32-bit unless its start shows wider ones, -d fold "
+           "back to back accesses to a block of granularity bytes into one "
+           "record with a repeat count, -l keep only the fills and "
+           "write-backs of a write-back LRU L1 of size bytes, block byte "
+           "blocks and ways ways\n");
+}
+
+// Streams the input into a binary trace of Addr-wide records
+template <typename Addr>
+int convert(const char *inPath, const char *outPath, const Options &options);
+
+int main(int argc, char **argv) {
+    Options options = Options();
+    int argi = 1;
+    for (; argi < argc && argv[argi][0] == '-' && argv[argi][1] != '\0';
+         ++argi) {
+        if (strcmp(argv[argi], "-w") == 0) {
+            options.wide = true;
+        } else if (strcmp(argv[argi], "-d") == 0 && argi + 1 < argc) {
+            options.granularity = strtoul(argv[++argi], nullptr, 10);
+            if (options.granularity == 0 ||
+                (options.granularity & (options.granularity - 1)) != 0) {
+                printf("Invalid granularity %s\n", argv[argi]);
+                return -1;
+            }
+        } else if (strcmp(argv[argi], "-l") == 0 && argi + 1 < argc) {
+            CacheBase::Policy &policy = options.filter;
+            unsigned size, block, ways;
+            if (sscanf(argv[++argi], "%u:%u:%u", &size, &block, &ways) != 3 ||
+                block == 0) {
+                printf("Invalid L1 geometry %s\n", argv[argi]);
+                return -1;
+            }
+            policy.cacheSize = size;
+            policy.blockSize = block;
+            policy.blockNum = size / block;
+            policy.associativity = ways;
+            policy.hitLatency = 1;
+            policy.missLatency = 0;
+            if (!CacheBase::isPolicyValid(policy)) {
+                return -1;
+            }
+        } else {
+            printUsage();
+            return -1;
+        }
+    }
+    if (argc - argi != 2) {
+        printUsage();
+        return -1;
+    }
+    const char *inPath = argv[argi];
+    const char *outPath = argv[argi + 1];
+
+    // Traces with addresses beyond 32 bits are converted to 64-bit records
+    uint16_t addrBits = TraceBase::getAddrBits(inPath, options.wide);
+    if (addrBits == 0) {
+        printf("Unable to open file %s\n", inPath);
+        return -1;
+    }
+    return addrBits == 64 ? convert<uint64_t>(inPath, outPath, options)
+                          : convert<uint32_t>(inPath, outPath, options);
+}
+
+// Writes records to the output file, folding each into the record before it
+// when -d allows, and counts what was written
+template <typename Addr>
+class RecordWriter {
+public:
+    typedef typename BasicTrace<Addr>::Record Record;
+
+    RecordWriter(FILE *out, uint32_t granularity)
+        : out(out), granularity(granularity), pending(false), ok(true),
+          recordCount(0), accessCount(0) {}
+
+    void write(const Record &record) {
+        accessCount += 1 + record.getRepeat();
+        if (pending && canFold(record)) {
+            last.flags +=
+                (1 + record.getRepeat()) << TraceBase::REPEAT_SHIFT;
+            return;
+        }
+        flush();
+        last = record;
+        pending = true;
+    }
+
+    // Writes out the record held back for folding
+    void flush() {
+        if (!pending)
+            return;
+        buffer.push_back(last);
+        pending = false;
+        if (buffer.size() >= OUTPUT_BATCH) writeBuffer();
+    }
+
+    // Flushes and writes out everything buffered, returning false if any
+    // write failed
+    bool finish() {
+        flush();
+        writeBuffer();
+        return ok;
+    }
+
+    uint64_t getRecordCount() const { return recordCount; }
+    uint64_t getAccessCount() const { return accessCount; }
+
+private:
+    static const size_t OUTPUT_BATCH = 1 << 16;
+
+    // Whether record can join last: same flags apart from the repeat
+    // count, same block and room left in the count
+    bool canFold(const Record &record) const {
+        if (granularity == 0)
+            return false;
+        uint32_t mask = ~TraceBase::REPEAT_MASK;
+        Addr blockMask = ~Addr(granularity - 1);
+        return (last.flags & mask) == (record.flags & mask) &&
+               (last.addr & blockMask) == (record.addr & blockMask) &&
+               last.getRepeat() + 1 + record.getRepeat() <=
+                   TraceBase::MAX_REPEAT;
+    }
+
+    void writeBuffer() {
+        if (ok && !buffer.empty()) {
+            ok = fwrite(buffer.data(), sizeof(Record), buffer.size(), out) ==
+                 buffer.size();
+        }
+        recordCount += buffer.size();
+        buffer.clear();
+    }
+
+    FILE *out;
+    uint32_t granularity;
+    Record last;                  // Record that may still fold, if pending
+    bool pending;
+    bool ok;
+    std::vector<Record> buffer;
+    uint64_t recordCount;         // Records written
+    uint64_t accessCount;         // Accesses written, counting repeats
+};
+
+template <typename Addr>
+int convert(const char *inPath, const char *outPath, const Options &options) {
+    typedef typename BasicTrace<Addr>::Record Record;
+
+    // Stream the input so traces larger than memory can be converted
+    BasicTraceReader<Addr> reader;
+    if (!reader.open(inPath)) {
+        return -1;
+    }
+    FILE *out = fopen(outPath, "wb");
+    if (out == nullptr) {
+        printf("Unable to open file %s\n", outPath);
+        return -1;
+    }
+
+    // The L1 of -l, timing-only. It reports its victims so the dirty one
+    // can be written back under its own address
+    BasicMemoryManager<Addr> *memory = nullptr;
+    BasicCache<Addr> *l1cache = nullptr;
+    if (options.filter.cacheSize != 0) {
+        memory = new BasicMemoryManager<Addr>();
+        l1cache = new BasicCache<Addr>(memory, options.filter, nullptr, true,
+                                       true, true);
+        l1cache->trackEvictions(true);
+        memory->setCache(l1cache);
+    }
+    std::vector<Addr> evictions;
+
+    // The header is rewritten with the final record count at the end
+    TraceBase::Header header;
+    BasicTrace<Addr>::initHeader(header, 0);
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+
+    RecordWriter<Addr> writer(out, options.granularity);
+    uint64_t inCount = 0;
+    bool multiCore = false;
+    const Record *begin, *end;
+    while (ok && !multiCore && reader.next(begin, end)) {
+        inCount += end - begin;
+        for (const Record *r = begin; r != end; ++r) {
+            if (l1cache == nullptr) {
+                writer.write(*r);
+                continue;
+            }
+            if (r->getCore() != 0) {
+                multiCore = true;
+                break;
+            }
+
+            // A fill is a miss or a prefetch fill; the fill goes below
+            // before the victim it makes room for, as in a hierarchy
+            const CacheBase::Statistics &stats = l1cache->statistics;
+            uint64_t fills = stats.numMiss + stats.numPrefetchFill;
+            uint64_t writebacks = stats.numWriteback;
+            Record single = *r;
+            single.flags &= TraceBase::WRITE | TraceBase::PREFETCH;
+            for (uint32_t i = 0; i <= r->getRepeat(); ++i) {
+                l1cache->access(&single, &single + 1);
+                l1cache->takeEvictions(evictions);
+                if (stats.numMiss + stats.numPrefetchFill != fills) {
+                    Record fill;
+                    fill.addr = single.addr &
+                                ~Addr(options.filter.blockSize - 1);
+                    fill.flags = single.flags & TraceBase::PREFETCH;
+                    writer.write(fill);
+                }
+                if (stats.numWriteback != writebacks) {
+                    Record writeback;
+                    writeback.addr = evictions.back();
+                    writeback.flags = TraceBase::WRITE | TraceBase::WRITEBACK;
+                    writer.write(writeback);
+                }
+                fills = stats.numMiss + stats.numPrefetchFill;
+                writebacks = stats.numWriteback;
+            }
+        }
+    }
+    delete l1cache;
+    delete memory;
+    if (multiCore) {
+        printf("An L1-filtered trace needs a single-core trace\n");
+    }
+    ok = writer.finish() && ok;
+    if (multiCore || reader.failed()) {
+        fclose(out);
+        return -1;
+    }
+
+    BasicTrace<Addr>::initHeader(header, writer.getRecordCount());
+    ok = ok && fseek(out, 0, SEEK_SET) == 0 &&
+         fwrite(&header, sizeof(header), 1, out) == 1;
+    ok = fclose(out) == 0 && ok;
+    if (!ok) {
+        printf("Unable to write file %s\n", outPath);
+        return -1;
+    }
+
+    printf("Converted %llu records from %s to %s\n",
+           (unsigned long long)inCount, inPath, outPath);
+    if (options.granularity != 0 || options.filter.cacheSize != 0) {
+        printf("Wrote %llu records for %llu accesses (%.1f%% of the input "
+               "records)\n",
+               (unsigned long long)writer.getRecordCount(),
+               (unsigned long long)writer.getAccessCount(),
+               inCount ? 100.0 * writer.getRecordCount() / inCount : 0.0);
+    }
+    return 0;
+}
@@ -3,141 +3,180 @@
  */
 
 #include "MemoryManager.h"
+#include "Checkpoint.h"
 #include "Debug.h"
 
+#include <algorithm>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
 #include <string>
 
-MemoryManager::MemoryManager() {
-  this->cache = nullptr;
-  for (uint32_t i = 0; i < 1024; ++i) {
-    this->memory[i] = nullptr;
-  }
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(MEMORY_NO_RESERVATION)
+#include <sys/mman.h>
+#define MEMORY_RESERVATION
+#endif
+
+// Size of the 32-bit address space and pages per arena of the hashed store
+static const uint64_t ADDRESS_SPACE = 1ull << 32;
+static const uint32_t ARENA_PAGES = 256;
+static const uint32_t INITIAL_PAGE_SLOTS = 1024;
+
+// Backs reads of pages the hashed store has never allocated
+static const uint8_t zeroPage[4096] = {0};
+
+// Multiplicative hashing of a page number onto a power of two table,
+// folding the well-mixed high bits into the slot index
+static inline uint32_t hashPage(uint64_t page, uint32_t mask) {
+  uint64_t h = page * 0x9e3779b97f4a7c15ull;
+  return (h ^ (h >> 32)) & mask;
 }
 
-MemoryManager::~MemoryManager() {
-  for (uint32_t i = 0; i < 1024; ++i) {
-    if (this->memory[i] != nullptr) {
-      for (uint32_t j = 0; j < 1024; ++j) {
-        if (this->memory[i][j] != nullptr) {
-          delete[] this->memory[i][j];
-          this->memory[i][j] = nullptr;
-        }
-      }
-      delete[] this->memory[i];
-      this->memory[i] = nullptr;
+template <typename Addr>
+BasicMemoryManager<Addr>::BasicMemoryManager() {
+  this->cache = nullptr;
+  this->flat = nullptr;
+  this->pageNum = 0;
+  this->arenaUsed = ARENA_PAGES;
+
+#ifdef MEMORY_RESERVATION
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+  flags |= MAP_NORESERVE;
+#endif
+  if (sizeof(Addr) == 4 && sizeof(void *) >= 8) {
+    void *p =
+        mmap(nullptr, ADDRESS_SPACE, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (p != MAP_FAILED) {
+      this->flat = (uint8_t *)p;
+      this->touched.assign(ADDRESS_SPACE / 4096 / 64, 0);
     }
   }
+#endif
+  if (this->flat == nullptr) {
+    this->pageTable.assign(INITIAL_PAGE_SLOTS, PageSlot{0, nullptr});
+  }
 }
 
-bool MemoryManager::addPage(uint32_t addr) {
-  uint32_t i = this->getFirstEntryId(addr);
-  uint32_t j = this->getSecondEntryId(addr);
-  if (this->memory[i] == nullptr) {
-    this->memory[i] = new uint8_t *[1024];
-    memset(this->memory[i], 0, sizeof(uint8_t *) * 1024);
+template <typename Addr>
+BasicMemoryManager<Addr>::~BasicMemoryManager() {
+#ifdef MEMORY_RESERVATION
+  if (this->flat != nullptr) {
+    munmap(this->flat, ADDRESS_SPACE);
+  }
+#endif
+  for (uint8_t *arena : this->arenas) {
+    free(arena);
   }
-  if (this->memory[i][j] == nullptr) {
-    this->memory[i][j] = new uint8_t[4096];
-    memset(this->memory[i][j], 0, 4096);
-  } else {
-    dbgprintf("Addr 0x%x already exists and do not need an addPage()!\n", addr);
+}
+
+template <typename Addr>
+bool BasicMemoryManager<Addr>::addPage(Addr addr) {
+  if (this->isPageExist(addr)) {
+    dbgprintf("Addr 0x%llx already exists and do not need an addPage()!\n",
+              (unsigned long long)addr);
     return false;
   }
+  this->getPage(addr);
   return true;
 }
 
-bool MemoryManager::isPageExist(uint32_t addr) {
-  return this->isAddrExist(addr);
+template <typename Addr>
+bool BasicMemoryManager<Addr>::isPageExist(Addr addr) {
+  Addr page = addr >> 12;
+  if (this->flat != nullptr) {
+    return (this->touched[page / 64] >> (page % 64)) & 1;
+  }
+  return this->lookupPage(page) != nullptr;
 }
 
-bool MemoryManager::copyFrom(const void *src, uint32_t dest, uint32_t len) {
+template <typename Addr>
+bool BasicMemoryManager<Addr>::copyFrom(const void *src, Addr dest,
+                                        uint32_t len) {
   for (uint32_t i = 0; i < len; ++i) {
-    if (!this->isAddrExist(dest + i)) {
-      dbgprintf("Data copy to invalid addr 0x%x!\n", dest + i);
-      return false;
-    }
     this->setByte(dest + i, ((uint8_t *)src)[i]);
   }
   return true;
 }
 
-bool MemoryManager::setByte(uint32_t addr, uint8_t val, uint32_t *cycles) {
-  if (!this->isAddrExist(addr)) {
-    dbgprintf("Byte write to invalid addr 0x%x!\n", addr);
-    return false;
-  }
+template <typename Addr>
+bool BasicMemoryManager<Addr>::setByte(Addr addr, uint8_t val,
+                                       uint32_t *cycles) {
   if (this->cache != nullptr) {
     this->cache->setByte(addr, val, cycles);
     return true;
   }
-
-  uint32_t i = this->getFirstEntryId(addr);
-  uint32_t j = this->getSecondEntryId(addr);
-  uint32_t k = this->getPageOffset(addr);
-  this->memory[i][j][k] = val;
+  this->getPage(addr)[this->getPageOffset(addr)] = val;
   return true;
 }
 
-bool MemoryManager::setByteNoCache(uint32_t addr, uint8_t val) {
-  if (!this->isAddrExist(addr)) {
-    dbgprintf("Byte write to invalid addr 0x%x!\n", addr);
-    return false;
-  }
-
-  uint32_t i = this->getFirstEntryId(addr);
-  uint32_t j = this->getSecondEntryId(addr);
-  uint32_t k = this->getPageOffset(addr);
-  this->memory[i][j][k] = val;
+template <typename Addr>
+bool BasicMemoryManager<Addr>::setByteNoCache(Addr addr, uint8_t val) {
+  this->getPage(addr)[this->getPageOffset(addr)] = val;
   return true;
 }
 
-uint8_t MemoryManager::getByte(uint32_t addr, uint32_t *cycles) {
-  if (!this->isAddrExist(addr)) {
-    dbgprintf("Byte read to invalid addr 0x%x!\n", addr);
-    return false;
-  }
+template <typename Addr>
+uint8_t BasicMemoryManager<Addr>::getByte(Addr addr, uint32_t *cycles) {
   if (this->cache != nullptr) {
     return this->cache->getByte(addr, cycles);
   }
-  uint32_t i = this->getFirstEntryId(addr);
-  uint32_t j = this->getSecondEntryId(addr);
-  uint32_t k = this->getPageOffset(addr);
-  return this->memory[i][j][k];
+  return this->findPage(addr)[this->getPageOffset(addr)];
 }
 
-uint8_t MemoryManager::getByteNoCache(uint32_t addr) {
-  if (!this->isAddrExist(addr)) {
-    dbgprintf("Byte read to invalid addr 0x%x!\n", addr);
-    return false;
+template <typename Addr>
+uint8_t BasicMemoryManager<Addr>::getByteNoCache(Addr addr) {
+  return this->findPage(addr)[this->getPageOffset(addr)];
+}
+
+// Block transfers for the lowest cache level, bypassing the cache
+template <typename Addr>
+bool BasicMemoryManager<Addr>::fillBlock(Addr addr, uint32_t size,
+                                         uint8_t *out) {
+  while (size > 0) {
+    uint32_t k = this->getPageOffset(addr);
+    uint32_t len = 4096 - k < size ? 4096 - k : size;
+    memcpy(out, this->findPage(addr) + k, len);
+    addr += len;
+    out += len;
+    size -= len;
   }
-  uint32_t i = this->getFirstEntryId(addr);
-  uint32_t j = this->getSecondEntryId(addr);
-  uint32_t k = this->getPageOffset(addr);
-  return this->memory[i][j][k];
+  return true;
 }
 
-bool MemoryManager::setShort(uint32_t addr, uint16_t val, uint32_t *cycles) {
-  if (!this->isAddrExist(addr)) {
-    dbgprintf("Short write to invalid addr 0x%x!\n", addr);
-    return false;
+template <typename Addr>
+bool BasicMemoryManager<Addr>::writebackBlock(Addr addr, uint32_t size,
+                                              const uint8_t *data) {
+  while (size > 0) {
+    uint32_t k = this->getPageOffset(addr);
+    uint32_t len = 4096 - k < size ? 4096 - k : size;
+    memcpy(this->getPage(addr) + k, data, len);
+    addr += len;
+    data += len;
+    size -= len;
   }
+  return true;
+}
+
+template <typename Addr>
+bool BasicMemoryManager<Addr>::setShort(Addr addr, uint16_t val,
+                                        uint32_t *cycles) {
   this->setByte(addr, val & 0xFF, cycles);
   this->setByte(addr + 1, (val >> 8) & 0xFF);
   return true;
 }
 
-uint16_t MemoryManager::getShort(uint32_t addr, uint32_t *cycles) {
+template <typename Addr>
+uint16_t BasicMemoryManager<Addr>::getShort(Addr addr, uint32_t *cycles) {
   uint32_t b1 = this->getByte(addr, cycles);
   uint32_t b2 = this->getByte(addr + 1);
   return b1 + (b2 << 8);
 }
 
-bool MemoryManager::setInt(uint32_t addr, uint32_t val, uint32_t *cycles) {
-  if (!this->isAddrExist(addr)) {
-    dbgprintf("Int write to invalid addr 0x%x!\n", addr);
-    return false;
-  }
+template <typename Addr>
+bool BasicMemoryManager<Addr>::setInt(Addr addr, uint32_t val,
+                                      uint32_t *cycles) {
   this->setByte(addr, val & 0xFF, cycles);
   this->setByte(addr + 1, (val >> 8) & 0xFF);
   this->setByte(addr + 2, (val >> 16) & 0xFF);
@@ -145,7 +184,8 @@ bool MemoryManager::setInt(uint32_t addr, uint32_t val, uint32_t *cycles) {
   return true;
 }
 
-uint32_t MemoryManager::getInt(uint32_t addr, uint32_t *cycles) {
+template <typename Addr>
+uint32_t BasicMemoryManager<Addr>::getInt(Addr addr, uint32_t *cycles) {
   uint32_t b1 = this->getByte(addr, cycles);
   uint32_t b2 = this->getByte(addr + 1);
   uint32_t b3 = this->getByte(addr + 2);
@@ -153,11 +193,9 @@ uint32_t MemoryManager::getInt(uint32_t addr, uint32_t *cycles) {
   return b1 + (b2 << 8) + (b3 << 16) + (b4 << 24);
 }
 
-bool MemoryManager::setLong(uint32_t addr, uint64_t val, uint32_t *cycles) {
-  if (!this->isAddrExist(addr)) {
-    dbgprintf("Long write to invalid addr 0x%x!\n", addr);
-    return false;
-  }
+template <typename Addr>
+bool BasicMemoryManager<Addr>::setLong(Addr addr, uint64_t val,
+                                       uint32_t *cycles) {
   this->setByte(addr, val & 0xFF, cycles);
   this->setByte(addr + 1, (val >> 8) & 0xFF);
   this->setByte(addr + 2, (val >> 16) & 0xFF);
@@ -169,7 +207,8 @@ bool MemoryManager::setLong(uint32_t addr, uint64_t val, uint32_t *cycles) {
   return true;
 }
 
-uint64_t MemoryManager::getLong(uint32_t addr, uint32_t *cycles) {
+template <typename Addr>
+uint64_t BasicMemoryManager<Addr>::getLong(Addr addr, uint32_t *cycles) {
   uint64_t b1 = this->getByte(addr, cycles);
   uint64_t b2 = this->getByte(addr + 1);
   uint64_t b3 = this->getByte(addr + 2);
@@ -182,74 +221,239 @@ uint64_t MemoryManager::getLong(uint32_t addr, uint32_t *cycles) {
          (b7 << 48) + (b8 << 56);
 }
 
-void MemoryManager::printInfo() {
+template <typename Addr>
+void BasicMemoryManager<Addr>::printInfo() {
   printf("Memory Pages: \n");
-  for (uint32_t i = 0; i < 1024; ++i) {
-    if (this->memory[i] == nullptr) {
-      continue;
-    }
-    printf("0x%x-0x%x:\n", i << 22, (i + 1) << 22);
-    for (uint32_t j = 0; j < 1024; ++j) {
-      if (this->memory[i][j] == nullptr) {
-        continue;
-      }
-      printf("  0x%x-0x%x\n", (i << 22) + (j << 12),
-             (i << 22) + ((j + 1) << 12));
+  std::vector<Addr> pages = this->getPages();
+  for (size_t n = 0; n < pages.size(); ++n) {
+    Addr region = pages[n] >> 10;
+    if (n == 0 || region != pages[n - 1] >> 10) {
+      printf("0x%llx-0x%llx:\n", (unsigned long long)(region << 22),
+             (unsigned long long)Addr((region + 1) << 22));
     }
+    printf("  0x%llx-0x%llx\n", (unsigned long long)(pages[n] << 12),
+           (unsigned long long)Addr((pages[n] + 1) << 12));
   }
 }
 
-void MemoryManager::printStatistics() {
+template <typename Addr>
+void BasicMemoryManager<Addr>::printStatistics() {
   printf("---------- CACHE STATISTICS ----------\n");
   this->cache->printStatistics();
 }
 
-std::string MemoryManager::dumpMemory() {
+template <typename Addr>
+std::string BasicMemoryManager<Addr>::dumpMemory() {
   char buf[65536];
   std::string dump;
 
   dump += "Memory Pages: \n";
-  for (uint32_t i = 0; i < 1024; ++i) {
-    if (this->memory[i] == nullptr) {
-      continue;
+  std::vector<Addr> pages = this->getPages();
+  for (size_t n = 0; n < pages.size(); ++n) {
+    Addr region = pages[n] >> 10;
+    if (n == 0 || region != pages[n - 1] >> 10) {
+      sprintf(buf, "0x%llx-0x%llx:\n", (unsigned long long)(region << 22),
+              (unsigned long long)Addr((region + 1) << 22));
+      dump += buf;
     }
-    sprintf(buf, "0x%x-0x%x:\n", i << 22, (i + 1) << 22);
+    Addr addr = pages[n] << 12;
+    sprintf(buf, "  0x%llx-0x%llx\n", (unsigned long long)addr,
+            (unsigned long long)Addr(addr + 4096));
     dump += buf;
-    for (uint32_t j = 0; j < 1024; ++j) {
-      if (this->memory[i][j] == nullptr) {
-        continue;
-      }
-      sprintf(buf, "  0x%x-0x%x\n", (i << 22) + (j << 12),
-              (i << 22) + ((j + 1) << 12));
+
+    const uint8_t *page = this->findPage(addr);
+    for (uint32_t k = 0; k < 1024; ++k) {
+      sprintf(buf, "    0x%llx: 0x%x\n", (unsigned long long)(addr + k),
+              page[k]);
       dump += buf;
+    }
+  }
+  return dump;
+}
+
+// Appends the page count, then the number and contents of every page
+template <typename Addr>
+void BasicMemoryManager<Addr>::saveState(std::vector<uint8_t> &out) {
+  std::vector<Addr> pages = this->getPages();
+  uint64_t pageCount = pages.size();
+  CheckpointBase::append(out, &pageCount, sizeof(pageCount));
+  for (Addr page : pages) {
+    CheckpointBase::append(out, &page, sizeof(page));
+    CheckpointBase::append(out, this->findPage(page << 12), 4096);
+  }
+}
 
-      for (uint32_t k = 0; k < 1024; ++k) {
-        sprintf(buf, "    0x%x: 0x%x\n", (i << 22) + (j << 12) + k,
-                this->memory[i][j][k]);
-        dump += buf;
+// Stores the pages of a checkpoint
+template <typename Addr>
+bool BasicMemoryManager<Addr>::restoreState(const uint8_t *&p,
+                                            const uint8_t *end) {
+  uint64_t pageCount;
+  if (!CheckpointBase::read(p, end, &pageCount, sizeof(pageCount))) {
+    return false;
+  }
+  for (uint64_t n = 0; n < pageCount; ++n) {
+    Addr page;
+    if (!CheckpointBase::read(p, end, &page, sizeof(page)) ||
+        !CheckpointBase::read(p, end, this->getPage(page << 12), 4096)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Copies the file data of every loadable segment into memory; the rest of
+// each segment reads as zero like all untouched memory
+template <typename Addr>
+bool BasicMemoryManager<Addr>::loadElf(const char *path, Addr &entry) {
+  ELFIO::elfio reader;
+  if (!reader.load(path)) {
+    printf("Unable to load ELF file %s\n", path);
+    return false;
+  }
+
+  uint64_t limit = sizeof(Addr) < 8 ? (1ull << (sizeof(Addr) * 8)) - 1
+                                    : ~0ull;
+  for (const ELFIO::segment *segment : reader.segments) {
+    if (segment->get_type() != PT_LOAD) {
+      continue;
+    }
+    uint64_t begin = segment->get_virtual_address();
+    uint64_t memorySize = segment->get_memory_size();
+    uint64_t fileSize = segment->get_file_size();
+    if (memorySize == 0) {
+      continue;
+    }
+    if (begin > limit || memorySize - 1 > limit - begin ||
+        fileSize > memorySize) {
+      printf("Segment at 0x%llx of %s does not fit %d-bit addresses\n",
+             (unsigned long long)begin, path, int(sizeof(Addr) * 8));
+      return false;
+    }
+    for (uint64_t page = begin >> 12; page <= (begin + memorySize - 1) >> 12;
+         ++page) {
+      if (!this->isPageExist(Addr(page << 12))) {
+        this->addPage(Addr(page << 12));
       }
     }
+    if (fileSize > 0 && segment->get_data() != nullptr) {
+      this->copyFrom(segment->get_data(), Addr(begin), uint32_t(fileSize));
+    }
   }
-  return dump;
+
+  if (reader.get_entry() > limit) {
+    printf("Entry point of %s does not fit %d-bit addresses\n", path,
+           int(sizeof(Addr) * 8));
+    return false;
+  }
+  entry = Addr(reader.get_entry());
+  return true;
+}
+
+template <typename Addr>
+uint32_t BasicMemoryManager<Addr>::getPageOffset(Addr addr) {
+  return addr & 0xFFF;
 }
 
-uint32_t MemoryManager::getFirstEntryId(uint32_t addr) {
-  return (addr >> 22) & 0x3FF;
+// Page numbers of the pages added or written, in address order
+template <typename Addr>
+std::vector<Addr> BasicMemoryManager<Addr>::getPages() {
+  std::vector<Addr> pages;
+  if (this->flat != nullptr) {
+    for (size_t w = 0; w < this->touched.size(); ++w) {
+      for (uint64_t bits = this->touched[w]; bits != 0; bits &= bits - 1) {
+        pages.push_back(w * 64 + __builtin_ctzll(bits));
+      }
+    }
+    return pages;
+  }
+  for (const PageSlot &slot : this->pageTable) {
+    if (slot.data != nullptr) {
+      pages.push_back(slot.page);
+    }
+  }
+  std::sort(pages.begin(), pages.end());
+  return pages;
 }
 
-uint32_t MemoryManager::getSecondEntryId(uint32_t addr) {
-  return (addr >> 12) & 0x3FF;
+// Page holding addr for a write, allocated on first use
+template <typename Addr>
+uint8_t *BasicMemoryManager<Addr>::getPage(Addr addr) {
+  Addr page = addr >> 12;
+  if (this->flat != nullptr) {
+    this->touched[page / 64] |= 1ull << (page % 64);
+    return this->flat + (addr & ~Addr(0xFFF));
+  }
+  uint8_t *data = this->lookupPage(page);
+  return data != nullptr ? data : this->allocatePage(page);
 }
 
-uint32_t MemoryManager::getPageOffset(uint32_t addr) { return addr & 0xFFF; }
+// Page holding addr for a read; pages never written read as 0
+template <typename Addr>
+const uint8_t *BasicMemoryManager<Addr>::findPage(Addr addr) {
+  if (this->flat != nullptr) {
+    return this->flat + (addr & ~Addr(0xFFF));
+  }
+  uint8_t *data = this->lookupPage(addr >> 12);
+  return data != nullptr ? data : zeroPage;
+}
 
-bool MemoryManager::isAddrExist(uint32_t addr) {
-  uint32_t i = this->getFirstEntryId(addr);
-  uint32_t j = this->getSecondEntryId(addr);
-  if (memory[i] && memory[i][j]) {
-    return true;
+// Finds a page of the hashed store, nullptr if it was never allocated
+template <typename Addr>
+uint8_t *BasicMemoryManager<Addr>::lookupPage(Addr page) {
+  uint32_t mask = this->pageTable.size() - 1;
+  for (uint32_t i = hashPage(page, mask);; i = (i + 1) & mask) {
+    const PageSlot &slot = this->pageTable[i];
+    if (slot.data == nullptr || slot.page == page) {
+      return slot.data;
+    }
   }
-  return false;
 }
 
-void MemoryManager::setCache(Cache *cache) { this->cache = cache; }
+// Takes a zeroed page from the current arena and enters it into the hash
+// table, which is kept at most half full. Running out of memory throws, as
+// the page allocation with new did
+template <typename Addr>
+uint8_t *BasicMemoryManager<Addr>::allocatePage(Addr page) {
+  if (this->arenaUsed == ARENA_PAGES) {
+    uint8_t *arena = (uint8_t *)calloc(ARENA_PAGES, 4096);
+    if (arena == nullptr) {
+      throw std::bad_alloc();
+    }
+    this->arenas.push_back(arena);
+    this->arenaUsed = 0;
+  }
+  uint8_t *data = this->arenas.back() + (this->arenaUsed++) * 4096;
+
+  if ((this->pageNum + 1) * 2 > this->pageTable.size()) {
+    std::vector<PageSlot> old(this->pageTable.size() * 2, PageSlot{0, nullptr});
+    old.swap(this->pageTable);
+    uint32_t mask = this->pageTable.size() - 1;
+    for (const PageSlot &slot : old) {
+      if (slot.data == nullptr) {
+        continue;
+      }
+      uint32_t i = hashPage(slot.page, mask);
+      while (this->pageTable[i].data != nullptr) {
+        i = (i + 1) & mask;
+      }
+      this->pageTable[i] = slot;
+    }
+  }
+
+  uint32_t mask = this->pageTable.size() - 1;
+  uint32_t i = hashPage(page, mask);
+  while (this->pageTable[i].data != nullptr) {
+    i = (i + 1) & mask;
+  }
+  this->pageTable[i] = PageSlot{page, data};
+  this->pageNum++;
+  return data;
+}
+
+template <typename Addr>
+void BasicMemoryManager<Addr>::setCache(BasicCache<Addr> *cache) {
+  this->cache = cache;
+}
+
+template class BasicMemoryManager<uint32_t>;
+template class BasicMemoryManager<uint64_t>;
@@ -8,53 +8,114 @@
 
 #include <cstdint>
 #include <cstdio>
+#include <string>
+#include <vector>
+#ifdef CACHESIM_PROFILE
+#include <unordered_map>
+#endif
 
 #include <elfio/elfio.hpp>
 
 #include "Cache.h"
 
-class Cache;
+template <typename Addr>
+class BasicCache;
 
-class MemoryManager
+// Byte-addressed memory of Addr-wide addresses; MemoryManager and
+// MemoryManager64 below
+template <typename Addr>
+class BasicMemoryManager
 {
 public:
-  MemoryManager();
-  ~MemoryManager();
+  BasicMemoryManager();
+  ~BasicMemoryManager();
 
-  bool addPage(uint32_t addr);
-  bool isPageExist(uint32_t addr);
+  BasicMemoryManager(const BasicMemoryManager &) = delete;
+  BasicMemoryManager &operator=(const BasicMemoryManager &) = delete;
 
-  bool copyFrom(const void *src, uint32_t dest, uint32_t len);
+  // Pages exist on demand; addPage() and isPageExist() only mark and query
+  // the pages listed by printInfo() and dumpMemory()
+  bool addPage(Addr addr);
+  bool isPageExist(Addr addr);
 
-  bool setByte(uint32_t addr, uint8_t val, uint32_t *cycles = nullptr);
-  bool setByteNoCache(uint32_t addr, uint8_t val);
-  uint8_t getByte(uint32_t addr, uint32_t *cycles = nullptr);
-  uint8_t getByteNoCache(uint32_t addr);
+  bool copyFrom(const void *src, Addr dest, uint32_t len);
 
-  bool setShort(uint32_t addr, uint16_t val, uint32_t *cycles = nullptr);
-  uint16_t getShort(uint32_t addr, uint32_t *cycles = nullptr);
+  // Loads the segments of an ELF executable at their virtual addresses and
+  // returns its entry point; load it before setCache() so the image goes
+  // to memory and not through the caches. False if the file is no ELF
+  // file or does not fit Addr-wide addresses
+  bool loadElf(const char *path, Addr &entry);
 
-  bool setInt(uint32_t addr, uint32_t val, uint32_t *cycles = nullptr);
-  uint32_t getInt(uint32_t addr, uint32_t *cycles = nullptr);
+  bool setByte(Addr addr, uint8_t val, uint32_t *cycles = nullptr);
+  bool setByteNoCache(Addr addr, uint8_t val);
+  uint8_t getByte(Addr addr, uint32_t *cycles = nullptr);
+  uint8_t getByteNoCache(Addr addr);
+  bool fillBlock(Addr addr, uint32_t size, uint8_t *out);
+  bool writebackBlock(Addr addr, uint32_t size, const uint8_t *data);
 
-  bool setLong(uint32_t addr, uint64_t val, uint32_t *cycles = nullptr);
-  uint64_t getLong(uint32_t addr, uint32_t *cycles = nullptr);
+  bool setShort(Addr addr, uint16_t val, uint32_t *cycles = nullptr);
+  uint16_t getShort(Addr addr, uint32_t *cycles = nullptr);
+
+  bool setInt(Addr addr, uint32_t val, uint32_t *cycles = nullptr);
+  uint32_t getInt(Addr addr, uint32_t *cycles = nullptr);
+
+  bool setLong(Addr addr, uint64_t val, uint32_t *cycles = nullptr);
+  uint64_t getLong(Addr addr, uint32_t *cycles = nullptr);
 
   void printInfo();
   void printStatistics();
 
   std::string dumpMemory();
 
-  void setCache(Cache *cache);  
+  // Checkpoint support: appends every page written so far with its page
+  // number, and stores such pages back, advancing p; false if the buffer
+  // ends first
+  void saveState(std::vector<uint8_t> &out);
+  bool restoreState(const uint8_t *&p, const uint8_t *end);
 
-private:
-  uint32_t getFirstEntryId(uint32_t addr);
-  uint32_t getSecondEntryId(uint32_t addr);
-  uint32_t getPageOffset(uint32_t addr);
-  bool isAddrExist(uint32_t addr);
+  void setCache(BasicCache<Addr> *cache);
 
-  uint8_t **memory[1024];
-  Cache *cache;
+#ifdef CACHESIM_PROFILE
+  // Blocks the last cache level read from memory, demand and prefetch, per
+  // page number. Counted in timing-only runs too, which move no data
+  void countMiss(Addr addr) { this->pageMisses[addr >> 12]++; }
+  const std::unordered_map<Addr, uint64_t> &getPageMisses() const {
+    return this->pageMisses;
+  }
+#endif
+
+private:
+  // Page store with demand-zero semantics: memory that was never written
+  // reads as 0, so callers need not add pages before accessing them. The
+  // 32-bit space is a single lazily backed reservation where the OS
+  // provides one. Elsewhere, and for 64-bit addresses, pages come from
+  // arenas through a hash table keyed by page number, so memory grows with
+  // the pages touched and not with the address space
+  struct PageSlot {
+    Addr page;                 // Page number, addr >> 12
+    uint8_t *data;             // Page in an arena, nullptr if the slot is free
+  };
+
+  uint32_t getPageOffset(Addr addr);
+  std::vector<Addr> getPages();
+  uint8_t *getPage(Addr addr);
+  const uint8_t *findPage(Addr addr);
+  uint8_t *lookupPage(Addr page);
+  uint8_t *allocatePage(Addr page);
+
+  uint8_t *flat;                       // 4 GB reservation, or nullptr
+  std::vector<uint64_t> touched;       // Pages added or written, if flat
+  std::vector<PageSlot> pageTable;     // Power of two slots, at most half used
+  uint32_t pageNum;                    // Used slots
+  std::vector<uint8_t *> arenas;       // ARENA_PAGES zeroed pages each
+  uint32_t arenaUsed;                  // Pages handed out from the last arena
+  BasicCache<Addr> *cache;
+#ifdef CACHESIM_PROFILE
+  std::unordered_map<Addr, uint64_t> pageMisses;
+#endif
 };
 
-#endif
\ No newline at end of file
+typedef BasicMemoryManager<uint32_t> MemoryManager;
+typedef BasicMemoryManager<uint64_t> MemoryManager64;
+
+#endif
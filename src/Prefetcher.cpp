@@ -0,0 +1,305 @@
+/*
+ * Implementation of the cache prefetchers
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include "Prefetcher.h"
+
+// Integer log base 2 of a power of two
+static uint32_t log2i(uint32_t val) {
+    uint32_t bits = 0;
+    while (val >>= 1)
+        ++bits;
+    return bits;
+}
+
+// Stride table without PCs: an access belongs to the stream whose last
+// address is closest to it, within WINDOW blocks, or else replaces the
+// least recently used stream. A stream prefetches once it has seen the same
+// stride three times in a row. Strides below the block size advance one
+// block per prefetch, so small strides still run ahead of the demand
+class StridePrefetcher : public Prefetcher {
+public:
+    StridePrefetcher(uint32_t blockSize, uint32_t degree)
+        : Prefetcher(blockSize, degree), counter(0), streams(STREAMS) {
+        memset(streams.data(), 0, STREAMS * sizeof(Stream));
+    }
+
+    void onAccess(uint64_t addr, bool, bool,
+                  std::vector<uint64_t> &out) override {
+        uint64_t window = uint64_t(WINDOW) << blockBits;
+        Stream *s = nullptr;
+        Stream *lru = &streams[0];
+        uint64_t best = window + 1;
+        for (Stream &stream : streams) {
+            uint64_t distance = addr > stream.last ? addr - stream.last
+                                                   : stream.last - addr;
+            if (stream.valid && distance < best) {
+                best = distance;
+                s = &stream;
+            }
+            if (!stream.valid || (lru->valid && stream.stamp < lru->stamp))
+                lru = &stream;
+        }
+        if (s == nullptr) {
+            *lru = Stream{addr, 0, 0, ++counter, true};
+            return;
+        }
+        s->stamp = ++counter;
+        int64_t stride = int64_t(addr - s->last);
+        if (stride == 0)
+            return;
+        s->last = addr;
+        if (stride == s->stride) {
+            if (s->confidence < 3) s->confidence++;
+        } else if (s->confidence > 0) {
+            s->confidence--;
+        } else {
+            s->stride = stride;
+        }
+        if (s->confidence < 2)
+            return;
+
+        int64_t step = s->stride;
+        if (step > -int64_t(blockSize) && step < int64_t(blockSize))
+            step = step > 0 ? int64_t(blockSize) : -int64_t(blockSize);
+        for (uint32_t k = 1; k <= degree; ++k) {
+            out.push_back(addr + uint64_t(step * k));
+        }
+    }
+
+    Type getType() const override { return STRIDE; }
+
+private:
+    static const uint32_t STREAMS = 16;
+    static const uint32_t WINDOW = 16;
+
+    struct Stream {
+        uint64_t last;              // Last address of the stream
+        int64_t stride;             // Stride being confirmed or followed
+        uint32_t confidence;        // Repeats of the stride, saturating at 3
+        uint64_t stamp;             // Last use, for replacement
+        bool valid;
+    };
+
+    uint64_t counter;               // Access counter for the stamps
+    std::vector<Stream> streams;
+};
+
+// Tagged next-line: a miss, or the first use of a prefetched block,
+// prefetches the blocks that follow it
+class NextLinePrefetcher : public Prefetcher {
+public:
+    NextLinePrefetcher(uint32_t blockSize, uint32_t degree)
+        : Prefetcher(blockSize, degree) {}
+
+    void onAccess(uint64_t addr, bool miss, bool prefetchHit,
+                  std::vector<uint64_t> &out) override {
+        if (!miss && !prefetchHit)
+            return;
+        uint64_t block = addr >> blockBits;
+        for (uint32_t k = 1; k <= degree; ++k) {
+            out.push_back((block + k) << blockBits);
+        }
+    }
+
+    Type getType() const override { return NEXT_LINE; }
+};
+
+// Sequential stream buffers in the style of Jouppi, except that the
+// prefetched blocks go into the cache instead of a buffer beside it. A miss
+// outside every stream allocates the least recently used one, which then
+// keeps degree blocks fetched ahead of the demand accesses into it; the
+// first uses of prefetched blocks count as accesses into the stream
+class StreamPrefetcher : public Prefetcher {
+public:
+    StreamPrefetcher(uint32_t blockSize, uint32_t degree)
+        : Prefetcher(blockSize, degree), counter(0), streams(STREAMS) {
+        memset(streams.data(), 0, STREAMS * sizeof(Stream));
+    }
+
+    void onAccess(uint64_t addr, bool miss, bool prefetchHit,
+                  std::vector<uint64_t> &out) override {
+        if (!miss && !prefetchHit)
+            return;
+        uint64_t block = addr >> blockBits;
+        Stream *s = nullptr;
+        Stream *lru = &streams[0];
+        for (Stream &stream : streams) {
+            if (stream.valid && block >= stream.front && block < stream.end)
+                s = &stream;
+            if (!stream.valid || (lru->valid && stream.stamp < lru->stamp))
+                lru = &stream;
+        }
+        if (s == nullptr) {
+            s = lru;
+            *s = Stream{block + 1, block + 1, 0, true};
+        }
+        s->stamp = ++counter;
+        s->front = block + 1;
+        for (; s->end < block + 1 + degree; ++s->end) {
+            out.push_back(s->end << blockBits);
+        }
+    }
+
+    Type getType() const override { return STREAM; }
+
+private:
+    static const uint32_t STREAMS = 4;
+
+    struct Stream {
+        uint64_t front;             // Next block expected to be accessed
+        uint64_t end;               // Next block to prefetch
+        uint64_t stamp;             // Last use, for replacement
+        bool valid;
+    };
+
+    uint64_t counter;               // Trigger counter for the stamps
+    std::vector<Stream> streams;
+};
+
+// Global history buffer with delta correlation (G/DC, Nesbit and Smith).
+// The miss stream, with first uses of prefetched blocks counted as the
+// misses they replaced, goes into a circular history buffer. An index table
+// keyed by the last two block deltas points to their previous occurrence,
+// and the deltas that followed it are replayed from the current block
+class DeltaPrefetcher : public Prefetcher {
+public:
+    DeltaPrefetcher(uint32_t blockSize, uint32_t degree)
+        : Prefetcher(blockSize, degree), count(0), history(HISTORY, 0),
+          index(INDEX) {
+        memset(index.data(), 0, INDEX * sizeof(IndexEntry));
+    }
+
+    void onAccess(uint64_t addr, bool miss, bool prefetchHit,
+                  std::vector<uint64_t> &out) override {
+        if (!miss && !prefetchHit)
+            return;
+        uint64_t pos = count++;
+        history[pos % HISTORY] = addr >> blockBits;
+        if (pos < 2)
+            return;
+
+        uint64_t delta1 = at(pos) - at(pos - 1);
+        uint64_t delta2 = at(pos - 1) - at(pos - 2);
+        IndexEntry &entry = index[hashDeltas(delta1, delta2) % INDEX];
+        if (entry.valid && entry.delta1 == delta1 && entry.delta2 == delta2 &&
+            pos - entry.pos < HISTORY - 1) {
+            uint64_t block = at(pos);
+            for (uint64_t p = entry.pos + 1;
+                 p <= pos && p <= entry.pos + degree; ++p) {
+                block += at(p) - at(p - 1);
+                out.push_back(block << blockBits);
+            }
+        }
+        entry = IndexEntry{delta1, delta2, pos, true};
+    }
+
+    Type getType() const override { return DELTA; }
+
+private:
+    static const uint32_t HISTORY = 256;
+    static const uint32_t INDEX = 256;
+
+    struct IndexEntry {
+        uint64_t delta1;            // Latest delta of the pair
+        uint64_t delta2;            // Delta before it
+        uint64_t pos;               // History position after the pair
+        bool valid;
+    };
+
+    // Block at a history position still in the buffer
+    uint64_t at(uint64_t pos) const { return history[pos % HISTORY]; }
+
+    static uint64_t hashDeltas(uint64_t delta1, uint64_t delta2) {
+        return ((delta1 * 0x9e3779b97f4a7c15ull) ^ delta2) >> 17;
+    }
+
+    uint64_t count;                 // Misses pushed so far
+    std::vector<uint64_t> history;  // Circular buffer of missed blocks
+    std::vector<IndexEntry> index;  // Last occurrence of each delta pair
+};
+
+// Default prefetch degree and name, indexed by Type
+static const uint32_t defaultDegrees[] = {2, 1, 4, 4};
+static const char *const prefetcherNames[] = {
+    "stride", "nextline", "stream", "delta",
+};
+
+Prefetcher::Prefetcher(uint32_t blockSize, uint32_t degree)
+    : statistics(Statistics{0, 0, 0, 0, 0, 0}), blockSize(blockSize),
+      blockBits(log2i(blockSize)), degree(degree) {}
+
+// Useful over issued prefetches
+double Prefetcher::getAccuracy() const {
+    return statistics.numIssued == 0
+               ? 0.0
+               : double(statistics.numUseful) / statistics.numIssued;
+}
+
+// Misses removed by useful prefetches over the misses without them
+double Prefetcher::getCoverage() const {
+    uint64_t misses = statistics.numUseful + statistics.numMiss;
+    return misses == 0 ? 0.0 : double(statistics.numUseful) / misses;
+}
+
+// Useful prefetches that arrived in time
+double Prefetcher::getTimeliness() const {
+    return statistics.numUseful == 0
+               ? 0.0
+               : double(statistics.numUseful - statistics.numLate) /
+                     statistics.numUseful;
+}
+
+// Displays the prefetcher type and its statistics
+void Prefetcher::printStatistics(FILE *out) const {
+    fprintf(out, "Prefetcher: %s, degree %d\n", getName(getType()), degree);
+    fprintf(out, "Prefetches Issued: %llu\n",
+            (unsigned long long)statistics.numIssued);
+    fprintf(out, "Useful Prefetches: %llu\n",
+            (unsigned long long)statistics.numUseful);
+    fprintf(out, "Late Prefetches: %llu\n",
+            (unsigned long long)statistics.numLate);
+    fprintf(out, "Unused Prefetches: %llu\n",
+            (unsigned long long)statistics.numUnused);
+    fprintf(out, "Prefetch Accuracy: %.2f%%\n", getAccuracy() * 100);
+    fprintf(out, "Prefetch Coverage: %.2f%%\n", getCoverage() * 100);
+    fprintf(out, "Prefetch Timeliness: %.2f%%\n", getTimeliness() * 100);
+}
+
+// Creates a prefetcher for a cache with the given block size
+Prefetcher *Prefetcher::create(Type type, uint32_t blockSize,
+                               uint32_t degree) {
+    if (degree == 0)
+        degree = defaultDegrees[type];
+    switch (type) {
+    case STRIDE:
+        return new StridePrefetcher(blockSize, degree);
+    case NEXT_LINE:
+        return new NextLinePrefetcher(blockSize, degree);
+    case STREAM:
+        return new StreamPrefetcher(blockSize, degree);
+    case DELTA:
+        return new DeltaPrefetcher(blockSize, degree);
+    }
+    return nullptr;
+}
+
+// Returns the name of a prefetcher type
+const char *Prefetcher::getName(Type type) {
+    return prefetcherNames[type];
+}
+
+// Looks up a prefetcher type by name
+bool Prefetcher::parseName(const char *name, Type &type) {
+    for (uint32_t i = 0;
+         i < sizeof(prefetcherNames) / sizeof(prefetcherNames[0]); ++i) {
+        if (strcmp(name, prefetcherNames[i]) == 0) {
+            type = static_cast<Type>(i);
+            return true;
+        }
+    }
+    return false;
+}
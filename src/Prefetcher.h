@@ -0,0 +1,76 @@
+/*
+ * Hardware prefetchers that attach to a cache level
+ * A prefetcher observes the demand accesses to its level, none of which
+ * carry a PC, and names the addresses it expects to be accessed next. The
+ * cache fills the blocks that are not already present and keeps the usage
+ * counters of the prefetched blocks in the prefetcher's statistics
+ */
+
+#ifndef PREFETCHER_H
+#define PREFETCHER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+class Prefetcher {
+public:
+    enum Type {
+        STRIDE,     // Multi-stream stride table matched by address proximity
+        NEXT_LINE,  // Tagged next-line: the blocks after a miss
+        STREAM,     // Sequential stream buffers allocated on misses
+        DELTA,      // Global history buffer with delta correlation (G/DC)
+    };
+
+    // Prefetch counters, kept by the cache the prefetcher is attached to
+    struct Statistics {
+        uint64_t numAccess;     // Demand accesses observed
+        uint64_t numMiss;       // Demand misses left
+        uint64_t numIssued;     // Prefetches that filled a block
+        uint64_t numUseful;     // Prefetched blocks hit by a demand access
+        uint64_t numLate;       // Useful prefetches used too soon after
+                                // their fill to hide its latency
+        uint64_t numUnused;     // Prefetched blocks evicted before any use
+    };
+
+    Prefetcher(uint32_t blockSize, uint32_t degree);
+    virtual ~Prefetcher() {}
+
+    // Observes a demand access to addr. miss tells whether it missed, and
+    // prefetchHit whether it was the first use of a prefetched block.
+    // Appends the addresses to prefetch to out
+    virtual void onAccess(uint64_t addr, bool miss, bool prefetchHit,
+                          std::vector<uint64_t> &out) = 0;
+
+    // Type and prefetch degree (blocks requested per trigger)
+    virtual Type getType() const = 0;
+    uint32_t getDegree() const { return degree; }
+
+    // Useful over issued prefetches, misses removed over the misses there
+    // would have been, and useful prefetches that were not late
+    double getAccuracy() const;
+    double getCoverage() const;
+    double getTimeliness() const;
+
+    // Prints the prefetcher type and its statistics
+    void printStatistics(FILE *out) const;
+
+    // Creates a prefetcher for a cache with the given block size. A degree
+    // of 0 picks the default of the type
+    static Prefetcher *create(Type type, uint32_t blockSize,
+                              uint32_t degree = 0);
+
+    // Converts between prefetcher types and their names ("stride", ...)
+    static const char *getName(Type type);
+    static bool parseName(const char *name, Type &type);
+
+    // Public statistics member
+    Statistics statistics;
+
+protected:
+    uint32_t blockSize;            // Block size of the cache level
+    uint32_t blockBits;            // log2(blockSize)
+    uint32_t degree;               // Blocks requested per trigger
+};
+
+#endif
@@ -0,0 +1,298 @@
+/*
+ * Implementation of the cache replacement policies
+ */
+
+#include <cstring>
+#include <vector>
+
+#include "Checkpoint.h"
+#include "ReplacementPolicy.h"
+
+// Small xorshift generator, seeded with a constant so that runs with the
+// same trace and configuration are reproducible
+class XorShift {
+public:
+    XorShift() : state(0x9e3779b9u) {}
+
+    uint32_t next() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+private:
+    uint32_t state;
+};
+
+// True LRU: every access stamps the block, the oldest stamp is evicted
+class LruPolicy : public ReplacementPolicy {
+public:
+    LruPolicy(uint32_t sets, uint32_t ways)
+        : ways(ways), counter(0), stamps(uint64_t(sets) * ways, 0) {}
+
+    void onHit(uint32_t set, uint32_t way) override {
+        stamps[set * ways + way] = ++counter;
+    }
+
+    void onFill(uint32_t set, uint32_t way) override {
+        stamps[set * ways + way] = ++counter;
+    }
+
+    uint32_t getVictim(uint32_t set) override {
+        const uint64_t *s = &stamps[set * ways];
+        uint32_t victim = 0;
+        for (uint32_t i = 1; i < ways; ++i) {
+            if (s[i] < s[victim])
+                victim = i;
+        }
+        return victim;
+    }
+
+    uint64_t getState(uint32_t set, uint32_t way) override {
+        return stamps[set * ways + way];
+    }
+
+    void saveState(std::vector<uint8_t> &out) const override {
+        CheckpointBase::append(out, &counter, sizeof(counter));
+        CheckpointBase::append(out, stamps.data(),
+                               stamps.size() * sizeof(uint64_t));
+    }
+
+    bool restoreState(const uint8_t *&p, const uint8_t *end) override {
+        return CheckpointBase::read(p, end, &counter, sizeof(counter)) &&
+               CheckpointBase::read(p, end, stamps.data(),
+                                    stamps.size() * sizeof(uint64_t));
+    }
+
+private:
+    uint32_t ways;
+    uint64_t counter;               // Access counter, 64 bits never wrap
+    std::vector<uint64_t> stamps;   // Last access per block
+};
+
+// Tree pseudo-LRU. The ways - 1 nodes of a set form an implicit binary
+// tree rooted at node 1; each node points towards the half to evict next
+class PlruPolicy : public ReplacementPolicy {
+public:
+    PlruPolicy(uint32_t sets, uint32_t ways)
+        : ways(ways), levels(0), nodes(uint64_t(sets) * ways, 0) {
+        while ((1u << levels) < ways)
+            levels++;
+    }
+
+    void onHit(uint32_t set, uint32_t way) override { touch(set, way); }
+
+    void onFill(uint32_t set, uint32_t way) override { touch(set, way); }
+
+    uint32_t getVictim(uint32_t set) override {
+        const uint8_t *tree = &nodes[set * ways];
+        uint32_t node = 1;
+        for (uint32_t l = 0; l < levels; ++l) {
+            node = 2 * node + tree[node];
+        }
+        return node - ways;
+    }
+
+    uint64_t getState(uint32_t set, uint32_t way) override {
+        // Nodes on the path that point away from this way
+        const uint8_t *tree = &nodes[set * ways];
+        uint64_t protect = 0;
+        uint32_t node = 1;
+        for (uint32_t l = levels; l-- > 0;) {
+            uint32_t dir = (way >> l) & 1;
+            protect += tree[node] != dir;
+            node = 2 * node + dir;
+        }
+        return protect;
+    }
+
+    void saveState(std::vector<uint8_t> &out) const override {
+        CheckpointBase::append(out, nodes.data(), nodes.size());
+    }
+
+    bool restoreState(const uint8_t *&p, const uint8_t *end) override {
+        return CheckpointBase::read(p, end, nodes.data(), nodes.size());
+    }
+
+private:
+    // Points every node on the path to the way at the other half
+    void touch(uint32_t set, uint32_t way) {
+        uint8_t *tree = &nodes[set * ways];
+        uint32_t node = 1;
+        for (uint32_t l = levels; l-- > 0;) {
+            uint32_t dir = (way >> l) & 1;
+            tree[node] = dir ^ 1;
+            node = 2 * node + dir;
+        }
+    }
+
+    uint32_t ways;
+    uint32_t levels;                // log2(ways)
+    std::vector<uint8_t> nodes;     // Node i of a set at index i, 0 unused
+};
+
+// RRIP with 2-bit re-reference prediction values. Hits predict a near
+// re-reference; SRRIP inserts with a long prediction, BRRIP usually with a
+// distant one and only every 32nd fill with a long one
+class RripPolicy : public ReplacementPolicy {
+public:
+    RripPolicy(uint32_t sets, uint32_t ways, bool bimodal)
+        : ways(ways), bimodal(bimodal),
+          rrpv(uint64_t(sets) * ways, RRPV_MAX) {}
+
+    void onHit(uint32_t set, uint32_t way) override {
+        rrpv[set * ways + way] = 0;
+    }
+
+    void onFill(uint32_t set, uint32_t way) override {
+        bool distant = bimodal && (random.next() & 31) != 0;
+        rrpv[set * ways + way] = distant ? RRPV_MAX : RRPV_MAX - 1;
+    }
+
+    uint32_t getVictim(uint32_t set) override {
+        uint8_t *s = &rrpv[set * ways];
+        uint8_t oldest = 0;
+        for (uint32_t i = 0; i < ways; ++i) {
+            if (s[i] == RRPV_MAX)
+                return i;
+            if (s[i] > oldest)
+                oldest = s[i];
+        }
+        // Age the whole set so that the oldest blocks reach RRPV_MAX
+        uint8_t age = RRPV_MAX - oldest;
+        uint32_t victim = 0;
+        for (uint32_t i = ways; i-- > 0;) {
+            s[i] += age;
+            if (s[i] == RRPV_MAX)
+                victim = i;
+        }
+        return victim;
+    }
+
+    uint64_t getState(uint32_t set, uint32_t way) override {
+        return rrpv[set * ways + way];
+    }
+
+    void saveState(std::vector<uint8_t> &out) const override {
+        CheckpointBase::append(out, &random, sizeof(random));
+        CheckpointBase::append(out, rrpv.data(), rrpv.size());
+    }
+
+    bool restoreState(const uint8_t *&p, const uint8_t *end) override {
+        return CheckpointBase::read(p, end, &random, sizeof(random)) &&
+               CheckpointBase::read(p, end, rrpv.data(), rrpv.size());
+    }
+
+private:
+    static const uint8_t RRPV_MAX = 3;
+
+    uint32_t ways;
+    bool bimodal;
+    XorShift random;
+    std::vector<uint8_t> rrpv;      // Prediction value per block
+};
+
+// Pseudo-random victim; keeps no per-set state
+class RandomPolicy : public ReplacementPolicy {
+public:
+    explicit RandomPolicy(uint32_t ways) : ways(ways) {}
+
+    void onHit(uint32_t, uint32_t) override {}
+
+    void onFill(uint32_t, uint32_t) override {}
+
+    uint32_t getVictim(uint32_t) override {
+        return random.next() % ways;
+    }
+
+    uint64_t getState(uint32_t, uint32_t) override { return 0; }
+
+    void saveState(std::vector<uint8_t> &out) const override {
+        CheckpointBase::append(out, &random, sizeof(random));
+    }
+
+    bool restoreState(const uint8_t *&p, const uint8_t *end) override {
+        return CheckpointBase::read(p, end, &random, sizeof(random));
+    }
+
+private:
+    uint32_t ways;
+    XorShift random;
+};
+
+// FIFO: a round-robin pointer per set names the oldest fill. Invalid ways
+// are filled in order, so the pointer follows them until the set is full
+class FifoPolicy : public ReplacementPolicy {
+public:
+    FifoPolicy(uint32_t sets, uint32_t ways) : ways(ways), next(sets, 0) {}
+
+    void onHit(uint32_t, uint32_t) override {}
+
+    void onFill(uint32_t set, uint32_t way) override {
+        if (way == next[set])
+            next[set] = way + 1 == ways ? 0 : way + 1;
+    }
+
+    uint32_t getVictim(uint32_t set) override { return next[set]; }
+
+    uint64_t getState(uint32_t set, uint32_t way) override {
+        // Fills until this way is evicted
+        return (way + ways - next[set]) % ways;
+    }
+
+    void saveState(std::vector<uint8_t> &out) const override {
+        CheckpointBase::append(out, next.data(),
+                               next.size() * sizeof(uint32_t));
+    }
+
+    bool restoreState(const uint8_t *&p, const uint8_t *end) override {
+        return CheckpointBase::read(p, end, next.data(),
+                                    next.size() * sizeof(uint32_t));
+    }
+
+private:
+    uint32_t ways;
+    std::vector<uint32_t> next;     // Next victim per set
+};
+
+// Policy names, indexed by Type
+static const char *const policyNames[] = {
+    "lru", "plru", "srrip", "brrip", "random", "fifo",
+};
+
+// Creates a policy for a cache with the given geometry
+ReplacementPolicy *ReplacementPolicy::create(Type type, uint32_t sets,
+                                             uint32_t ways) {
+    switch (type) {
+    case LRU:
+        return new LruPolicy(sets, ways);
+    case PLRU:
+        return new PlruPolicy(sets, ways);
+    case SRRIP:
+        return new RripPolicy(sets, ways, false);
+    case BRRIP:
+        return new RripPolicy(sets, ways, true);
+    case RANDOM:
+        return new RandomPolicy(ways);
+    case FIFO:
+        return new FifoPolicy(sets, ways);
+    }
+    return nullptr;
+}
+
+// Returns the name of a policy type
+const char *ReplacementPolicy::getName(Type type) {
+    return policyNames[type];
+}
+
+// Looks up a policy type by name
+bool ReplacementPolicy::parseName(const char *name, Type &type) {
+    for (uint32_t i = 0; i < sizeof(policyNames) / sizeof(policyNames[0]); ++i) {
+        if (strcmp(name, policyNames[i]) == 0) {
+            type = static_cast<Type>(i);
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,53 @@
+/*
+ * Replacement policies for set-associative caches
+ * Each policy keeps its own compact per-set metadata, laid out set by set
+ * like the cache's block keys. The cache fills invalid ways first and only
+ * asks the policy for a victim when the set is full
+ */
+
+#ifndef REPLACEMENT_POLICY_H
+#define REPLACEMENT_POLICY_H
+
+#include <cstdint>
+#include <vector>
+
+class ReplacementPolicy {
+public:
+    enum Type {
+        LRU,       // True LRU on per-block access stamps
+        PLRU,      // Tree pseudo-LRU, ways - 1 bits per set
+        SRRIP,     // Static re-reference interval prediction, 2-bit RRPV
+        BRRIP,     // Bimodal RRIP: mostly distant insertion
+        RANDOM,    // Pseudo-random victim, deterministic seed
+        FIFO,      // Round-robin victim pointer per set
+    };
+
+    virtual ~ReplacementPolicy() {}
+
+    // Called when a demand or prefetch access hits the given way
+    virtual void onHit(uint32_t set, uint32_t way) = 0;
+
+    // Called after a block has been filled into the given way
+    virtual void onFill(uint32_t set, uint32_t way) = 0;
+
+    // Picks the way to evict from a full set
+    virtual uint32_t getVictim(uint32_t set) = 0;
+
+    // Policy state of a block for verbose output
+    virtual uint64_t getState(uint32_t set, uint32_t way) = 0;
+
+    // Appends the whole policy state to a checkpoint buffer, and reads it
+    // back into a policy of the same type and geometry, advancing p; false
+    // if the buffer ends first
+    virtual void saveState(std::vector<uint8_t> &out) const = 0;
+    virtual bool restoreState(const uint8_t *&p, const uint8_t *end) = 0;
+
+    // Creates a policy for a cache with the given geometry
+    static ReplacementPolicy *create(Type type, uint32_t sets, uint32_t ways);
+
+    // Converts between policy types and their names ("lru", "plru", ...)
+    static const char *getName(Type type);
+    static bool parseName(const char *name, Type &type);
+};
+
+#endif
@@ -0,0 +1,121 @@
+/*
+ * Implementation of the sampling schedule and miss rate estimator
+ */
+
+#include <cmath>
+
+#include "Sampling.h"
+
+// Two-sided 95% quantiles of Student's t distribution by degrees of
+// freedom; beyond the table the normal quantile is close enough
+static const double T_95[] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+};
+static const double Z_95 = 1.96;
+
+// 95% quantile for a sample of n units
+static double getQuantile(uint64_t n) {
+    uint64_t df = n - 1;
+    return df <= sizeof(T_95) / sizeof(T_95[0]) ? T_95[df - 1] : Z_95;
+}
+
+// Constructor: the windows never exceed the period
+Sampling::Sampling(uint64_t period, uint64_t warmup, uint64_t measure)
+    : period(period), warmup(warmup), measure(measure), unitNum(0),
+      sumAccesses(0), sumMisses(0), sumAccesses2(0), sumMisses2(0),
+      sumProducts(0) {
+    if (period > 0 && warmup + measure > period) {
+        this->period = warmup + measure;
+    }
+}
+
+// Whether the schedule leaves out part of the trace
+bool Sampling::isTimeSampling() const {
+    return period > 0;
+}
+
+// Phase of the record at index: each period skips, warms up, then measures
+Sampling::Phase Sampling::getPhase(uint64_t index) const {
+    if (period == 0) {
+        return MEASURE;
+    }
+    uint64_t offset = index % period;
+    if (offset < period - warmup - measure) {
+        return SKIP;
+    }
+    return offset < period - measure ? WARMUP : MEASURE;
+}
+
+// Whether the record at index opens a measure window
+bool Sampling::isMeasureBegin(uint64_t index) const {
+    if (period == 0) {
+        return index == 0;
+    }
+    return index % period == period - measure;
+}
+
+// Whether the record at index closes a measure window
+bool Sampling::isMeasureEnd(uint64_t index) const {
+    return period > 0 && measure > 0 && index % period == period - 1;
+}
+
+// Number of periods in a trace of recordNum records
+uint64_t Sampling::getPeriodNum(uint64_t recordNum) const {
+    if (period == 0) {
+        return 1;
+    }
+    return (recordNum + period - 1) / period;
+}
+
+// Adds a sampling unit to the running sums
+void Sampling::addUnit(uint64_t accesses, uint64_t misses) {
+    double a = accesses;
+    double m = misses;
+    unitNum++;
+    sumAccesses += a;
+    sumMisses += m;
+    sumAccesses2 += a * a;
+    sumMisses2 += m * m;
+    sumProducts += a * m;
+}
+
+// Number of units added so far
+uint64_t Sampling::getUnitNum() const {
+    return unitNum;
+}
+
+// Number of accesses measured so far
+uint64_t Sampling::getAccessNum() const {
+    return sumAccesses;
+}
+
+// Ratio estimate of the miss rate over all units
+double Sampling::getMissRate() const {
+    return sumAccesses > 0 ? sumMisses / sumAccesses : 0;
+}
+
+// Half width of the 95% confidence interval of the ratio estimate. With
+// fewer than two units and unmeasured units left the variance is unknown,
+// which is reported as the widest possible bound
+double Sampling::getErrorBound(uint64_t populationUnits) const {
+    if (unitNum >= populationUnits) {
+        return 0;
+    }
+    if (unitNum < 2 || sumAccesses == 0) {
+        return 1;
+    }
+
+    double n = unitNum;
+    double r = getMissRate();
+    double meanAccesses = sumAccesses / n;
+    double residuals =
+        sumMisses2 - 2 * r * sumProducts + r * r * sumAccesses2;
+    if (residuals < 0) {
+        residuals = 0;
+    }
+    double variance = (1 - n / populationUnits) * residuals / (n - 1) /
+                      (n * meanAccesses * meanAccesses);
+    return getQuantile(unitNum) * std::sqrt(variance);
+}
@@ -0,0 +1,75 @@
+/*
+ * Sampled simulation support
+ * Time sampling splits the trace into periods of which only the tail is
+ * simulated: a warmup window that brings the cache state up to date, then
+ * a measure window whose accesses are counted. Every measured window (and,
+ * with set sampling, every sampled set within it) is one sampling unit; the
+ * miss rate is estimated as a ratio over the units, with a 95% confidence
+ * bound from the usual ratio estimator variance. The bound covers the
+ * sampling variance only; warmup windows that are too short to refill the
+ * cache bias the estimate towards more misses
+ */
+
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+#include <cstdint>
+
+class Sampling {
+public:
+    // What happens to a trace record under the schedule
+    enum Phase {
+        SKIP,       // Not simulated at all
+        WARMUP,     // Simulated, not counted
+        MEASURE,    // Simulated and counted
+    };
+
+    // Creates a schedule of period records ending in warmup and measure
+    // windows; a period of 0 measures the whole trace
+    Sampling(uint64_t period = 0, uint64_t warmup = 0, uint64_t measure = 0);
+
+    // Whether the schedule leaves out part of the trace
+    bool isTimeSampling() const;
+
+    // Phase of the record at index
+    Phase getPhase(uint64_t index) const;
+
+    // Whether the record at index is the first / last one of a measure
+    // window
+    bool isMeasureBegin(uint64_t index) const;
+    bool isMeasureEnd(uint64_t index) const;
+
+    // Number of periods, i.e. of possible measure windows, in a trace of
+    // recordNum records
+    uint64_t getPeriodNum(uint64_t recordNum) const;
+
+    // Adds a sampling unit with its demand accesses and misses
+    void addUnit(uint64_t accesses, uint64_t misses);
+
+    // Number of units and accesses added so far
+    uint64_t getUnitNum() const;
+    uint64_t getAccessNum() const;
+
+    // Estimated miss rate
+    double getMissRate() const;
+
+    // Half width of the 95% confidence interval of the miss rate, for a
+    // population of populationUnits units. The finite population
+    // correction makes the bound 0 when every unit was measured
+    double getErrorBound(uint64_t populationUnits) const;
+
+private:
+    uint64_t period;
+    uint64_t warmup;
+    uint64_t measure;
+
+    // Running sums over the units for the ratio estimator
+    uint64_t unitNum;
+    double sumAccesses;
+    double sumMisses;
+    double sumAccesses2;      // Sum of squared accesses
+    double sumMisses2;        // Sum of squared misses
+    double sumProducts;       // Sum of accesses * misses
+};
+
+#endif
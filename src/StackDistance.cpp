@@ -0,0 +1,262 @@
+/*
+ * Implementation of the single-pass LRU stack distance analysis
+ *
+ * Write-backs follow from the distances as well: after a write a block is
+ * dirty in every cache. A later access at distance d means the block was
+ * evicted from, and refetched clean into, every cache with fewer than d
+ * ways. Each block therefore tracks dirtyFrom, the largest distance since its
+ * last write; it is dirty exactly in caches with at least dirtyFrom ways, and
+ * an access at distance d > dirtyFrom writes it back from the caches with
+ * dirtyFrom to d - 1 ways
+ */
+
+#include "StackDistance.h"
+
+// Initial positions per set and slots of the block table; both grow on
+// demand
+static const uint32_t INITIAL_SET_CAPACITY = 16;
+static const uint32_t INITIAL_BLOCK_SLOTS = 1024;
+
+// Multiplicative hashing of a block address onto a power of two table,
+// folding the well-mixed high bits into the slot index
+static inline uint32_t hashSlot(uint32_t addr, uint32_t mask) {
+    uint32_t h = addr * 0x9e3779b1u;
+    return (h ^ (h >> 16)) & mask;
+}
+
+static inline uint32_t hashSlot(uint64_t addr, uint32_t mask) {
+    uint64_t h = addr * 0x9e3779b97f4a7c15ull;
+    return (h ^ (h >> 32)) & mask;
+}
+
+// Constructor: derives the set mapping from the policy
+template <typename Addr>
+BasicStackDistance<Addr>::BasicStackDistance(const CacheBase::Policy &policy,
+                                             uint32_t maxAssociativity)
+    : policy(policy), numRead(0), numWrite(0), numWritebackIn(0),
+      blockNum(0) {
+    offsetBits = 0;
+    while ((1u << offsetBits) < policy.blockSize)
+        offsetBits++;
+    uint32_t setNum = policy.blockNum / policy.associativity;
+    idMask = setNum - 1;
+    missDistance = maxAssociativity + 1;
+
+    readDistances.assign(missDistance + 1, 0);
+    writeDistances.assign(missDistance + 1, 0);
+    writebackInDistances.assign(missDistance + 1, 0);
+    writebackDeltas.assign(missDistance + 1, 0);
+
+    sets.resize(setNum);
+    for (Set &s : sets) {
+        s.time = s.live = 0;
+        s.tree.assign(INITIAL_SET_CAPACITY + 1, 0);
+        s.owner.assign(INITIAL_SET_CAPACITY, 0);
+        s.marked.assign(INITIAL_SET_CAPACITY, 0);
+    }
+    blocks.assign(INITIAL_BLOCK_SLOTS, Block{0, 0, 0, 0});
+}
+
+// Records one access: finds its stack distance, moves the block to the top
+// of its set's stack and updates the write-back bookkeeping
+template <typename Addr>
+void BasicStackDistance<Addr>::access(Addr addr, bool isWrite, bool isDemand,
+                                      uint32_t repeat) {
+    Addr blockAddr = addr >> offsetBits;
+    Set &set = sets[blockAddr & idMask];
+    if (set.time == set.owner.size()) {
+        compact(set);
+    }
+
+    uint32_t distance = missDistance;
+    bool inserted;
+    Block &block = findBlock(blockAddr, inserted);
+    if (inserted) {
+        block.dirtyFrom = missDistance;
+    } else {
+        distance = getDistance(set, block.pos);
+        add(set.tree, block.pos, -1);
+        set.marked[block.pos] = 0;
+        set.live--;
+    }
+    if (distance > block.dirtyFrom) {
+        writebackDeltas[block.dirtyFrom]++;
+        writebackDeltas[distance]--;
+    }
+    // Repeats find the block on top of its stack, at distance 1, and leave
+    // the stack and the dirty state as they are
+    if (isWrite && !isDemand) {
+        numWritebackIn += 1 + repeat;
+        writebackInDistances[distance]++;
+        writebackInDistances[1] += repeat;
+        block.dirtyFrom = 1;
+    } else if (isWrite) {
+        numWrite += 1 + repeat;
+        writeDistances[distance]++;
+        writeDistances[1] += repeat;
+        block.dirtyFrom = 1;
+    } else {
+        numRead += 1 + repeat;
+        readDistances[distance]++;
+        readDistances[1] += repeat;
+        if (distance > block.dirtyFrom)
+            block.dirtyFrom = distance;
+    }
+
+    block.pos = set.time++;
+    set.owner[block.pos] = blockAddr;
+    set.marked[block.pos] = 1;
+    set.live++;
+    add(set.tree, block.pos, 1);
+}
+
+// Statistics of an LRU, write-allocate cache with the given associativity.
+// Dirty blocks that have already been evicted but not accessed again are
+// written back as well, like the simulated cache did at eviction time
+template <typename Addr>
+CacheBase::Statistics
+BasicStackDistance<Addr>::getStatistics(uint32_t associativity,
+                                        bool writeBack) const {
+    uint64_t hits = 0;
+    uint64_t writeHits = 0;
+    uint64_t writebackInHits = 0;
+    for (uint32_t d = 1; d <= associativity && d < missDistance; ++d) {
+        hits += readDistances[d] + writeDistances[d];
+        writeHits += writeDistances[d] + writebackInDistances[d];
+        writebackInHits += writebackInDistances[d];
+    }
+
+    int64_t writebacks = 0;
+    for (uint32_t a = 0; a <= associativity && a < missDistance; ++a) {
+        writebacks += writebackDeltas[a];
+    }
+    for (const Block &block : blocks) {
+        if (!block.used || block.dirtyFrom > associativity)
+            continue;
+        const Set &set = sets[block.addr & idMask];
+        if (getDistance(set, block.pos) > associativity)
+            writebacks++;
+    }
+
+    CacheBase::Statistics stats = CacheBase::Statistics();
+    stats.numRead = numRead;
+    stats.numWrite = numWrite;
+    stats.numHit = hits;
+    stats.numMiss = numRead + numWrite - hits;
+    stats.numWritebackIn = numWritebackIn;
+    stats.numWritebackMiss = numWritebackIn - writebackInHits;
+    stats.totalCycles = (hits + writebackInHits) * policy.hitLatency +
+                        (stats.numMiss + stats.numWritebackMiss) *
+                            policy.missLatency;
+    stats.numWriteback = writeBack ? writebacks : writeHits;
+    stats.totalCycles += stats.numWriteback * policy.missLatency;
+    return stats;
+}
+
+// Finds the state of a block with linear probing, inserting it if it has
+// not been seen. References stay valid until the next insertion
+template <typename Addr>
+typename BasicStackDistance<Addr>::Block &
+BasicStackDistance<Addr>::findBlock(Addr addr, bool &inserted) {
+    if (blockNum * 2 >= blocks.size()) {
+        growBlocks();
+    }
+    uint32_t mask = blocks.size() - 1;
+    for (uint32_t i = hashSlot(addr, mask);; i = (i + 1) & mask) {
+        Block &block = blocks[i];
+        if (!block.used) {
+            block = Block{addr, 0, 0, 1};
+            blockNum++;
+            inserted = true;
+            return block;
+        }
+        if (block.addr == addr) {
+            inserted = false;
+            return block;
+        }
+    }
+}
+
+// Doubles the block table and reinserts every block
+template <typename Addr>
+void BasicStackDistance<Addr>::growBlocks() {
+    std::vector<Block> old(blocks.size() * 2, Block{0, 0, 0, 0});
+    old.swap(blocks);
+    uint32_t mask = blocks.size() - 1;
+    for (const Block &block : old) {
+        if (!block.used)
+            continue;
+        uint32_t i = hashSlot(block.addr, mask);
+        while (blocks[i].used)
+            i = (i + 1) & mask;
+        blocks[i] = block;
+    }
+}
+
+// Stack distance of the block last accessed at pos: one more than the
+// number of distinct blocks of the set used after it
+template <typename Addr>
+uint32_t BasicStackDistance<Addr>::getDistance(const Set &set,
+                                               uint32_t pos) const {
+    uint32_t distance = set.live - prefix(set.tree, pos) + 1;
+    return distance < missDistance ? distance : missDistance;
+}
+
+// Renumbers the marked positions of a full set from 0. Only the last use of
+// every block is kept, so the set needs space for its distinct blocks only
+template <typename Addr>
+void BasicStackDistance<Addr>::compact(Set &set) {
+    uint32_t capacity = set.owner.size();
+    if (set.live * 2 > capacity) {
+        capacity *= 2;
+    }
+
+    std::vector<Addr> owner(capacity, 0);
+    std::vector<uint8_t> marked(capacity, 0);
+    uint32_t next = 0;
+    for (uint32_t pos = 0; pos < set.time; ++pos) {
+        if (!set.marked[pos])
+            continue;
+        owner[next] = set.owner[pos];
+        marked[next] = 1;
+        bool inserted;
+        findBlock(set.owner[pos], inserted).pos = next;
+        next++;
+    }
+
+    // Linear-time Fenwick construction
+    set.tree.assign(capacity + 1, 0);
+    for (uint32_t i = 1; i <= capacity; ++i) {
+        set.tree[i] += marked[i - 1];
+        uint32_t parent = i + (i & -i);
+        if (parent <= capacity)
+            set.tree[parent] += set.tree[i];
+    }
+
+    set.owner.swap(owner);
+    set.marked.swap(marked);
+    set.time = next;
+}
+
+// Adds delta to the count at pos
+template <typename Addr>
+void BasicStackDistance<Addr>::add(std::vector<uint32_t> &tree, uint32_t pos,
+                                   int32_t delta) {
+    for (uint32_t i = pos + 1; i < tree.size(); i += i & -i) {
+        tree[i] += delta;
+    }
+}
+
+// Sums the counts at positions 0 to pos
+template <typename Addr>
+uint32_t BasicStackDistance<Addr>::prefix(const std::vector<uint32_t> &tree,
+                                          uint32_t pos) {
+    uint32_t sum = 0;
+    for (uint32_t i = pos + 1; i > 0; i -= i & -i) {
+        sum += tree[i];
+    }
+    return sum;
+}
+
+template class BasicStackDistance<uint32_t>;
+template class BasicStackDistance<uint64_t>;
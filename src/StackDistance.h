@@ -0,0 +1,97 @@
+/*
+ * Single-pass LRU stack distance (Mattson) analysis
+ * For a fixed block size and set count, an LRU cache with A ways hits
+ * exactly the accesses whose stack distance within their set is at most A,
+ * so one pass over the trace yields the statistics of every associativity,
+ * i.e. every cache size with that set count. Only LRU caches with
+ * write-allocate qualify; write-back and write-through are both supported
+ */
+
+#ifndef STACK_DISTANCE_H
+#define STACK_DISTANCE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "Cache.h"
+
+template <typename Addr>
+class BasicStackDistance {
+public:
+    // Analyses caches with the block size, set count (blockNum /
+    // associativity) and latencies of policy, for up to maxAssociativity
+    // ways; larger distances are counted as misses everywhere
+    BasicStackDistance(const CacheBase::Policy &policy,
+                       uint32_t maxAssociativity);
+
+    // Records one access and repeat more back to back accesses to its
+    // block. Write-backs from a level above (isDemand false) are writes
+    // that count apart from the demand hits and misses
+    void access(Addr addr, bool isWrite, bool isDemand = true,
+                uint32_t repeat = 0);
+
+    // Statistics an LRU, write-allocate cache with the given associativity
+    // would have reported for the accesses so far
+    CacheBase::Statistics getStatistics(uint32_t associativity,
+                                        bool writeBack) const;
+
+private:
+    // Per-block state in an open addressing table keyed by block address
+    struct Block {
+        Addr addr;           // Block address
+        uint32_t pos;        // Set-local time of the last access
+        uint32_t dirtyFrom;  // Dirty in caches with at least this many ways
+        uint32_t used;       // Whether the slot holds a block
+    };
+
+    // Per-set reuse-distance counter: a Fenwick tree over set-local time
+    // marking the last access of every block. The marks after a block's
+    // last access count the distinct blocks used since then
+    struct Set {
+        uint32_t time;                 // Next set-local time
+        uint32_t live;                 // Marked positions
+        std::vector<uint32_t> tree;    // Fenwick tree, 1-based
+        std::vector<Addr> owner;       // Block address per position
+        std::vector<uint8_t> marked;   // Whether the position is a last use
+    };
+
+    // Finds the state of a block, inserting it if it has not been seen
+    Block &findBlock(Addr addr, bool &inserted);
+
+    // Doubles the block table
+    void growBlocks();
+
+    // Stack distance of a block whose last access was at pos, capped at
+    // the miss bucket
+    uint32_t getDistance(const Set &set, uint32_t pos) const;
+
+    // Renumbers the marked positions of a full set from 0, growing the
+    // tree if more than half of it is live
+    void compact(Set &set);
+
+    static void add(std::vector<uint32_t> &tree, uint32_t pos, int32_t delta);
+    static uint32_t prefix(const std::vector<uint32_t> &tree, uint32_t pos);
+
+    CacheBase::Policy policy;
+    uint32_t offsetBits;           // log2(blockSize)
+    uint32_t idMask;               // Selects the set from a block address
+    uint32_t missDistance;         // maxAssociativity + 1: miss everywhere
+
+    uint64_t numRead;
+    uint64_t numWrite;
+    uint64_t numWritebackIn;
+    std::vector<uint64_t> readDistances;    // Reads per stack distance
+    std::vector<uint64_t> writeDistances;   // Writes per stack distance
+    std::vector<uint64_t> writebackInDistances;  // Write-backs from above
+    std::vector<int64_t> writebackDeltas;   // Difference array over ways
+
+    std::vector<Set> sets;
+    std::vector<Block> blocks;     // Power of two slots, at most half used
+    uint32_t blockNum;             // Used slots
+};
+
+// Analyses of 32-bit and 64-bit address traces
+typedef BasicStackDistance<uint32_t> StackDistance;
+typedef BasicStackDistance<uint64_t> StackDistance64;
+
+#endif
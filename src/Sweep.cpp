@@ -0,0 +1,175 @@
+/*
+ * Implementation of the design-space sweep engine
+ */
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include "Sweep.h"
+
+// Constructor: a job count of 0 selects one worker per hardware thread
+Sweep::Sweep(unsigned jobs) {
+    if (jobs == 0) {
+        jobs = std::thread::hardware_concurrency();
+    }
+    this->jobs = jobs > 0 ? jobs : 1;
+}
+
+// Appends a configuration to the sweep
+void Sweep::addPoint(const Point &point) {
+    points.push_back(point);
+}
+
+// Returns all configurations in insertion order
+const std::vector<Sweep::Point> &Sweep::getPoints() const {
+    return points;
+}
+
+// Runs the simulator over every configuration, each one in a group of its
+// own
+std::vector<Sweep::Result> Sweep::run(const Simulator &simulate) {
+    std::vector<std::vector<size_t>> groups(points.size());
+    for (size_t i = 0; i < points.size(); ++i) {
+        groups[i].push_back(i);
+    }
+    return run(groups, [&](const std::vector<size_t> &group,
+                           std::vector<Result> &results) {
+        results[group[0]] = simulate(points[group[0]]);
+    });
+}
+
+// Runs the simulator over groups of configurations. Workers pull the next
+// unclaimed group from a shared counter and store the results into the
+// slots of its points, so the output order does not depend on scheduling
+std::vector<Sweep::Result>
+Sweep::run(const std::vector<std::vector<size_t>> &groups,
+           const GroupSimulator &simulate) {
+    std::vector<Result> results(points.size());
+    std::atomic<size_t> next(0);
+
+    auto worker = [&]() {
+        for (size_t i = next++; i < groups.size(); i = next++) {
+            simulate(groups[i], results);
+        }
+    };
+
+    unsigned workerNum = getJobs();
+    if (groups.size() < workerNum) {
+        workerNum = groups.empty() ? 1 : groups.size();
+    }
+    if (workerNum <= 1) {
+        worker();
+        return results;
+    }
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < workerNum; ++i) {
+        workers.push_back(std::thread(worker));
+    }
+    for (std::thread &t : workers) {
+        t.join();
+    }
+    return results;
+}
+
+// Number of worker threads, never more than there are configurations
+unsigned Sweep::getJobs() const {
+    if (points.size() < jobs) {
+        return points.empty() ? 1 : points.size();
+    }
+    return jobs;
+}
+
+// Writes the CSV header
+void Sweep::writeCsvHeader(std::ostream &out) {
+    out << "cacheSize,blockSize,associativity,writeBack,writeAllocate,"
+           "replacement,missRate,missRateError,totalCycles\n";
+}
+
+// Writes a single result row
+void Sweep::writeCsvRow(std::ostream &out, const Point &point,
+                        const Result &result) {
+    out << point.cacheSize << "," << point.blockSize << ","
+        << point.associativity << "," << point.writeBack << ","
+        << point.writeAllocate << ","
+        << ReplacementPolicy::getName(point.replacement) << ","
+        << result.missRate << "," << result.missRateError << ","
+        << result.totalCycles << std::endl;
+}
+
+// Writes the header of a partial result file
+void Sweep::writePartialHeader(std::ostream &out,
+                               const std::string &settings) {
+    out << "# " << settings << "\n";
+    out << "point,";
+    writeCsvHeader(out);
+}
+
+// Writes a result row prefixed with the index of its point
+void Sweep::writePartialRow(std::ostream &out, size_t index,
+                            const Point &point, const Result &result) {
+    out << index << ",";
+    writeCsvRow(out, point, result);
+}
+
+// The configuration fields of a result row, up to the miss rate
+static std::string getConfigFields(const std::string &row) {
+    size_t end = 0;
+    for (int i = 0; i < 6; ++i) {
+        end = row.find(',', i == 0 ? 0 : end + 1);
+        if (end == std::string::npos)
+            return std::string();
+    }
+    return row.substr(0, end);
+}
+
+// Reads a partial result file, checking its settings and every row
+// against its point
+bool Sweep::readPartial(const std::string &path, const std::string &settings,
+                        const std::vector<Point> &points,
+                        std::vector<std::string> &rows) {
+    rows.resize(points.size());
+    std::ifstream file(path);
+    std::string line;
+    if (!file || !std::getline(file, line) || file.eof()) {
+        return true;
+    }
+    if (line != "# " + settings) {
+        printf("Results of other sweep settings in %s: %s, not # %s\n",
+               path.c_str(), line.c_str(), settings.c_str());
+        return false;
+    }
+    if (!std::getline(file, line) || file.eof()) {
+        return true;
+    }
+    std::ostringstream columns;
+    columns << "point,";
+    writeCsvHeader(columns);
+    if (line + "\n" != columns.str()) {
+        printf("Unknown header in %s: %s\n", path.c_str(), line.c_str());
+        return false;
+    }
+    while (std::getline(file, line)) {
+        // The last row of a shard that died mid-write has no newline
+        if (file.eof() || line.empty())
+            break;
+        char *end;
+        unsigned long long index = strtoull(line.c_str(), &end, 10);
+        std::string row = *end == ',' ? std::string(end + 1) : std::string();
+        std::ostringstream expected;
+        if (index < points.size())
+            writeCsvRow(expected, points[index], Result());
+        if (index >= points.size() || row.empty() ||
+            getConfigFields(row) != getConfigFields(expected.str())) {
+            printf("Row of another sweep in %s: %s\n", path.c_str(),
+                   line.c_str());
+            return false;
+        }
+        rows[index] = row;
+    }
+    return true;
+}
@@ -0,0 +1,100 @@
+/*
+ * Design-space sweep engine
+ * Spreads the cache configurations of a sweep across worker threads while
+ * keeping the results in the order the configurations were added
+ */
+
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "ReplacementPolicy.h"
+
+class Sweep {
+public:
+    // One configuration of the design space
+    struct Point {
+        uint32_t cacheSize;       // Total cache size in bytes
+        uint32_t blockSize;       // Size of each block in bytes
+        uint32_t associativity;   // Number of blocks per set
+        bool writeBack;           // Write-back (true) or write-through
+        bool writeAllocate;       // Write-allocate on write miss
+        ReplacementPolicy::Type replacement;   // Victim selection
+        uint32_t hitLatency;      // Cycles for a cache hit
+        uint32_t missLatency;     // Cycles for a cache miss
+    };
+
+    // Simulation outcome of a single configuration
+    struct Result {
+        float missRate;
+        float missRateError;      // 95% confidence bound, 0 if exact
+        uint64_t totalCycles;
+    };
+
+    // Simulates one configuration; called concurrently from worker threads,
+    // so it must only touch state owned by the call
+    typedef std::function<Result(const Point &)> Simulator;
+
+    // Simulates a group of configurations together, given as indices into
+    // the points, storing each result into its slot of results; like
+    // Simulator it runs concurrently with the other groups
+    typedef std::function<void(const std::vector<size_t> &group,
+                               std::vector<Result> &results)>
+        GroupSimulator;
+
+    // Creates a sweep running on at most jobs threads (0 = all cores)
+    explicit Sweep(unsigned jobs = 0);
+
+    // Appends a configuration to the sweep
+    void addPoint(const Point &point);
+
+    // Returns all configurations in insertion order
+    const std::vector<Point> &getPoints() const;
+
+    // Runs the simulator over every configuration, results in point order
+    std::vector<Result> run(const Simulator &simulate);
+
+    // Runs the simulator over groups of configurations that together cover
+    // every point exactly once, results in point order
+    std::vector<Result> run(const std::vector<std::vector<size_t>> &groups,
+                            const GroupSimulator &simulate);
+
+    // Number of worker threads the sweep will use
+    unsigned getJobs() const;
+
+    // Writes the CSV header and a single result row
+    static void writeCsvHeader(std::ostream &out);
+    static void writeCsvRow(std::ostream &out, const Point &point,
+                            const Result &result);
+
+    // Partial results of one shard of a sweep split across nodes. The
+    // header starts with a "# settings" line naming the options that shape
+    // the results besides the points. Each row is the index of its point
+    // followed by the fields of the full CSV, so rows are appended as
+    // configurations finish and merge in point order
+    static void writePartialHeader(std::ostream &out,
+                                   const std::string &settings);
+    static void writePartialRow(std::ostream &out, size_t index,
+                                const Point &point, const Result &result);
+
+    // Reads the rows of a partial result file into rows, by point index and
+    // without the index field; rows of other points are left alone. A row
+    // cut short by a failed node is skipped, and so is a missing or empty
+    // file. Returns false if the file was written with other settings or a
+    // row does not belong to a point of points
+    static bool readPartial(const std::string &path,
+                            const std::string &settings,
+                            const std::vector<Point> &points,
+                            std::vector<std::string> &rows);
+
+private:
+    unsigned jobs;                 // Maximum number of worker threads
+    std::vector<Point> points;     // Configurations in output order
+};
+
+#endif
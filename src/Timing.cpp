@@ -0,0 +1,343 @@
+/*
+ * Implementation of the event-driven timing model
+ */
+
+#include <algorithm>
+
+#include "Timing.h"
+
+// Counters in output order, with their JSON key and text label
+static const struct {
+    const char *key;
+    const char *label;
+    uint64_t TimingBase::Statistics::*field;
+} timingFields[] = {
+    {"numAccess", "Demand Accesses", &TimingBase::Statistics::numAccess},
+    {"numPrefetch", "Prefetch Records", &TimingBase::Statistics::numPrefetch},
+    {"totalLatency", "Total Latency", &TimingBase::Statistics::totalLatency},
+    {"queueCycles", "Queueing Cycles", &TimingBase::Statistics::queueCycles},
+    {"numHitUnderMiss", "Hits Under Miss",
+     &TimingBase::Statistics::numHitUnderMiss},
+    {"windowStallCycles", "Window Stall Cycles",
+     &TimingBase::Statistics::windowStallCycles},
+    {"numMemoryRead", "Memory Reads", &TimingBase::Statistics::numMemoryRead},
+    {"numMemoryWrite", "Memory Writes",
+     &TimingBase::Statistics::numMemoryWrite},
+    {"memoryQueueCycles", "Memory Queueing Cycles",
+     &TimingBase::Statistics::memoryQueueCycles},
+    {"elapsedCycles", "Elapsed Cycles",
+     &TimingBase::Statistics::elapsedCycles},
+};
+
+// Counters of a level in output order
+static const struct {
+    const char *key;
+    const char *label;
+    uint64_t TimingBase::LevelStatistics::*field;
+} levelFields[] = {
+    {"numMshrMiss", "MSHR Misses", &TimingBase::LevelStatistics::numMshrMiss},
+    {"numMshrMerge", "MSHR Merges",
+     &TimingBase::LevelStatistics::numMshrMerge},
+    {"numMshrStall", "MSHR Stalls",
+     &TimingBase::LevelStatistics::numMshrStall},
+    {"mshrStallCycles", "MSHR Stall Cycles",
+     &TimingBase::LevelStatistics::mshrStallCycles},
+    {"mshrCycles", "MSHR Cycles", &TimingBase::LevelStatistics::mshrCycles},
+    {"mshrBusyCycles", "MSHR Busy Cycles",
+     &TimingBase::LevelStatistics::mshrBusyCycles},
+};
+
+TimingBase::TimingBase() : statistics(Statistics()) {}
+
+// Average cycles from issue to completion of a demand access
+double TimingBase::getAmat() const {
+    return statistics.numAccess > 0
+               ? double(statistics.totalLatency) / statistics.numAccess
+               : 0;
+}
+
+// Average L1 misses in flight while any is
+double TimingBase::getMlp() const {
+    return levelStatistics.empty() ? 0 : getLevelMlp(0);
+}
+
+// Average misses in flight at a level while any is
+double TimingBase::getLevelMlp(size_t level) const {
+    const LevelStatistics &stats = levelStatistics[level];
+    return stats.mshrBusyCycles > 0
+               ? double(stats.mshrCycles) / stats.mshrBusyCycles
+               : 0;
+}
+
+// Average cycles a demand access queued for MSHRs and the channel
+double TimingBase::getQueueDelay() const {
+    return statistics.numAccess > 0
+               ? double(statistics.queueCycles) / statistics.numAccess
+               : 0;
+}
+
+template <typename Addr>
+BasicTimingModel<Addr>::BasicTimingModel(
+    const std::vector<BasicCache<Addr> *> &levels,
+    const std::vector<uint32_t> &mshrs, Params params)
+    : params(params), memoryBurst(0), issueCycle(0), memoryFree(0),
+      window(params.window > 0 ? params.window : 1, 0), windowPos(0),
+      blocks(levels.size()), allocCycles(levels.size()) {
+    for (size_t i = 0; i < levels.size(); ++i) {
+        Level level;
+        level.cache = levels[i];
+        level.offsetBits = 0;
+        while ((1u << level.offsetBits) < levels[i]->getPolicy().blockSize)
+            ++level.offsetBits;
+        level.mshrNum = mshrs[i] > 0 ? mshrs[i] : 1;
+        level.busyEnd = 0;
+        this->levels.push_back(level);
+    }
+    levelStatistics.assign(levels.size(), LevelStatistics());
+    if (params.memoryBandwidth > 0) {
+        uint32_t blockSize = levels.back()->getPolicy().blockSize;
+        memoryBurst = (blockSize + params.memoryBandwidth - 1) /
+                      params.memoryBandwidth;
+    }
+}
+
+// Whether a level or its victim cache holds the block of an address
+template <typename Addr>
+bool BasicTimingModel<Addr>::inLevel(Level &level, Addr addr) {
+    BasicCache<Addr> *victim = level.cache->getVictimCache();
+    return level.cache->inCache(addr) ||
+           (victim != nullptr && victim->inCache(addr));
+}
+
+// Runs every record through the first level on its own, so that the level
+// each one hit in and the memory traffic it caused can be told apart. Each
+// repeat of a record is issued as an access of its own
+template <typename Addr>
+void BasicTimingModel<Addr>::access(const Record *begin, const Record *end) {
+    for (const Record *r = begin; r != end; ++r) {
+        Record record = *r;
+        record.flags &= ~TraceBase::REPEAT_MASK;
+        for (uint32_t i = 0; i <= r->getRepeat(); ++i) {
+            accessRecord(record);
+        }
+    }
+}
+
+// Issues and times a single record
+template <typename Addr>
+void BasicTimingModel<Addr>::accessRecord(const Record &record) {
+    BasicCache<Addr> *l1cache = levels.front().cache;
+    const CacheBase::Statistics &last = levels.back().cache->statistics;
+
+    // Where the block is before the record fills it on its way up; a victim
+    // cache hit counts as a hit of the level it is attached to
+    size_t depth = 0;
+    while (depth < levels.size() && !inLevel(levels[depth], record.addr))
+        ++depth;
+    CacheBase::Statistics before = last;
+    l1cache->access(&record, &record + 1);
+
+    bool demand = !record.isPrefetch();
+    uint64_t issue = issueCycle;
+    if (demand && window[windowPos] > issue) {
+        statistics.windowStallCycles += window[windowPos] - issue;
+        issue = window[windowPos];
+    }
+    Result result = time(record, depth, issue);
+    chargeMemory(before, issue, result.memoryRead);
+
+    if (demand) {
+        statistics.numAccess++;
+        statistics.totalLatency += result.done - issue;
+        statistics.queueCycles += result.wait;
+        window[windowPos] = result.done;
+        windowPos = (windowPos + 1) % window.size();
+    } else {
+        statistics.numPrefetch++;
+    }
+    statistics.elapsedCycles = std::max(statistics.elapsedCycles, result.done);
+    issueCycle = result.accepted + 1;
+}
+
+// Frees the MSHRs of a level whose blocks arrived by cycle
+template <typename Addr>
+void BasicTimingModel<Addr>::retire(Level &level, uint64_t cycle) {
+    while (!level.completions.empty() &&
+           level.completions.top().first <= cycle) {
+        level.inFlight.erase(level.completions.top().second);
+        level.completions.pop();
+    }
+}
+
+// Walks the levels the record missed in, queueing for a free MSHR at each,
+// then takes the hit latency of the level holding the block or goes to
+// memory. A level whose MSHRs already wait for the block ends the walk:
+// the record completes when the block arrives. Every level it missed in
+// holds an MSHR until then
+template <typename Addr>
+typename BasicTimingModel<Addr>::Result
+BasicTimingModel<Addr>::time(const Record &record, size_t depth,
+                             uint64_t issue) {
+    Result result = {0, issue, 0, false};
+    uint64_t cycle = issue;        // Cycle the record reaches a level
+    size_t missNum = 0;            // Levels it takes an MSHR at
+    bool merged = false;
+    for (size_t i = 0; i < depth; ++i) {
+        Level &level = levels[i];
+        LevelStatistics &stats = levelStatistics[i];
+        retire(level, cycle);
+        blocks[i] = record.addr >> level.offsetBits;
+        typename std::unordered_map<Addr, uint64_t>::const_iterator it =
+            level.inFlight.find(blocks[i]);
+        if (it != level.inFlight.end()) {
+            stats.numMshrMerge++;
+            result.done = std::max(cycle, it->second);
+            merged = true;
+            break;
+        }
+        if (level.inFlight.size() >= level.mshrNum) {
+            uint64_t start = cycle;
+            while (level.inFlight.size() >= level.mshrNum) {
+                cycle = level.completions.top().first;
+                retire(level, cycle);
+            }
+            stats.numMshrStall++;
+            stats.mshrStallCycles += cycle - start;
+            result.wait += cycle - start;
+        }
+        if (i == 0)
+            result.accepted = cycle;
+        allocCycles[i] = cycle;
+        missNum = i + 1;
+        cycle += level.cache->getPolicy().missLatency;
+    }
+
+    if (merged) {
+        // Completes with the miss already in flight
+    } else if (depth < levels.size()) {
+        Level &level = levels[depth];
+        retire(level, cycle);
+        result.done = cycle + level.cache->getPolicy().hitLatency;
+        typename std::unordered_map<Addr, uint64_t>::const_iterator it =
+            level.inFlight.find(record.addr >> level.offsetBits);
+        if (it != level.inFlight.end()) {
+            levelStatistics[depth].numMshrMerge++;
+            result.done = std::max(result.done, it->second);
+        } else if (depth == 0 && !record.isPrefetch() &&
+                   !level.inFlight.empty()) {
+            statistics.numHitUnderMiss++;
+        }
+    } else {
+        uint64_t start = std::max(cycle, memoryFree);
+        statistics.memoryQueueCycles += start - cycle;
+        result.wait += start - cycle;
+        memoryFree = start + memoryBurst;
+        result.done = start + params.memoryLatency + memoryBurst;
+        result.memoryRead = true;
+        statistics.numMemoryRead++;
+    }
+
+    for (size_t i = 0; i < missNum; ++i) {
+        Level &level = levels[i];
+        LevelStatistics &stats = levelStatistics[i];
+        level.inFlight[blocks[i]] = result.done;
+        level.completions.push(Completion(result.done, blocks[i]));
+        stats.numMshrMiss++;
+        stats.mshrCycles += result.done - allocCycles[i];
+        if (result.done > level.busyEnd) {
+            stats.mshrBusyCycles +=
+                result.done - std::max(allocCycles[i], level.busyEnd);
+            level.busyEnd = result.done;
+        }
+    }
+    return result;
+}
+
+// Counts the blocks the last level read from and wrote to memory for the
+// record: its misses, prefetch fills and allocating write-back misses, and
+// its write-backs. They occupy the channel from the issue cycle on without
+// delaying the record
+template <typename Addr>
+void BasicTimingModel<Addr>::chargeMemory(const CacheBase::Statistics &before,
+                                          uint64_t issue, bool memoryRead) {
+    const BasicCache<Addr> *cache = levels.back().cache;
+    const CacheBase::Statistics &after = cache->statistics;
+    uint64_t reads = after.numMiss - before.numMiss + after.numPrefetchFill -
+                     before.numPrefetchFill;
+    if (cache->isWriteAllocate())
+        reads += after.numWritebackMiss - before.numWritebackMiss;
+    if (memoryRead && reads > 0)
+        reads--;
+    uint64_t writes = after.numWriteback - before.numWriteback;
+    statistics.numMemoryRead += reads;
+    statistics.numMemoryWrite += writes;
+    if (reads + writes > 0 && memoryBurst > 0) {
+        memoryFree =
+            std::max(memoryFree, issue) + (reads + writes) * memoryBurst;
+    }
+}
+
+// Prints the timing statistics as text or as JSON object members
+template <typename Addr>
+void BasicTimingModel<Addr>::writeStatistics(
+    FILE *out, CacheBase::StatisticsFormat format,
+    const std::vector<std::string> &names) {
+    const size_t fieldNum = sizeof(timingFields) / sizeof(timingFields[0]);
+    const size_t levelFieldNum = sizeof(levelFields) / sizeof(levelFields[0]);
+    if (format == CacheBase::CSV) {
+        return;
+    }
+
+    if (format == CacheBase::TEXT) {
+        fprintf(out, "-------- TIMING ----------\n");
+        fprintf(out, "Window: %u, Memory Latency: %u, Memory Bandwidth: %u\n",
+                uint32_t(window.size()),
+                params.memoryLatency, params.memoryBandwidth);
+        for (size_t i = 0; i < fieldNum; ++i) {
+            fprintf(out, "%s: %llu\n", timingFields[i].label,
+                    (unsigned long long)(statistics.*timingFields[i].field));
+        }
+        fprintf(out, "AMAT: %.3f cycles\n", getAmat());
+        fprintf(out, "MLP: %.3f\n", getMlp());
+        fprintf(out, "Queueing Delay: %.3f cycles\n", getQueueDelay());
+        for (size_t l = 0; l < levels.size(); ++l) {
+            fprintf(out, "%s MSHRs: %u\n", names[l].c_str(),
+                    levels[l].mshrNum);
+            for (size_t i = 0; i < levelFieldNum; ++i) {
+                fprintf(out, "%s %s: %llu\n", names[l].c_str(),
+                        levelFields[i].label,
+                        (unsigned long long)(levelStatistics[l].*
+                                             levelFields[i].field));
+            }
+            fprintf(out, "%s MLP: %.3f\n", names[l].c_str(), getLevelMlp(l));
+        }
+        return;
+    }
+
+    fprintf(out,
+            "  \"timing\": {\"window\": %u, \"memoryLatency\": %u, "
+            "\"memoryBandwidth\": %u",
+            uint32_t(window.size()), params.memoryLatency,
+            params.memoryBandwidth);
+    for (size_t i = 0; i < fieldNum; ++i) {
+        fprintf(out, ", \"%s\": %llu", timingFields[i].key,
+                (unsigned long long)(statistics.*timingFields[i].field));
+    }
+    fprintf(out, ", \"amat\": %.6f, \"mlp\": %.6f, \"queueDelay\": %.6f",
+            getAmat(), getMlp(), getQueueDelay());
+    fprintf(out, ", \"levels\": [");
+    for (size_t l = 0; l < levels.size(); ++l) {
+        const LevelStatistics &stats = levelStatistics[l];
+        fprintf(out, "%s\n    {\"cache\": \"%s\", \"mshrs\": %u",
+                l == 0 ? "" : ",", names[l].c_str(), levels[l].mshrNum);
+        for (size_t i = 0; i < levelFieldNum; ++i) {
+            fprintf(out, ", \"%s\": %llu", levelFields[i].key,
+                    (unsigned long long)(stats.*levelFields[i].field));
+        }
+        fprintf(out, ", \"mlp\": %.6f}", getLevelMlp(l));
+    }
+    fprintf(out, "\n  ]}");
+}
+
+template class BasicTimingModel<uint32_t>;
+template class BasicTimingModel<uint64_t>;
@@ -0,0 +1,176 @@
+/*
+ * Event-driven timing model
+ * The additive latency of the cache levels charges every miss in full, as
+ * if no two accesses ever overlapped. This model replays each trace record
+ * against per-level miss status holding registers (MSHRs) and a memory
+ * channel to find the cycle it completes, while the cache levels still
+ * decide hits, misses and fills as usual:
+ *
+ * - The core issues one record per cycle in order and keeps at most a
+ *   window of demand accesses in flight, stalling while it is full or
+ *   while the L1 has no free MSHR
+ * - A miss holds an MSHR at every level it misses in until its block
+ *   arrives; a level with all MSHRs held queues new misses. An access to a
+ *   block already in flight merges with that miss, and hits to other
+ *   blocks go on under the outstanding misses
+ * - Each level costs its miss latency on a miss and its hit latency where
+ *   the access hits. Misses of the last level go to a memory channel that
+ *   moves one block at a time at a fixed bandwidth, after a fixed latency
+ * - Write-backs to memory and the blocks prefetchers fill share the
+ *   channel bandwidth but hold no MSHRs. PREFETCH records take MSHRs like
+ *   demand accesses, but the core does not wait for them
+ *
+ * An isolated access with an unlimited channel takes as long as the
+ * additive model charges it. The model reports the average memory access
+ * time (AMAT), the memory-level parallelism (MLP, the average number of
+ * misses in flight while there is any) and the cycles spent queueing for
+ * MSHRs and the channel
+ */
+
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Cache.h"
+
+// Parameters and statistics shared by every address width
+class TimingBase {
+public:
+    // Core and memory parameters; the MSHRs are given per level
+    struct Params {
+        uint32_t window;            // Demand accesses in flight, at least 1
+        uint32_t memoryLatency;     // Cycles of a memory access on top of
+                                    // the last level's miss latency
+        uint32_t memoryBandwidth;   // Channel bytes per cycle, 0 unlimited
+    };
+
+    // Miss handling of one level
+    struct LevelStatistics {
+        uint64_t numMshrMiss;       // Misses that took an MSHR
+        uint64_t numMshrMerge;      // Accesses to blocks already in flight
+        uint64_t numMshrStall;      // Misses that found every MSHR held
+        uint64_t mshrStallCycles;   // Cycles those waited for an MSHR
+        uint64_t mshrCycles;        // Cycles MSHRs were held in total
+        uint64_t mshrBusyCycles;    // Cycles any MSHR was held
+    };
+
+    struct Statistics {
+        uint64_t numAccess;         // Demand reads and writes
+        uint64_t numPrefetch;       // PREFETCH records
+        uint64_t totalLatency;      // Issue to completion of demand accesses
+        uint64_t queueCycles;       // Of that, waits for MSHRs and channel
+        uint64_t numHitUnderMiss;   // L1 hits while L1 misses were in flight
+        uint64_t windowStallCycles; // Issue cycles lost to a full window
+        uint64_t numMemoryRead;     // Blocks read from memory
+        uint64_t numMemoryWrite;    // Blocks written to memory
+        uint64_t memoryQueueCycles; // Waits for the memory channel
+        uint64_t elapsedCycles;     // Cycle the last access completed
+    };
+
+    // Average cycles from issue to completion of a demand access
+    double getAmat() const;
+
+    // Average L1 misses in flight while any is, and the same for a level
+    double getMlp() const;
+    double getLevelMlp(size_t level) const;
+
+    // Average cycles a demand access queued for MSHRs and the channel
+    double getQueueDelay() const;
+
+    Statistics statistics;
+    std::vector<LevelStatistics> levelStatistics;   // First level first
+
+protected:
+    TimingBase();
+};
+
+template <typename Addr>
+class BasicTimingModel : public TimingBase {
+public:
+    typedef typename BasicCache<Addr>::Record Record;
+
+    // Times the hierarchy of levels, first level first, each with the MSHR
+    // count of the same index. The caches stay owned by the caller
+    BasicTimingModel(const std::vector<BasicCache<Addr> *> &levels,
+                     const std::vector<uint32_t> &mshrs, Params params);
+
+    BasicTimingModel(const BasicTimingModel &) = delete;
+    BasicTimingModel &operator=(const BasicTimingModel &) = delete;
+
+    // Runs a batch of records through the first level, one at a time, and
+    // times each of them
+    void access(const Record *begin, const Record *end);
+
+    // Prints the timing statistics of the hierarchy and of every level,
+    // names given first level first, as text or as a JSON object member;
+    // CSV output only has the cache table
+    void writeStatistics(FILE *out, CacheBase::StatisticsFormat format,
+                         const std::vector<std::string> &names);
+
+private:
+    // Completion cycle and block of an MSHR, ordered by completion
+    typedef std::pair<uint64_t, Addr> Completion;
+
+    // MSHRs of one level
+    struct Level {
+        BasicCache<Addr> *cache;
+        uint32_t offsetBits;        // log2(blockSize)
+        uint32_t mshrNum;
+        std::unordered_map<Addr, uint64_t> inFlight;   // Block to arrival
+        std::priority_queue<Completion, std::vector<Completion>,
+                            std::greater<Completion> >
+            completions;            // Held MSHRs, earliest arrival first
+        uint64_t busyEnd;           // Last cycle an MSHR is known held
+    };
+
+    std::vector<Level> levels;
+    Params params;
+    uint32_t memoryBurst;           // Channel cycles per block
+    uint64_t issueCycle;            // Earliest cycle of the next issue
+    uint64_t memoryFree;            // Cycle the channel is next free
+    std::vector<uint64_t> window;   // Completion of the last window demand
+                                    // accesses, oldest at windowPos
+    size_t windowPos;
+    std::vector<Addr> blocks;       // Block of the access at each level
+    std::vector<uint64_t> allocCycles;  // Cycle each level took its MSHR
+
+    // Timing of one record
+    struct Result {
+        uint64_t done;              // Completion cycle
+        uint64_t accepted;          // Cycle the first level took it
+        uint64_t wait;              // Cycles queued for MSHRs and the channel
+        bool memoryRead;            // Whether it read its block from memory
+    };
+
+    // Runs and times one record, without its repeats
+    void accessRecord(const Record &record);
+
+    // Whether a level or its victim cache holds the block of an address
+    bool inLevel(Level &level, Addr addr);
+
+    // Frees the MSHRs of a level whose blocks arrived by cycle
+    void retire(Level &level, uint64_t cycle);
+
+    // Times a record issued at issue whose block the first depth levels
+    // missed, depth being the level count if it came from memory
+    Result time(const Record &record, size_t depth, uint64_t issue);
+
+    // Puts the memory traffic of a record, other than its own block read,
+    // on the channel: the last level's counters before the record are in
+    // before
+    void chargeMemory(const CacheBase::Statistics &before, uint64_t issue,
+                      bool memoryRead);
+};
+
+typedef BasicTimingModel<uint32_t> TimingModel;
+typedef BasicTimingModel<uint64_t> TimingModel64;
+
+#endif
@@ -0,0 +1,336 @@
+/*
+ * Implementation of the in-memory decoded memory trace
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Debug.h"
+#include "Trace.h"
+#include "TraceInput.h"
+#include "TraceReader.h"
+
+const char TraceBase::BINARY_MAGIC[4] = {'C', 'T', 'R', 'C'};
+
+// Returns the value of a hexadecimal digit, or -1 if c is not one
+static inline int hexValue(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// Scans text for a hex number with more than eight significant digits. The
+// x of a 0x prefix ends a run of digits, so the prefix is never counted.
+// Runs may span buffer boundaries, so the state is kept in digits: -1
+// outside a number, else the significant digits seen so far
+static bool hasWideAddress(const char *p, const char *end, int &digits) {
+    for (; p < end; ++p) {
+        if (hexValue(*p) < 0) {
+            digits = -1;
+        } else if (digits < 0) {
+            digits = *p != '0';
+        } else if (digits > 0 || *p != '0') {
+            if (++digits > 8)
+                return true;
+        }
+    }
+    return false;
+}
+
+// Address width of a trace file
+uint16_t TraceBase::getAddrBits(const char *path, bool wide) {
+    if (strcmp(path, "-") == 0) {
+        Header header;
+        ssize_t n = TraceInput::peekStandardInput(&header, sizeof(header));
+        if (n < 0) {
+            printf("Unable to read file %s\n", path);
+            return 0;
+        }
+        bool binary = n == (ssize_t)sizeof(header) &&
+                      memcmp(header.magic, BINARY_MAGIC,
+                             sizeof(BINARY_MAGIC)) == 0;
+        return binary ? header.addrBits : 64;
+    }
+    TraceInput *input = TraceInput::open(path);
+    if (input == nullptr) {
+        return 0;
+    }
+
+    std::vector<char> buf(1024 * 1024);
+    ssize_t n = input->read(buf.data(), sizeof(Header));
+    uint16_t bits = 32;
+    if (n == (ssize_t)sizeof(Header) &&
+        memcmp(buf.data(), BINARY_MAGIC, sizeof(BINARY_MAGIC)) == 0) {
+        Header header;
+        memcpy(&header, buf.data(), sizeof(header));
+        bits = header.addrBits;
+    } else if (wide) {
+        bits = 64;
+    } else {
+        // The scan stops after a prefix so that text traces are not read,
+        // and decompressed, twice
+        int digits = -1;
+        size_t scanned = 0;
+        while (n > 0) {
+            if (hasWideAddress(buf.data(), buf.data() + n, digits)) {
+                bits = 64;
+                break;
+            }
+            scanned += n;
+            if (scanned >= ADDR_SCAN_BYTES)
+                break;
+            n = input->read(buf.data(), buf.size());
+        }
+        if (n < 0) {
+            printf("Unable to read file %s\n", path);
+            bits = 0;
+        }
+    }
+    delete input;
+    return bits;
+}
+
+template <typename Addr>
+BasicTrace<Addr>::BasicTrace()
+    : records(nullptr), recordNum(0), mapping(nullptr), mappingSize(0) {}
+
+template <typename Addr>
+BasicTrace<Addr>::~BasicTrace() {
+    clear();
+}
+
+// Loads a binary or text trace file
+template <typename Addr>
+bool BasicTrace<Addr>::load(const char *path) {
+    clear();
+
+    size_t fileSize = 0;
+    if (strcmp(path, "-") != 0) {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            printf("Unable to open file %s\n", path);
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            printf("Unable to read file %s\n", path);
+            close(fd);
+            return false;
+        }
+        fileSize = st.st_size;
+
+        char magic[sizeof(BINARY_MAGIC)];
+        if (S_ISREG(st.st_mode) && fileSize >= sizeof(Header) &&
+            pread(fd, magic, sizeof(magic), 0) == sizeof(magic) &&
+            memcmp(magic, BINARY_MAGIC, sizeof(magic)) == 0) {
+            bool ok = map(fd, fileSize, path);
+            close(fd);
+            return ok;
+        }
+        close(fd);
+    }
+
+    // Decode text and compressed traces chunk by chunk, so only the decoded
+    // records and not the whole input are held in memory
+    BasicTraceReader<Addr> reader;
+    if (!reader.open(path)) {
+        return false;
+    }
+    // A text record takes at least a dozen characters
+    decoded.reserve(fileSize / 12);
+    const Record *chunkBegin, *chunkEnd;
+    while (reader.next(chunkBegin, chunkEnd)) {
+        decoded.insert(decoded.end(), chunkBegin, chunkEnd);
+    }
+    if (reader.failed()) {
+        clear();
+        return false;
+    }
+
+    records = decoded.data();
+    recordNum = decoded.size();
+    return true;
+}
+
+// Decodes text records. Replaces the operator>> / std::hex tokenizing with a
+// hand-written scanner, which is several times faster
+template <typename Addr>
+bool BasicTrace<Addr>::decodeText(const char *&p, const char *end,
+                                  size_t maxRecords,
+                                  std::vector<Record> &out) {
+    for (size_t n = 0; n < maxRecords; ++n) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+            ++p;
+        if (p == end)
+            break;
+
+        Record record = Record();
+        char type = *p++;
+        switch (type) {
+        case 'r':
+            record.flags = 0;
+            break;
+        case 'w':
+            record.flags = WRITE;
+            break;
+        case 'i':
+            record.flags = FETCH;
+            break;
+        default:
+            dbgprintf("Illegal type %c\n", type);
+            return false;
+        }
+
+        while (p < end && (*p == ' ' || *p == '\t'))
+            ++p;
+        if (end - p >= 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+            p += 2;
+
+        const char *digits = p;
+        uint64_t addr = 0;
+        bool wide = false;
+        for (int v; p < end && (v = hexValue(*p)) >= 0; ++p) {
+            wide = wide || (addr >> (sizeof(Addr) * 8 - 4)) != 0;
+            addr = (addr << 4) | v;
+        }
+        if (p == digits) {
+            dbgprintf("Illegal address in trace\n");
+            return false;
+        }
+        if (wide) {
+            if (sizeof(Addr) < sizeof(uint64_t)) {
+                printf("Address wider than 32 bits past the start of the "
+                       "trace; rerun with -w for 64-bit addresses\n");
+            } else {
+                dbgprintf("Address wider than 64 bits in trace\n");
+            }
+            return false;
+        }
+
+        // An optional decimal core ID may follow on the same line
+        while (p < end && (*p == ' ' || *p == '\t'))
+            ++p;
+        if (p < end && *p >= '0' && *p <= '9') {
+            uint32_t core = 0;
+            for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+                core = core * 10 + (*p - '0');
+                if (core > MAX_CORE_ID) {
+                    dbgprintf("Core ID beyond %d in trace\n", MAX_CORE_ID);
+                    return false;
+                }
+            }
+            record.flags |= core << CORE_SHIFT;
+        }
+
+        record.addr = addr;
+        out.push_back(record);
+    }
+    return true;
+}
+
+// Writes the records as a binary trace file
+template <typename Addr>
+bool BasicTrace<Addr>::save(const char *path) const {
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr) {
+        printf("Unable to open file %s\n", path);
+        return false;
+    }
+
+    Header header;
+    initHeader(header, recordNum);
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(records, sizeof(Record), recordNum, file) == recordNum;
+    ok = fclose(file) == 0 && ok;
+    if (!ok) {
+        printf("Unable to write file %s\n", path);
+    }
+    return ok;
+}
+
+// Fills in the header of a binary trace holding recordCount records
+template <typename Addr>
+void BasicTrace<Addr>::initHeader(Header &header, uint64_t recordCount) {
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BINARY_MAGIC, sizeof(header.magic));
+    header.version = BINARY_VERSION;
+    header.addrBits = sizeof(Record::addr) * 8;
+    header.recordSize = sizeof(Record);
+    header.recordCount = recordCount;
+}
+
+// Checks that a binary trace header matches this record layout
+template <typename Addr>
+bool BasicTrace<Addr>::checkHeader(const Header &header, const char *path) {
+    if (memcmp(header.magic, BINARY_MAGIC, sizeof(header.magic)) != 0) {
+        printf("Not a binary trace file %s\n", path);
+        return false;
+    }
+    if (header.version != BINARY_VERSION) {
+        printf("Unsupported trace version %d in %s\n", header.version, path);
+        return false;
+    }
+    if (header.addrBits != sizeof(Record::addr) * 8 ||
+        header.recordSize != sizeof(Record)) {
+        printf("Unsupported record layout (%d-bit address, %d bytes) in %s\n",
+               header.addrBits, header.recordSize, path);
+        return false;
+    }
+    return true;
+}
+
+// Maps a binary trace file and points the records into the mapping
+template <typename Addr>
+bool BasicTrace<Addr>::map(int fd, size_t fileSize, const char *path) {
+    void *base = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) {
+        printf("Unable to map file %s\n", path);
+        return false;
+    }
+    mapping = base;
+    mappingSize = fileSize;
+
+    const Header *header = static_cast<const Header *>(base);
+    if (!checkHeader(*header, path)) {
+        clear();
+        return false;
+    }
+    size_t available = (fileSize - sizeof(Header)) / sizeof(Record);
+    if (header->recordCount == STREAM_RECORDS) {
+        // A stream saved to a file holds as many records as fit
+        recordNum = available;
+    } else if (header->recordCount > available) {
+        printf("Truncated trace file %s\n", path);
+        clear();
+        return false;
+    } else {
+        recordNum = header->recordCount;
+    }
+    records = reinterpret_cast<const Record *>(header + 1);
+    return true;
+}
+
+// Releases the records and any mapping
+template <typename Addr>
+void BasicTrace<Addr>::clear() {
+    if (mapping != nullptr) {
+        munmap(mapping, mappingSize);
+        mapping = nullptr;
+        mappingSize = 0;
+    }
+    std::vector<Record>().swap(decoded);
+    records = nullptr;
+    recordNum = 0;
+}
+
+template class BasicTrace<uint32_t>;
+template class BasicTrace<uint64_t>;
@@ -0,0 +1,139 @@
+/*
+ * In-memory decoded memory trace
+ * The trace is parsed once into a compact array of records which every
+ * simulation can then replay read-only. Binary traces are memory-mapped and
+ * used in place without any parse step.
+ *
+ * Instrumentation tools (a Pin, DynamoRIO or QEMU plugin, say) can feed a
+ * simulator live through a pipe as well: a binary header with recordCount
+ * STREAM_RECORDS, then records until the writer closes the pipe. Records
+ * with the FETCH flag are instruction fetches, the others data accesses.
+ *
+ * TraceConvert can shrink a binary trace for replay: back to back accesses
+ * to one block fold into a single record with a repeat count, and an
+ * L1-filtered trace keeps only the fills and write-backs a fixed L1 sends
+ * to the level below
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Trace format definitions shared by every address width
+class TraceBase {
+public:
+    // Access flags stored in Record::flags
+    enum Flag : uint32_t {
+        WRITE = 1 << 0,           // Write access (read otherwise)
+        PREFETCH = 1 << 1,        // Prefetch read, not a demand access
+        FETCH = 1 << 2,           // Instruction fetch, a read of the I-cache
+        WRITEBACK = 1 << 3,       // With WRITE: a write-back from a filtered
+                                  // level above, not a demand access
+        CORE_MASK = 0xff << 8,    // ID of the issuing core, 0 by default
+        REPEAT_MASK = 0xffffu << 16,  // Times the access repeats right after
+    };
+    static const uint32_t CORE_SHIFT = 8;
+    static const uint32_t MAX_CORE_ID = 0xff;
+    static const uint32_t REPEAT_SHIFT = 16;
+    static const uint32_t MAX_REPEAT = 0xffff;
+
+    // Header of a binary trace file, followed directly by recordCount
+    // records in host (little-endian) byte order
+    struct Header {
+        char magic[4];            // BINARY_MAGIC
+        uint16_t version;         // BINARY_VERSION
+        uint16_t addrBits;        // Width of Record::addr in bits
+        uint32_t recordSize;      // Size of one record in bytes
+        uint32_t reserved;        // Zero
+        uint64_t recordCount;     // Number of records in the file
+    };
+
+    static const char BINARY_MAGIC[4];
+    static const uint16_t BINARY_VERSION = 1;
+
+    // recordCount of a stream whose length is not known up front, read up
+    // to the end of its input
+    static const uint64_t STREAM_RECORDS = ~0ull;
+
+    // Address width a trace file needs: taken from the header of a binary
+    // trace, otherwise 64 if wide is set or a text address within the first
+    // ADDR_SCAN_BYTES has more than eight significant hex digits. A wider
+    // address further on fails the decode of a 32-bit trace, which is then
+    // rerun with wide set. Only the header of standard input ("-") is
+    // peeked at, so a text trace piped in is taken as 64-bit. Returns 0 if
+    // the file cannot be read
+    static const size_t ADDR_SCAN_BYTES = 16 * 1024 * 1024;
+    static uint16_t getAddrBits(const char *path, bool wide = false);
+};
+
+// A decoded trace of Addr-wide addresses; Trace and Trace64 below
+template <typename Addr>
+class BasicTrace : public TraceBase {
+public:
+    // Packed trace record: the accessed address plus its access flags
+    struct Record {
+        Addr addr;                // Accessed address
+        uint32_t flags;           // Combination of Flag bits
+
+        bool isWrite() const { return (flags & WRITE) != 0; }
+        bool isPrefetch() const { return (flags & PREFETCH) != 0; }
+        bool isFetch() const { return (flags & FETCH) != 0; }
+        bool isWriteback() const { return (flags & WRITEBACK) != 0; }
+        uint32_t getCore() const { return (flags & CORE_MASK) >> CORE_SHIFT; }
+        uint32_t getRepeat() const { return flags >> REPEAT_SHIFT; }
+    };
+
+    BasicTrace();
+    ~BasicTrace();
+
+    // Loads a trace file. Uncompressed binary traces are detected by their
+    // magic number and memory-mapped, anything else (text traces with one
+    // "r|w|i 0xADDR [core]" access per line, .gz and .zst files, standard
+    // input given as "-") is decoded through a TraceReader
+    bool load(const char *path);
+
+    // Writes the records as a binary trace file
+    bool save(const char *path) const;
+
+    // Decodes at most maxRecords text records starting at p, appending them
+    // to out. The text must end on a line boundary; p is advanced past the
+    // decoded records. Addresses wider than Addr are malformed
+    static bool decodeText(const char *&p, const char *end, size_t maxRecords,
+                           std::vector<Record> &out);
+
+    // Fills in the header of a binary trace holding recordCount records
+    static void initHeader(Header &header, uint64_t recordCount);
+
+    // Checks that a binary trace header matches this record layout
+    static bool checkHeader(const Header &header, const char *path);
+
+    // Record access for replay
+    const Record *begin() const { return records; }
+    const Record *end() const { return records + recordNum; }
+    size_t size() const { return recordNum; }
+
+private:
+    const Record *records;         // Records in trace order
+    size_t recordNum;              // Number of records
+    std::vector<Record> decoded;   // Storage of records parsed from text
+    void *mapping;                 // Mapped binary trace file, if any
+    size_t mappingSize;            // Size of the mapping in bytes
+
+    // Maps a binary trace file
+    bool map(int fd, size_t fileSize, const char *path);
+
+    // Releases the records and any mapping
+    void clear();
+
+    BasicTrace(const BasicTrace &) = delete;
+    BasicTrace &operator=(const BasicTrace &) = delete;
+};
+
+// Traces of 32-bit (8 byte records) and 64-bit (16 byte records) addresses
+typedef BasicTrace<uint32_t> Trace;
+typedef BasicTrace<uint64_t> Trace64;
+
+#endif
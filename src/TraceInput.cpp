@@ -0,0 +1,218 @@
+/*
+ * Implementation of the trace byte sources
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "TraceInput.h"
+
+// Reads from a file descriptor, retrying when interrupted
+static ssize_t readRetry(int fd, void *buf, size_t len) {
+    ssize_t n;
+    do {
+        n = ::read(fd, buf, len);
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+// Checks whether path ends with the given extension
+static bool hasExtension(const char *path, const char *ext) {
+    size_t pathLen = strlen(path);
+    size_t extLen = strlen(ext);
+    return pathLen >= extLen && strcmp(path + pathLen - extLen, ext) == 0;
+}
+
+// Bytes peekStandardInput() has read and no input has handed out yet
+static std::vector<char> stdinPeeked;
+
+// Uncompressed trace file, preceded by the bytes already read from it
+class FileInput : public TraceInput {
+public:
+    explicit FileInput(int fd, std::vector<char> pending = {})
+        : fd(fd), pending(std::move(pending)), pendingPos(0) {}
+    ~FileInput() { close(fd); }
+
+    ssize_t read(void *buf, size_t len) override {
+        if (pendingPos < pending.size()) {
+            size_t n = std::min(len, pending.size() - pendingPos);
+            memcpy(buf, pending.data() + pendingPos, n);
+            pendingPos += n;
+            return n;
+        }
+        return readRetry(fd, buf, len);
+    }
+
+private:
+    int fd;
+    std::vector<char> pending;      // Peeked bytes to hand out first
+    size_t pendingPos;              // Next byte of pending
+};
+
+#ifdef HAVE_ZLIB
+// Gzip compressed trace file
+class GzipInput : public TraceInput {
+public:
+    explicit GzipInput(gzFile file) : file(file) {
+        gzbuffer(file, 256 * 1024);
+    }
+    ~GzipInput() { gzclose(file); }
+
+    ssize_t read(void *buf, size_t len) override {
+        if (len > INT_MAX)
+            len = INT_MAX;
+        int n = gzread(file, buf, len);
+        if (n < 0) {
+            int code;
+            fprintf(stderr, "gzip: %s\n", gzerror(file, &code));
+            return -1;
+        }
+        return n;
+    }
+
+private:
+    gzFile file;
+};
+#endif
+
+#ifdef HAVE_ZSTD
+// Zstandard compressed trace file
+class ZstdInput : public TraceInput {
+public:
+    ZstdInput(int fd, ZSTD_DStream *stream)
+        : fd(fd), stream(stream), compressed(ZSTD_DStreamInSize()),
+          frameOpen(false) {
+        ZSTD_initDStream(stream);
+        in.src = compressed.data();
+        in.size = 0;
+        in.pos = 0;
+    }
+    ~ZstdInput() {
+        ZSTD_freeDStream(stream);
+        close(fd);
+    }
+
+    ssize_t read(void *buf, size_t len) override {
+        ZSTD_outBuffer out = {buf, len, 0};
+        while (out.pos == 0) {
+            if (in.pos == in.size) {
+                ssize_t n = readRetry(fd, compressed.data(), compressed.size());
+                if (n < 0)
+                    return -1;
+                if (n == 0) {
+                    if (frameOpen) {
+                        fprintf(stderr, "zstd: truncated input\n");
+                        return -1;
+                    }
+                    return 0;
+                }
+                in.size = n;
+                in.pos = 0;
+            }
+            size_t ret = ZSTD_decompressStream(stream, &out, &in);
+            if (ZSTD_isError(ret)) {
+                fprintf(stderr, "zstd: %s\n", ZSTD_getErrorName(ret));
+                return -1;
+            }
+            // A return value of 0 means a frame was completely decoded
+            frameOpen = ret != 0;
+        }
+        return out.pos;
+    }
+
+private:
+    int fd;
+    ZSTD_DStream *stream;
+    std::vector<char> compressed;   // Compressed bytes awaiting decoding
+    ZSTD_inBuffer in;
+    bool frameOpen;                 // Inside a partially decoded frame
+};
+#endif
+
+// Opens a trace file, picking the decompressor from the file extension
+TraceInput *TraceInput::open(const char *path) {
+    bool isGzip = hasExtension(path, ".gz");
+    bool isZstd = hasExtension(path, ".zst");
+
+#ifndef HAVE_ZLIB
+    if (isGzip) {
+        printf("gzip traces are not supported by this build: %s\n", path);
+        return nullptr;
+    }
+#endif
+#ifndef HAVE_ZSTD
+    if (isZstd) {
+        printf("zstd traces are not supported by this build: %s\n", path);
+        return nullptr;
+    }
+#endif
+
+    int fd = strcmp(path, "-") == 0 ? dup(STDIN_FILENO)
+                                    : ::open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("Unable to open file %s\n", path);
+        return nullptr;
+    }
+
+#ifdef HAVE_ZLIB
+    if (isGzip) {
+        gzFile file = gzdopen(fd, "rb");
+        if (file == nullptr) {
+            printf("Unable to open file %s\n", path);
+            close(fd);
+            return nullptr;
+        }
+        return new GzipInput(file);
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if (isZstd) {
+        ZSTD_DStream *stream = ZSTD_createDStream();
+        if (stream == nullptr) {
+            printf("Unable to open file %s\n", path);
+            close(fd);
+            return nullptr;
+        }
+        return new ZstdInput(fd, stream);
+    }
+#endif
+    if (strcmp(path, "-") == 0) {
+        std::vector<char> pending;
+        pending.swap(stdinPeeked);
+        return new FileInput(fd, std::move(pending));
+    }
+    return new FileInput(fd);
+}
+
+// Reads ahead into the bytes the next open("-") hands out first
+ssize_t TraceInput::peekStandardInput(void *buf, size_t len) {
+    while (stdinPeeked.size() < len) {
+        size_t have = stdinPeeked.size();
+        stdinPeeked.resize(len);
+        ssize_t n = readRetry(STDIN_FILENO, stdinPeeked.data() + have,
+                              len - have);
+        stdinPeeked.resize(have + (n > 0 ? n : 0));
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            break;
+    }
+    size_t n = std::min(len, stdinPeeked.size());
+    memcpy(buf, stdinPeeked.data(), n);
+    return n;
+}
@@ -0,0 +1,36 @@
+/*
+ * Byte sources for trace files
+ * Plain files are read directly, .gz and .zst files are decompressed on the
+ * fly while they are read, so compressed traces never have to be expanded
+ * to disk first
+ */
+
+#ifndef TRACE_INPUT_H
+#define TRACE_INPUT_H
+
+#include <cstddef>
+
+#include <sys/types.h>
+
+class TraceInput {
+public:
+    virtual ~TraceInput() {}
+
+    // Reads up to len bytes of (decompressed) trace data. Returns the number
+    // of bytes read, 0 at the end of the input or -1 on error
+    virtual ssize_t read(void *buf, size_t len) = 0;
+
+    // Opens a trace file, picking the decompressor from the file extension;
+    // "-" reads standard input uncompressed. Returns nullptr if the file
+    // cannot be opened or the compression format is not supported by this
+    // build
+    static TraceInput *open(const char *path);
+
+    // Reads up to len bytes from the start of standard input without
+    // consuming them: the input open("-") returns hands them out first.
+    // Returns the number of bytes read, short at the end of the input, or
+    // -1 on error
+    static ssize_t peekStandardInput(void *buf, size_t len);
+};
+
+#endif
@@ -0,0 +1,255 @@
+/*
+ * Implementation of the streaming chunked trace reader
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include "TraceReader.h"
+
+// Initial size of the raw text buffer; grows if a line does not fit
+static const size_t TEXT_BUFFER_SIZE = 1024 * 1024;
+
+template <typename Addr>
+BasicTraceReader<Addr>::BasicTraceReader(size_t chunkRecords)
+    : chunkRecords(chunkRecords > 0 ? chunkRecords : 1), current(-1),
+      finished(true), error(false), stopping(false), input(nullptr),
+      binary(false), remaining(0), textBegin(0), textEnd(0), eof(true) {
+    chunks[0].full = chunks[1].full = false;
+}
+
+template <typename Addr>
+BasicTraceReader<Addr>::~BasicTraceReader() {
+    close();
+}
+
+// Opens a trace file, detects its format and starts the decoder thread
+template <typename Addr>
+bool BasicTraceReader<Addr>::open(const char *path) {
+    close();
+
+    this->path = path;
+    input = TraceInput::open(path);
+    if (input == nullptr) {
+        return false;
+    }
+
+    // Sniff the format from the first bytes. They stay in the text buffer,
+    // so non-seekable inputs work as well
+    text.resize(TEXT_BUFFER_SIZE);
+    ssize_t n = readFully(text.data(), sizeof(TraceBase::Header));
+    if (n < 0) {
+        printf("Unable to read file %s\n", path);
+        close();
+        return false;
+    }
+    textBegin = 0;
+    textEnd = n;
+    eof = n == 0;
+
+    binary = n >= (ssize_t)sizeof(TraceBase::BINARY_MAGIC) &&
+             memcmp(text.data(), TraceBase::BINARY_MAGIC,
+                    sizeof(TraceBase::BINARY_MAGIC)) == 0;
+    if (binary) {
+        TraceBase::Header header;
+        if (n < (ssize_t)sizeof(header)) {
+            printf("Truncated trace file %s\n", path);
+            close();
+            return false;
+        }
+        memcpy(&header, text.data(), sizeof(header));
+        if (!BasicTrace<Addr>::checkHeader(header, path)) {
+            close();
+            return false;
+        }
+        remaining = header.recordCount;
+        std::vector<char>().swap(text);
+    }
+
+    for (Chunk &c : chunks) {
+        c.records.reserve(chunkRecords);
+        c.full = false;
+    }
+    current = -1;
+    finished = error = stopping = false;
+    decoder = std::thread(&BasicTraceReader::decodeLoop, this);
+    return true;
+}
+
+// Hands out the next decoded chunk, releasing the previous one
+template <typename Addr>
+bool BasicTraceReader<Addr>::next(const Record *&begin, const Record *&end) {
+    std::unique_lock<std::mutex> lock(mutex);
+    int i = 0;
+    if (current >= 0) {
+        chunks[current].full = false;
+        i = current ^ 1;
+        current = -1;
+        cond.notify_all();
+    }
+
+    cond.wait(lock, [&]() { return chunks[i].full || finished; });
+    if (!chunks[i].full) {
+        return false;
+    }
+
+    current = i;
+    begin = chunks[i].records.data();
+    end = begin + chunks[i].records.size();
+    return true;
+}
+
+// Whether decoding stopped because of a malformed or unreadable trace
+template <typename Addr>
+bool BasicTraceReader<Addr>::failed() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return error;
+}
+
+// Stops the decoder thread and closes the trace file
+template <typename Addr>
+void BasicTraceReader<Addr>::close() {
+    if (decoder.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cond.notify_all();
+        decoder.join();
+    }
+    delete input;
+    input = nullptr;
+    finished = true;
+    current = -1;
+}
+
+// Decoder thread body: fills the two chunks alternately, waiting whenever
+// the consumer still holds the chunk that is due next
+template <typename Addr>
+void BasicTraceReader<Addr>::decodeLoop() {
+    for (int i = 0;; i ^= 1) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [&]() { return !chunks[i].full || stopping; });
+            if (stopping) {
+                return;
+            }
+        }
+
+        bool ok = decodeChunk(chunks[i].records);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!ok || chunks[i].records.empty()) {
+            error = !ok;
+            finished = true;
+            cond.notify_all();
+            return;
+        }
+        chunks[i].full = true;
+        cond.notify_all();
+    }
+}
+
+// Decodes up to chunkRecords records into out
+template <typename Addr>
+bool BasicTraceReader<Addr>::decodeChunk(std::vector<Record> &out) {
+    return binary ? decodeBinaryChunk(out) : decodeTextChunk(out);
+}
+
+// Decodes text records, only ever up to the last complete line until the
+// input is exhausted
+template <typename Addr>
+bool BasicTraceReader<Addr>::decodeTextChunk(std::vector<Record> &out) {
+    out.clear();
+    while (out.size() < chunkRecords) {
+        const char *begin = text.data() + textBegin;
+        const char *limit = text.data() + textEnd;
+        if (!eof) {
+            const char *newline =
+                static_cast<const char *>(memrchr(begin, '\n', limit - begin));
+            if (newline == nullptr) {
+                if (!refill())
+                    return false;
+                continue;
+            }
+            limit = newline + 1;
+        }
+
+        const char *p = begin;
+        if (!BasicTrace<Addr>::decodeText(p, limit, chunkRecords - out.size(),
+                                          out)) {
+            printf("Malformed trace file %s\n", path.c_str());
+            return false;
+        }
+        textBegin = p - text.data();
+
+        if (p == limit) {
+            if (eof)
+                break;
+            if (!refill())
+                return false;
+        }
+    }
+    return true;
+}
+
+// Reads binary records straight into the chunk. A stream of unknown length
+// ends with its input, on a record boundary
+template <typename Addr>
+bool BasicTraceReader<Addr>::decodeBinaryChunk(std::vector<Record> &out) {
+    size_t n = remaining < chunkRecords ? remaining : chunkRecords;
+    out.resize(n);
+    size_t bytes = n * sizeof(Record);
+    ssize_t got = readFully(out.data(), bytes);
+    if (got >= 0 && remaining == TraceBase::STREAM_RECORDS &&
+        got % sizeof(Record) == 0) {
+        out.resize(got / sizeof(Record));
+        return true;
+    }
+    if (got != (ssize_t)bytes) {
+        printf("Truncated trace file %s\n", path.c_str());
+        return false;
+    }
+    remaining -= n;
+    return true;
+}
+
+// Moves the undecoded tail to the front of the buffer and appends whatever
+// input is available
+template <typename Addr>
+bool BasicTraceReader<Addr>::refill() {
+    size_t tail = textEnd - textBegin;
+    memmove(text.data(), text.data() + textBegin, tail);
+    textBegin = 0;
+    textEnd = tail;
+    if (textEnd == text.size()) {
+        text.resize(text.size() * 2);
+    }
+
+    ssize_t n = input->read(text.data() + textEnd, text.size() - textEnd);
+    if (n < 0) {
+        printf("Unable to read file %s\n", path.c_str());
+        return false;
+    }
+    eof = n == 0;
+    textEnd += n;
+    return true;
+}
+
+// Reads up to len bytes, retrying on short reads
+template <typename Addr>
+ssize_t BasicTraceReader<Addr>::readFully(void *buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = input->read(static_cast<char *>(buf) + done, len - done);
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            break;
+        done += n;
+    }
+    return done;
+}
+
+template class BasicTraceReader<uint32_t>;
+template class BasicTraceReader<uint64_t>;
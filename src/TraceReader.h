@@ -0,0 +1,101 @@
+/*
+ * Streaming chunked trace reader
+ * Decodes a text or binary trace, optionally gzip or zstd compressed, into
+ * fixed-size chunks of records held in reusable buffers. A background
+ * thread decodes the next chunk while the simulator consumes the current
+ * one, so parsing overlaps simulation and memory use stays bounded
+ * regardless of the trace size
+ */
+
+#ifndef TRACE_READER_H
+#define TRACE_READER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "Trace.h"
+#include "TraceInput.h"
+
+// Reader of traces of Addr-wide addresses; TraceReader and TraceReader64
+// below
+template <typename Addr>
+class BasicTraceReader {
+public:
+    typedef typename BasicTrace<Addr>::Record Record;
+
+    static const size_t DEFAULT_CHUNK_RECORDS = 64 * 1024;
+
+    explicit BasicTraceReader(size_t chunkRecords = DEFAULT_CHUNK_RECORDS);
+    ~BasicTraceReader();
+
+    // Opens a trace file and starts decoding in the background
+    bool open(const char *path);
+
+    // Hands out the next chunk of records. The chunk remains valid until the
+    // following call. Returns false at the end of the trace or on error
+    bool next(const Record *&begin, const Record *&end);
+
+    // Whether decoding stopped because of a malformed or unreadable trace
+    bool failed() const;
+
+    // Stops decoding and closes the trace file
+    void close();
+
+private:
+    // Double buffered chunk storage shared with the decoder thread
+    struct Chunk {
+        std::vector<Record> records;
+        bool full;                 // Decoded and not yet released by next()
+    };
+
+    size_t chunkRecords;           // Number of records per chunk
+    Chunk chunks[2];               // Filled alternately by the decoder
+    int current;                   // Chunk handed out by next(), -1 if none
+
+    std::thread decoder;           // Background decoder thread
+    mutable std::mutex mutex;      // Guards the chunk states and flags below
+    std::condition_variable cond;  // Signals chunk state changes
+    bool finished;                 // Decoder reached the end of the trace
+    bool error;                    // Decoder hit a malformed trace
+    bool stopping;                 // close() asked the decoder to quit
+
+    // Decoder-owned input state
+    std::string path;              // Trace file path for diagnostics
+    TraceInput *input;             // Trace byte source
+    bool binary;                   // Binary (true) or text trace
+    uint64_t remaining;            // Records left in a binary trace
+    std::vector<char> text;        // Raw text awaiting decoding
+    size_t textBegin;              // First undecoded byte in text
+    size_t textEnd;                // End of valid bytes in text
+    bool eof;                      // No more input bytes
+
+    // Decoder thread body
+    void decodeLoop();
+
+    // Decodes up to chunkRecords records into out, false on error
+    bool decodeChunk(std::vector<Record> &out);
+    bool decodeTextChunk(std::vector<Record> &out);
+    bool decodeBinaryChunk(std::vector<Record> &out);
+
+    // Reads more raw text, keeping the undecoded tail
+    bool refill();
+
+    // Reads up to len bytes, retrying on short reads; returns bytes read or
+    // -1 on error
+    ssize_t readFully(void *buf, size_t len);
+
+    BasicTraceReader(const BasicTraceReader &) = delete;
+    BasicTraceReader &operator=(const BasicTraceReader &) = delete;
+};
+
+typedef BasicTraceReader<uint32_t> TraceReader;
+typedef BasicTraceReader<uint64_t> TraceReader64;
+
+#endif